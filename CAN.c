@@ -1,5 +1,12 @@
 #include <stm32f4xx.h>
 #include "CAN.h"
+#include "Clock.h"
+#ifdef __CAN_TRACE
+#include "Trace.h"
+#endif
+#ifdef __CAN_LOG
+#include "CanLog.h"
+#endif
 
 /* CAN identifier type */
 #define CAN_ID_STD            ((uint32_t)0x00000000)  /* Standard Id          */
@@ -9,23 +16,131 @@
 #define CAN_RTR_DATA          ((uint32_t)0x00000000)  /* Data frame           */
 #define CAN_RTR_REMOTE        ((uint32_t)0x00000002)  /* Remote frame         */
 
-CAN_msg       CAN_TxMsg[2];                      /* CAN message for sending */
-CAN_msg       CAN_RxMsg[2];                      /* CAN message for receiving */                                
+CAN_dev       CAN_Dev[2] CAN_CCM_DATA = {        /* driver state of CAN1 and CAN2 */
+  { CAN1, 1 },
+  { CAN2, 2 }
+};
+
+#define CAN_SW_BANK   13                         /* mask bank in front of the software filter */
+#define CAN_BTR_TIMING  0x037F03FFUL             /* SJW, TS2, TS1 and BRP fields */
+
+static uint32_t CAN_used;                        /* controllers set up, bit 0 = CAN1 */
+
+
+
+/*----------------------------------------------------------------------------
+  ms since the controller entered its current initialisation state,
+  counted with the DWT cycle counter
+ *----------------------------------------------------------------------------*/
+static uint32_t can_elapsed (CAN_dev *dev)  {
+
+  return ((DWT->CYCCNT - dev->t0) / (CLK_get ()->hclk / 1000));
+}
 
-uint32_t      CAN_TxRdy[2] = {0,0};              /* CAN HW ready to transmit a message */
-uint32_t      CAN_RxRdy[2] = {0,0};              /* CAN HW received a message */
+/*----------------------------------------------------------------------------
+  enter an initialisation state; every way into normal mode takes the
+  mailbox 0 state over into txRdy for CAN_tryWrMsg
+ *----------------------------------------------------------------------------*/
+static void can_state (CAN_dev *dev, uint32_t state)  {
+
+  if (state == CAN_ST_READY) {
+    dev->txRdy = (((CAN_TypeDef *)dev->reg)->TSR & CAN_TSR_TME0) != 0;
+  }
+  dev->state = state;
+  dev->t0    = DWT->CYCCNT;
+}
 
-static uint32_t CAN_filterIdx[2] = {0,0};        /* static variable for the filter index */
+/*----------------------------------------------------------------------------
+  wait at most ms for INAK to become inak, returns 0 on timeout
+ *----------------------------------------------------------------------------*/
+static uint32_t can_waitInak (CAN_TypeDef *pCAN, uint32_t inak, uint32_t ms)  {
+  uint32_t t0  = DWT->CYCCNT;
+  uint32_t cyc = ms * (CLK_get ()->hclk / 1000);
 
+  while ((pCAN->MSR & CAN_MSR_INAK) != inak) {
+    if (DWT->CYCCNT - t0 > cyc) return (0);
+  }
+  return (1);
+}
+
+/*----------------------------------------------------------------------------
+  bit timing for CAN_BITRATE at an APB1 clock of pclk, 0 if there is none
+  the fewest time quanta from 7 up that divide pclk exactly are used, the
+  sample point stays at about 71% (TSEG1 = 4, TSEG2 = 2 at 42 MHz)
+ *----------------------------------------------------------------------------*/
+static uint32_t can_btr (uint32_t pclk)  {
+  uint32_t tq, brp = 0, ts1, ts2;
+
+  for (tq = 7; tq <= 25; tq++) {
+    if (pclk % (CAN_BITRATE * tq) == 0) {
+      brp = pclk / (CAN_BITRATE * tq);
+      break;
+    }
+  }
+  if (brp == 0 || brp > 1024) {
+    return (0);
+  }
+  ts2 = (tq * 2 + 3) / 7;
+  ts1 = tq - 1 - ts2;
+  if (ts1 > 16) {
+    ts2 += ts1 - 16;
+    ts1  = 16;
+  }
+  return ((((3-1) & 0x03) << 24) | (((ts2-1) & 0x07) << 20) | (((ts1-1) & 0x0F) << 16) | ((brp-1) & 0x3FF));
+}
+
+/*----------------------------------------------------------------------------
+  clock profile switch: the controllers in use wait in initialisation mode,
+  so no frame is cut, and get the bit timing of the new APB1 clock
+ *----------------------------------------------------------------------------*/
+static uint32_t can_clock (uint32_t phase, const CLK_info *clk)  {
+  static uint32_t run;                      /* controllers to restart        */
+  CAN_TypeDef    *pCAN;
+  uint32_t        btr = can_btr (clk->pclk1);
+  uint32_t        i;
+
+  if (phase == CLK_CHECK) {
+    return (btr != 0);
+  }
+  for (i = 0; i < 2; i++) {
+    if ((CAN_used & (1UL << i)) == 0) {
+      continue;
+    }
+    pCAN = CAN_Dev[i].reg;
+    if (phase == CLK_PRE) {
+      if ((pCAN->MSR & CAN_MSR_INAK) == 0) run |= 1UL << i;
+      pCAN->MCR = (pCAN->MCR & ~CAN_MCR_SLEEP) | CAN_MCR_INRQ;
+      can_waitInak (pCAN, CAN_MSR_INAK, CAN_INIT_TIMEOUT);  /* frame completes */
+    } else {
+      pCAN->BTR = (pCAN->BTR & ~CAN_BTR_TIMING) | btr;
+      if (CAN_Dev[i].sleep) {
+        pCAN->MCR = (pCAN->MCR & ~CAN_MCR_INRQ) | CAN_MCR_SLEEP;
+      } else if (run & (1UL << i)) {
+        pCAN->MCR &= ~CAN_MCR_INRQ;         /* resynchronises, see CAN_poll  */
+        can_state (&CAN_Dev[i], CAN_ST_SYNC);
+      }
+    }
+  }
+  if (phase == CLK_POST) {
+    run = 0;
+  }
+  return (1);
+}
 
 /*----------------------------------------------------------------------------
   setup CAN interface
+  only requests initialisation mode, the controller is configured by
+  CAN_poll once it got there, so both controllers and the rest of the
+  system initialise in parallel. Calling it again restarts a controller
+  that ended in CAN_ST_ERROR
  *----------------------------------------------------------------------------*/
-void CAN_setup (uint32_t ctrl)  {
-  CAN_TypeDef *pCAN = (ctrl == 1) ? CAN1 : CAN2;
-  uint32_t brp;
+void CAN_setup (CAN_dev *dev)  {
+  CAN_TypeDef *pCAN = dev->reg;
+
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;  /* time base of the timeouts */
+  DWT->CTRL        |= DWT_CTRL_CYCCNTENA_Msk;
 
-  if (ctrl == 1) {
+  if (dev->ctrl == 1) {
     /* Enable clock for CAN1 and GPIOB */
     RCC->APB1ENR   |= (1 << 25);
     RCC->AHB1ENR   |= (1 <<  1);
@@ -40,6 +155,7 @@ void CAN_setup (uint32_t ctrl)  {
   
     NVIC_EnableIRQ   (CAN1_TX_IRQn);         /* Enable CAN1 interrupts */
     NVIC_EnableIRQ   (CAN1_RX0_IRQn);
+    NVIC_EnableIRQ   (CAN1_SCE_IRQn);
   } else {
     /* Enable clock for CAN2 and GPIOB */
     RCC->APB1ENR   |= (1 << 25) | (1 << 26);
@@ -55,100 +171,317 @@ void CAN_setup (uint32_t ctrl)  {
 
     NVIC_EnableIRQ   (CAN2_TX_IRQn);         /* Enable CAN2 interrupts */
     NVIC_EnableIRQ   (CAN2_RX0_IRQn);
+    NVIC_EnableIRQ   (CAN2_SCE_IRQn);
   }
 
   pCAN->MCR = (CAN_MCR_INRQ   |           /* initialisation request           */
-               CAN_MCR_NART    );         /* no automatic retransmission      */
+               CAN_MCR_NART   |           /* no automatic retransmission      */
+               CAN_MCR_AWUM   |           /* leave sleep mode on bus activity */
+               CAN_MCR_TTCM    );         /* time stamp the mailboxes at SOF  */
                                           /* only FIFO 0, tx mailbox 0 used!  */
-  while (!(pCAN->MSR & CAN_MCR_INRQ));
+  dev->start = 0;
+  dev->err   = CAN_OK;
+  dev->txRdy = 0;
+  can_state (dev, CAN_ST_ENTER);
+
+  CAN_used |= 1UL << (dev->ctrl - 1);
+  CLK_notify (can_clock);
+  CAN_poll (dev);                         /* INAK is mostly there already     */
+}
 
-  pCAN->IER = (CAN_IER_FMPIE0 |           /* enable FIFO 0 msg pending IRQ    */
-               CAN_IER_TMEIE    );        /* enable Transmit mbx empty IRQ    */
 
-  /* Note: this calculations fit for CAN (APB1) clock = 42MHz */
-  brp  = (42000000 / 7) / 500000;         /* baudrate is set to 500k bit/s    */
-                                                                          
-  /* set BTR register so that sample point is at about 71% bit time from bit start */
-  /* TSEG1 = 4, TSEG2 = 2, SJW = 3 => 1 CAN bit = 7 TQ, sample at 71%      */
-  pCAN->BTR &= ~(((        0x03) << 24) | ((        0x07) << 20) | ((        0x0F) << 16) | (          0x3FF));
-  pCAN->BTR |=  ((((3-1) & 0x03) << 24) | (((2-1) & 0x07) << 20) | (((4-1) & 0x0F) << 16) | ((brp-1) & 0x3FF));
-}
+/*----------------------------------------------------------------------------
+  leave initialisation mode as soon as the controller is configured,
+  does not wait for the bus, see CAN_poll
+ *----------------------------------------------------------------------------*/
+void CAN_start (CAN_dev *dev)  {
 
+  dev->start = 1;
+  CAN_poll (dev);
+}
 
 /*----------------------------------------------------------------------------
-  leave initialisation mode
+  advance the initialisation of a controller without waiting
+  returns CAN_BUSY while in progress, CAN_OK in normal mode, else the error,
+  CAN_ERR_SETUP for a controller CAN_setup was never called for.
+  Entering initialisation mode has CAN_INIT_TIMEOUT ms, leaving it needs
+  11 recessive bits on the bus and gets CAN_SYNC_TIMEOUT ms; with an
+  unpowered transceiver the controller keeps trying after the error is
+  reported and still joins the bus later
  *----------------------------------------------------------------------------*/
-void CAN_start (uint32_t ctrl)  {
-  CAN_TypeDef *pCAN = (ctrl == 1) ? CAN1 : CAN2;
+int32_t CAN_poll (CAN_dev *dev)  {
+  CAN_TypeDef *pCAN = dev->reg;
+  uint32_t     btr;
+
+  switch (dev->state) {
+    case CAN_ST_ENTER:
+      if ((pCAN->MSR & CAN_MSR_INAK) == 0) {
+        if (can_elapsed (dev) > CAN_INIT_TIMEOUT) {
+          dev->err = CAN_ERR_TIMEOUT;
+          can_state (dev, CAN_ST_ERROR);
+        }
+        break;
+      }
+      /* bit timing follows the APB1 clock of the active clock profile */
+      btr = can_btr (CLK_get ()->pclk1);
+      if (btr == 0) {
+        dev->err = CAN_ERR_CLOCK;
+        can_state (dev, CAN_ST_ERROR);
+        break;
+      }
+      pCAN->IER = (CAN_IER_FMPIE0 |       /* enable FIFO 0 msg pending IRQ    */
+                   CAN_IER_TMEIE  |       /* enable Transmit mbx empty IRQ    */
+                   CAN_IER_WKUIE    );    /* enable wake-up IRQ               */
+      pCAN->BTR = (pCAN->BTR & ~CAN_BTR_TIMING) | btr;
+      can_state (dev, CAN_ST_INIT);
+      /* fall through */
+    case CAN_ST_INIT:
+      if (dev->start) {
+        pCAN->MCR &= ~CAN_MCR_INRQ;       /* normal operating mode, reset INRQ*/
+        can_state (dev, CAN_ST_SYNC);
+      }
+      /* fall through */
+    case CAN_ST_SYNC:
+      if (dev->state != CAN_ST_SYNC) {
+        break;
+      }
+      if ((pCAN->MSR & CAN_MSR_INAK) == 0) {
+        can_state (dev, CAN_ST_READY);
+      } else if (can_elapsed (dev) > CAN_SYNC_TIMEOUT) {
+        dev->err = CAN_ERR_TIMEOUT;
+        can_state (dev, CAN_ST_ERROR);
+      }
+      break;
+    case CAN_ST_ERROR:
+      if (dev->err == CAN_ERR_TIMEOUT && (pCAN->MCR & CAN_MCR_INRQ) == 0 &&
+          (pCAN->MSR & CAN_MSR_INAK) == 0) {
+        dev->err = CAN_OK;                /* joined the bus after all         */
+        can_state (dev, CAN_ST_READY);
+      }
+      break;
+  }
 
-  pCAN->MCR &= ~CAN_MCR_INRQ;             /* normal operating mode, reset INRQ*/
-#ifndef __TEST
-  while (pCAN->MSR & CAN_MCR_INRQ);
-#endif
+  switch (dev->state) {
+    case CAN_ST_RESET: return (CAN_ERR_SETUP);
+    case CAN_ST_READY: return (CAN_OK);
+    case CAN_ST_ERROR: return (dev->err);
+  }
+  return (CAN_BUSY);
 }
 
 /*----------------------------------------------------------------------------
   set the testmode
  *----------------------------------------------------------------------------*/
-void CAN_testmode (uint32_t ctrl, uint32_t testmode) {
-  CAN_TypeDef *pCAN = (ctrl == 1) ? CAN1 : CAN2;
+void CAN_testmode (CAN_dev *dev, uint32_t testmode) {
+  CAN_TypeDef *pCAN = dev->reg;
 
   pCAN->BTR &= ~(CAN_BTR_SILM | CAN_BTR_LBKM);     /* set testmode            */
   pCAN->BTR |=  (testmode & (CAN_BTR_SILM | CAN_BTR_LBKM));
 }
 
 /*----------------------------------------------------------------------------
-  check if transmit mailbox is empty
+  put an idle controller into sleep mode
+  returns 0 if a mailbox is still pending or a frame waits in FIFO 0.
+  The controller wakes up by itself on the next start of frame (AWUM), that
+  frame is lost while the controller synchronises to the bus. Filters,
+  hooks and the mailbox state are kept, so nothing has to be restored
  *----------------------------------------------------------------------------*/
-void CAN_waitReady (uint32_t ctrl)  {
-  CAN_TypeDef *pCAN = (ctrl == 1) ? CAN1 : CAN2;
+uint32_t CAN_sleep (CAN_dev *dev)  {
+  CAN_TypeDef *pCAN = dev->reg;
 
-  while ((pCAN->TSR & CAN_TSR_TME0) == 0);  /* Transmit mailbox 0 is empty    */
-  CAN_TxRdy[ctrl-1] = 1;
+  if ((pCAN->TSR & CAN_TSR_TME) != CAN_TSR_TME || (pCAN->RF0R & CAN_RF0R_FMP0)) {
+    return (0);
+  }
+  dev->sleep = 1;
+  pCAN->MCR |= CAN_MCR_SLEEP;             /* SLAK follows once the bus is idle */
+  return (1);
 }
 
 /*----------------------------------------------------------------------------
-  wite a message to CAN peripheral and transmit it
+  leave sleep mode, does not wait for SLAK to clear; mailboxes loaded
+  meanwhile are sent as soon as the controller is synchronised
  *----------------------------------------------------------------------------*/
-void CAN_wrMsg (uint32_t ctrl, CAN_msg *msg)  {
-  CAN_TypeDef *pCAN = (ctrl == 1) ? CAN1 : CAN2;
+void CAN_wakeup (CAN_dev *dev)  {
+  CAN_TypeDef *pCAN = dev->reg;
+
+  pCAN->MCR &= ~CAN_MCR_SLEEP;
+  dev->sleep = 0;
+}
 
-  pCAN->sTxMailBox[0].TIR  = (uint32_t)0; /* reset TXRQ bit */
+/*----------------------------------------------------------------------------
+  wait until the controller is started and transmit mailbox 0 is empty,
+  bounded by the initialisation timeouts
+ *----------------------------------------------------------------------------*/
+int32_t CAN_waitReady (CAN_dev *dev)  {
+  CAN_TypeDef *pCAN = dev->reg;
+  int32_t      res;
+
+  while ((res = CAN_poll (dev)) == CAN_BUSY);
+  if (res != CAN_OK) {
+    return (res);
+  }
+  can_state (dev, CAN_ST_READY);          /* restarts the clock for TME0      */
+  while ((pCAN->TSR & CAN_TSR_TME0) == 0) {  /* Transmit mailbox 0 is empty   */
+    if (can_elapsed (dev) > CAN_SYNC_TIMEOUT) return (CAN_ERR_TIMEOUT);
+  }
+  dev->txRdy = 1;
+  return (CAN_OK);
+}
+
+/*----------------------------------------------------------------------------
+  load a message into a transmit mailbox, transmission is not yet requested
+ *----------------------------------------------------------------------------*/
+static CAN_RAMFUNC void can_loadMbx (CAN_TypeDef *pCAN, uint32_t mbx, CAN_msg *msg)  {
+
+  pCAN->sTxMailBox[mbx].TIR  = (uint32_t)0; /* reset TXRQ bit */
                                           /* Setup identifier information */
   if (msg->format == STANDARD_FORMAT) {   /*    Standard ID                   */
-    pCAN->sTxMailBox[0].TIR |= (uint32_t)(msg->id << 21) | CAN_ID_STD;
+    pCAN->sTxMailBox[mbx].TIR |= (uint32_t)(msg->id << 21) | CAN_ID_STD;
   } else {                                /* Extended ID                      */
-    pCAN->sTxMailBox[0].TIR |= (uint32_t)(msg->id <<  3) | CAN_ID_EXT;
+    pCAN->sTxMailBox[mbx].TIR |= (uint32_t)(msg->id <<  3) | CAN_ID_EXT;
   }
 
                                           /* Setup type information           */
   if (msg->type == DATA_FRAME)  {         /* DATA FRAME                       */
-    pCAN->sTxMailBox[0].TIR |= CAN_RTR_DATA;
+    pCAN->sTxMailBox[mbx].TIR |= CAN_RTR_DATA;
   } else {                                /* REMOTE FRAME                     */
-    pCAN->sTxMailBox[0].TIR |= CAN_RTR_REMOTE;
+    pCAN->sTxMailBox[mbx].TIR |= CAN_RTR_REMOTE;
   }
                                           /* Setup data bytes                 */
-  pCAN->sTxMailBox[0].TDLR = (((uint32_t)msg->data[3] << 24) | 
-                              ((uint32_t)msg->data[2] << 16) |
-                              ((uint32_t)msg->data[1] <<  8) | 
-                              ((uint32_t)msg->data[0])        );
-  pCAN->sTxMailBox[0].TDHR = (((uint32_t)msg->data[7] << 24) | 
-                              ((uint32_t)msg->data[6] << 16) |
-                              ((uint32_t)msg->data[5] <<  8) |
-                              ((uint32_t)msg->data[4])        );
+  pCAN->sTxMailBox[mbx].TDLR = (((uint32_t)msg->data[3] << 24) | 
+                                ((uint32_t)msg->data[2] << 16) |
+                                ((uint32_t)msg->data[1] <<  8) | 
+                                ((uint32_t)msg->data[0])        );
+  pCAN->sTxMailBox[mbx].TDHR = (((uint32_t)msg->data[7] << 24) | 
+                                ((uint32_t)msg->data[6] << 16) |
+                                ((uint32_t)msg->data[5] <<  8) |
+                                ((uint32_t)msg->data[4])        );
                                           /* Setup length                     */
-  pCAN->sTxMailBox[0].TDTR &= ~CAN_TDT0R_DLC;
-  pCAN->sTxMailBox[0].TDTR |=  (msg->len & CAN_TDT0R_DLC);
+  pCAN->sTxMailBox[mbx].TDTR &= ~CAN_TDT0R_DLC;
+  pCAN->sTxMailBox[mbx].TDTR |=  (msg->len & CAN_TDT0R_DLC);
+}
 
+/*----------------------------------------------------------------------------
+  wite a message to CAN peripheral and transmit it
+ *----------------------------------------------------------------------------*/
+CAN_RAMFUNC void CAN_wrMsg (CAN_dev *dev, CAN_msg *msg)  {
+  CAN_TypeDef *pCAN = dev->reg;
+
+  if (dev->sleep) {
+    CAN_wakeup (dev);
+  }
+  can_loadMbx (pCAN, 0, msg);
   pCAN->IER |= CAN_IER_TMEIE;                 /* enable  TME interrupt        */
   pCAN->sTxMailBox[0].TIR |=  CAN_TI0R_TXRQ;  /* transmit message             */
+#ifdef __CAN_TRACE
+  TRC_frame (dev->ctrl, msg, TRC_TX);
+#endif
+}
+
+/*----------------------------------------------------------------------------
+  write a message into the first empty mailbox selected by mbxMask and
+  transmit it; mailbox 0 belongs to CAN_wrMsg, so callers of this function
+  normally pass mailboxes 1 and 2
+  returns the mailbox used, or -1 if all selected mailboxes are busy
+ *----------------------------------------------------------------------------*/
+CAN_RAMFUNC int32_t CAN_wrMbx (CAN_dev *dev, uint32_t mbxMask, CAN_msg *msg)  {
+  CAN_TypeDef *pCAN = dev->reg;
+  uint32_t     tme  = (pCAN->TSR & CAN_TSR_TME) >> 26;
+  uint32_t     mbx;
+
+  tme &= mbxMask;
+  if (tme == 0) {
+    return (-1);
+  }
+  mbx = (tme & 1) ? 0 : ((tme & 2) ? 1 : 2);
+  if (dev->sleep) {
+    CAN_wakeup (dev);
+  }
+  can_loadMbx (pCAN, mbx, msg);
+  pCAN->sTxMailBox[mbx].TIR |=  CAN_TI0R_TXRQ;  /* transmit message           */
+#ifdef __CAN_TRACE
+  TRC_frame (dev->ctrl, msg, TRC_TX);
+#endif
+  return ((int32_t)mbx);
+}
+
+/*----------------------------------------------------------------------------
+  queue a message like CAN_wrMbx without waiting for the result
+  returns a token, or 0 if all selected mailboxes are busy. When the mailbox
+  completes, dev->txDone is called from the TX interrupt with the token, the
+  status (CAN_OK, CAN_ERR_ALST, CAN_ERR_TERR) and the 16 bit time stamp of
+  the start of frame in bit times. The callback may load the next frame or
+  post an event to a waiting task
+ *----------------------------------------------------------------------------*/
+CAN_RAMFUNC uint32_t CAN_submit (CAN_dev *dev, uint32_t mbxMask, CAN_msg *msg)  {
+  CAN_TypeDef *pCAN    = dev->reg;
+  uint32_t     primask = __get_PRIMASK();
+  uint32_t     tme, mbx, tok;
+
+  __disable_irq();                            /* txDone may submit from the ISR */
+  tme = ((pCAN->TSR & CAN_TSR_TME) >> 26) & mbxMask;
+  if (tme == 0) {
+    __set_PRIMASK(primask);
+    return (0);
+  }
+  mbx = (tme & 1) ? 0 : ((tme & 2) ? 1 : 2);
+  if (++dev->txSeq == 0) {                    /* 0 means no token             */
+    dev->txSeq = 1;
+  }
+  tok = dev->txSeq;
+  if (dev->sleep) {
+    CAN_wakeup (dev);
+  }
+  can_loadMbx (pCAN, mbx, msg);
+  dev->txTok[mbx] = tok;
+  pCAN->IER |= CAN_IER_TMEIE;                 /* completion raises TX interrupt */
+  pCAN->sTxMailBox[mbx].TIR |=  CAN_TI0R_TXRQ;  /* transmit message           */
+  __set_PRIMASK(primask);
+#ifdef __CAN_TRACE
+  TRC_frame (dev->ctrl, msg, TRC_TX);
+#endif
+  return (tok);
+}
+
+/*----------------------------------------------------------------------------
+  transmit a message if the transmit mailbox is free
+  returns 1 if the message was handed to the mailbox, 0 if it is still busy
+ *----------------------------------------------------------------------------*/
+uint32_t CAN_tryWrMsg (CAN_dev *dev, CAN_msg *msg)  {
+  uint32_t primask = __get_PRIMASK();
+
+  __disable_irq();                            /* test and claim TxRdy atomic  */
+  if (dev->txRdy == 0) {
+    __set_PRIMASK(primask);
+    return (0);
+  }
+  dev->txRdy = 0;
+  __set_PRIMASK(primask);
+
+  CAN_wrMsg (dev, msg);
+  return (1);
+}
+
+/*----------------------------------------------------------------------------
+  mask interrupts, returns the previous PRIMASK for CAN_unlock
+ *----------------------------------------------------------------------------*/
+CAN_RAMFUNC uint32_t CAN_lock (void)  {
+  uint32_t primask = __get_PRIMASK();
+
+  __disable_irq();
+  return (primask);
+}
+
+CAN_RAMFUNC void CAN_unlock (uint32_t key)  {
+
+  __set_PRIMASK(key);
 }
 
 /*----------------------------------------------------------------------------
   read a message from CAN peripheral and release it
  *----------------------------------------------------------------------------*/
-void CAN_rdMsg (uint32_t ctrl, CAN_msg *msg)  {
-  CAN_TypeDef *pCAN = (ctrl == 1) ? CAN1 : CAN2;
+CAN_RAMFUNC void CAN_rdMsg (CAN_dev *dev, CAN_msg *msg)  {
+  CAN_TypeDef *pCAN = dev->reg;
 
                                               /* Read identifier information  */
   if ((pCAN->sFIFOMailBox[0].RIR & CAN_ID_EXT) == 0) {
@@ -181,16 +514,80 @@ void CAN_rdMsg (uint32_t ctrl, CAN_msg *msg)  {
 }
 
 
+/*----------------------------------------------------------------------------
+  add an identifier to the software acceptance filter
+  the ids are kept sorted for a binary search from the RX interrupt, the last
+  filter bank runs in mask mode and passes every id that agrees with all
+  software filtered ids in the bits they have in common. With a single id
+  this is an exact match, with many ids the bank opens up and the RX
+  interrupt rejects the surplus before the frame is read
+ *----------------------------------------------------------------------------*/
+static void can_swAdd (CAN_dev *dev, uint32_t key)  {
+  CAN_TypeDef *pCAN = dev->reg;
+  uint32_t    *tab  = dev->swKey;
+  uint32_t     num  = dev->swNum;
+  uint32_t     diff = 0, i, primask;
+
+  for (i = 0; i < num; i++) {
+    if (tab[i] == key) return;              /* already accepted              */
+  }
+  if (num >= CAN_SWFILTER_MAX) {            /* software filter is full       */
+    return;
+  }
+
+  primask = __get_PRIMASK();
+  __disable_irq();                          /* RX interrupt searches tab     */
+  for (i = num; i > 0 && tab[i-1] > key; i--) {
+    tab[i] = tab[i-1];
+  }
+  tab[i] = key;
+  dev->swNum = ++num;
+  __set_PRIMASK(primask);
+
+  for (i = 1; i < num; i++) {
+    diff |= tab[i] ^ tab[0];                /* bits where the ids differ     */
+  }
+
+  pCAN->FMR  |=  CAN_FMR_FINIT;             /* set initMode for filter banks */
+  pCAN->FA1R &= ~(1UL << CAN_SW_BANK);      /* deactivate filter             */
+  pCAN->FS1R |=  (1UL << CAN_SW_BANK);      /* 32-bit scale                  */
+  pCAN->FM1R &= ~(1UL << CAN_SW_BANK);      /* 32-bit identifier mask mode   */
+  pCAN->sFilterRegister[CAN_SW_BANK].FR1 = tab[0] & ~diff;
+  pCAN->sFilterRegister[CAN_SW_BANK].FR2 = ~diff & ~1UL;  /* bit 0 reserved  */
+  pCAN->FFA1R &= ~(1UL << CAN_SW_BANK);     /* assign filter to FIFO 0       */
+  pCAN->FA1R  |=  (1UL << CAN_SW_BANK);     /* activate filter               */
+  pCAN->FMR  &= ~CAN_FMR_FINIT;             /* reset initMode for filterBanks*/
+}
+
+/*----------------------------------------------------------------------------
+  software acceptance check of the frame in FIFO 0 output mailbox
+  only frames that passed the mask bank are searched, the list banks in
+  front of it use two filter numbers each in 32-bit list mode
+ *----------------------------------------------------------------------------*/
+static __inline uint32_t can_swAccept (CAN_dev *dev, CAN_TypeDef *pCAN)  {
+  uint32_t *tab = dev->swKey;
+  uint32_t  lo  = 0, hi = dev->swNum, mid, rir, key;
+
+  if (hi == 0 || ((pCAN->sFIFOMailBox[0].RDTR & CAN_RDT0R_FMI) >> 8) != 2 * CAN_SW_BANK) {
+    return (1);
+  }
+  rir = pCAN->sFIFOMailBox[0].RIR;
+  key = (rir & CAN_ID_EXT) ? (rir & ~1UL) : (rir & 0xFFE00006);
+  while (lo < hi) {
+    mid = (lo + hi) >> 1;
+    if (tab[mid] < key) lo = mid + 1;
+    else                hi = mid;
+  }
+  return (lo < dev->swNum && tab[lo] == key);
+}
+
 /*----------------------------------------------------------------------------
   setup acceptance filter
  *----------------------------------------------------------------------------*/
-void CAN_wrFilter (uint32_t ctrl, uint32_t id, uint8_t format)  {
-   CAN_TypeDef *pCAN = (ctrl == 1) ? CAN1 : CAN2;
+void CAN_wrFilter (CAN_dev *dev, uint32_t id, uint8_t format)  {
+   CAN_TypeDef *pCAN = dev->reg;
    uint32_t      CAN_msgId     = 0;
   
-  if (CAN_filterIdx[ctrl-1] > 13) {                 /* check if Filter Memory is full*/
-    return;
-  }
                                             /* Setup identifier information  */
   if (format == STANDARD_FORMAT)  {         /*   Standard ID                 */
       CAN_msgId |= (uint32_t)(id << 21) | CAN_ID_STD;
@@ -198,71 +595,179 @@ void CAN_wrFilter (uint32_t ctrl, uint32_t id, uint8_t format)  {
       CAN_msgId |= (uint32_t)(id <<  3) | CAN_ID_EXT;
   }
 
+  if (dev->filterIdx >= CAN_SW_BANK) {       /* list banks used up        */
+    can_swAdd (dev, CAN_msgId);                    /* continue in software      */
+    return;
+  }
+
   pCAN->FMR  |=   CAN_FMR_FINIT;            /* set initMode for filter banks */
-  pCAN->FA1R &=  ~(1UL << CAN_filterIdx[ctrl-1]);   /* deactivate filter             */
+  pCAN->FA1R &=  ~(1UL << dev->filterIdx);   /* deactivate filter             */
 
                                             /* initialize filter             */
-  pCAN->FS1R |= (uint32_t)(1 << CAN_filterIdx[ctrl-1]);     /* set 32-bit scale configuration    */
+  pCAN->FS1R |= (uint32_t)(1 << dev->filterIdx);     /* set 32-bit scale configuration    */
 	
 	/*! !* To disable the CAN Filters: Swap the comment on the next two lines and the two lines after the next line. */
-	pCAN->FM1R |= (uint32_t)(1 << CAN_filterIdx[ctrl-1]);   /* set to 32-bit Identifier List mode */
+	pCAN->FM1R |= (uint32_t)(1 << dev->filterIdx);   /* set to 32-bit Identifier List mode */
 	//pCAN->FM1R |= 0x0;    							/* DISABLES FILTERS  set to 32-bit Identifier Mask mode */
 	
-  pCAN->sFilterRegister[CAN_filterIdx[ctrl-1]].FR1 = 0; //CAN_msgId; /*  32-bit identifier   */
+  pCAN->sFilterRegister[dev->filterIdx].FR1 = 0; //CAN_msgId; /*  32-bit identifier   */
 	
 	/* !!*  To disable the CAN Filters: Swap the comment on the next two lines.    */
-  pCAN->sFilterRegister[CAN_filterIdx[ctrl-1]].FR2 = CAN_msgId; 	/*  32-bit identifier (33) for identifier mode  */
-	//pCAN->sFilterRegister[CAN_filterIdx[ctrl-1]].FR2 = 0; 	/*  DISABLES FILTERS  32-bit MASK for mask mode */
+  pCAN->sFilterRegister[dev->filterIdx].FR2 = CAN_msgId; 	/*  32-bit identifier (33) for identifier mode  */
+	//pCAN->sFilterRegister[dev->filterIdx].FR2 = 0; 	/*  DISABLES FILTERS  32-bit MASK for mask mode */
    
    
-  pCAN->FFA1R &= ~(uint32_t)(1 << CAN_filterIdx[ctrl-1]);   /* assign filter to FIFO 0  */
-  pCAN->FA1R  |=  (uint32_t)(1 << CAN_filterIdx[ctrl-1]);   /* activate filter          */
+  pCAN->FFA1R &= ~(uint32_t)(1 << dev->filterIdx);   /* assign filter to FIFO 0  */
+  pCAN->FA1R  |=  (uint32_t)(1 << dev->filterIdx);   /* activate filter          */
 	
   pCAN->FMR &= ~CAN_FMR_FINIT;              /* reset initMode for filterBanks*/
 	
-	CAN_filterIdx[ctrl-1]++;                       /* increase filter index  */
+	dev->filterIdx++;                       /* increase filter index  */
 }
 
 /*----------------------------------------------------------------------------
-  CAN transmit interrupt handler
+  request a TX interrupt when the next mailbox completes, used by modules
+  that refill mailboxes from CAN_txHook
  *----------------------------------------------------------------------------*/
-void CAN1_TX_IRQHandler (void) {
+void CAN_txNotify (CAN_dev *dev)  {
+  CAN_TypeDef *pCAN = dev->reg;
 
-  if (CAN1->TSR & CAN_TSR_RQCP0) {          /* request completed mbx 0        */
-    CAN1->TSR |= CAN_TSR_RQCP0;             /* reset request complete mbx 0   */
-    CAN1->IER &= ~CAN_IER_TMEIE;            /* disable  TME interrupt         */
+  pCAN->IER |= CAN_IER_TMEIE;
+}
 
-	  CAN_TxRdy[0] = 1; 
+/*----------------------------------------------------------------------------
+  report the completed mailboxes that hold a CAN_submit frame, TSR has the
+  RQCP, TXOK, ALST and TERR bits of mailbox n at bit 8n
+ *----------------------------------------------------------------------------*/
+static __inline void can_txDone (CAN_dev *dev, CAN_TypeDef *pCAN, uint32_t tsr)  {
+  uint32_t mbx, tok, bits;
+  int32_t  res;
+
+  for (mbx = 0; mbx < 3; mbx++) {
+    bits = tsr >> (8 * mbx);
+    tok  = dev->txTok[mbx];
+    if ((bits & CAN_TSR_RQCP0) == 0 || tok == 0) {
+      continue;
+    }
+    dev->txTok[mbx] = 0;
+    if      (bits & CAN_TSR_TXOK0) res = CAN_OK;
+    else if (bits & CAN_TSR_ALST0) res = CAN_ERR_ALST;
+    else                           res = CAN_ERR_TERR;
+    if (dev->txDone) {
+      dev->txDone (dev, tok, res, pCAN->sTxMailBox[mbx].TDTR >> 16);
+    }
+  }
+  if (dev->txTok[0] | dev->txTok[1] | dev->txTok[2]) {
+    pCAN->IER |= CAN_IER_TMEIE;             /* more completions to report     */
   }
 }
 
-void CAN2_TX_IRQHandler (void) {
-
-  if (CAN2->TSR & CAN_TSR_RQCP0) {          /* request completed mbx 0        */
-    CAN2->TSR |= CAN_TSR_RQCP0;             /* reset request complete mbx 0   */
-    CAN2->IER &= ~CAN_IER_TMEIE;            /* disable  TME interrupt         */
-	  CAN_TxRdy[1] = 1; 
+/*----------------------------------------------------------------------------
+  CAN transmit interrupt handler
+ *----------------------------------------------------------------------------*/
+static __inline void can_txIRQ (CAN_dev *dev)  {
+  CAN_TypeDef *pCAN = dev->reg;
+  uint32_t     tsr  = pCAN->TSR;
+  uint32_t     done, ok;
+
+  if (tsr & CAN_TSR_RQCP0) {                /* request completed mbx 0        */
+    pCAN->TSR |= CAN_TSR_RQCP0;             /* reset request complete mbx 0   */
+    pCAN->IER &= ~CAN_IER_TMEIE;            /* disable  TME interrupt         */
+    dev->txRdy = 1;
+  }
+  if (tsr & (CAN_TSR_RQCP1 | CAN_TSR_RQCP2)) {
+    pCAN->TSR = tsr & (CAN_TSR_RQCP1 | CAN_TSR_RQCP2);  /* reset mbx 1, 2     */
+  }
+  done = tsr & (CAN_TSR_RQCP0 | CAN_TSR_RQCP1 | CAN_TSR_RQCP2);
+  ok   = (tsr >> 1) & done;                 /* TXOKx is the bit above RQCPx   */
+  done ^= ok;
+  dev->txOk  += (ok   & 1) + ((ok   >> 8) & 1) + ((ok   >> 16) & 1);
+  dev->txErr += (done & 1) + ((done >> 8) & 1) + ((done >> 16) & 1);
+  can_txDone (dev, pCAN, tsr);
+  if (dev->txHook) {                        /* hook may re-enable TMEIE       */
+    dev->txHook (dev, tsr);
   }
 }
 
+CAN_RAMFUNC void CAN1_TX_IRQHandler (void) {
+
+  can_txIRQ (&CAN_Dev[0]);
+}
+
+CAN_RAMFUNC void CAN2_TX_IRQHandler (void) {
+
+  can_txIRQ (&CAN_Dev[1]);
+}
+
 
 /*----------------------------------------------------------------------------
   CAN receive interrupt handler
  *----------------------------------------------------------------------------*/
-void CAN1_RX0_IRQHandler (void) {
+static __inline void can_rxIRQ (CAN_dev *dev)  {
+  CAN_TypeDef *pCAN = dev->reg;
 
-  if (CAN1->RF0R & CAN_RF0R_FMP0) {			    /* message pending ?              */
-	  CAN_rdMsg (1, &CAN_RxMsg[0]);           /* read the message               */
+  if (pCAN->RF0R & CAN_RF0R_FOVR0) {        /* FIFO 0 overrun                 */
+    pCAN->RF0R = CAN_RF0R_FOVR0;
+    dev->rxOvr++;
+  }
+  if (pCAN->RF0R & CAN_RF0R_FMP0) {         /* message pending ?              */
+    if (can_swAccept (dev, pCAN) == 0) {
+      pCAN->RF0R |= CAN_RF0R_RFOM0;         /* not wanted, release mailbox    */
+      dev->rxDrop++;
+      return;
+    }
+    CAN_rdMsg (dev, &dev->rxMsg);           /* read the message               */
+    dev->rxCnt++;
+#ifdef __CAN_TRACE
+    TRC_frame (dev->ctrl, &dev->rxMsg, TRC_RX);
+#endif
+#ifdef __CAN_LOG
+    LOG_frame (dev->ctrl, &dev->rxMsg);
+#endif
 
-    CAN_RxRdy[0] = 1;                       /*  set receive flag              */
+    if (dev->rxHook == 0 || dev->rxHook (dev, &dev->rxMsg) == 0) {
+      dev->rxRdy = 1;                       /*  set receive flag if not consumed */
+    }
   }
 }
 
-void CAN2_RX0_IRQHandler (void) {
+/*----------------------------------------------------------------------------
+  CAN status change interrupt handler
+  the controller left sleep mode because of bus activity, modules that
+  refill mailboxes from CAN_txHook get a call to resume their queues
+ *----------------------------------------------------------------------------*/
+static __inline void can_sceIRQ (CAN_dev *dev)  {
+  CAN_TypeDef *pCAN = dev->reg;
+
+  if (pCAN->MSR & CAN_MSR_WKUI) {
+    pCAN->MSR = CAN_MSR_WKUI;               /* clear wake-up flag             */
+    dev->sleep = 0;
+    dev->wakeCnt++;
+    if (dev->txHook) {
+      dev->txHook (dev, 0);
+    }
+  }
+}
 
-  if (CAN2->RF0R & CAN_RF0R_FMP0) {			    /* message pending ?              */
-	  CAN_rdMsg (2, &CAN_RxMsg[1]);           /* read the message               */
+void CAN1_SCE_IRQHandler (void) {
 
-    CAN_RxRdy[1] = 1;                       /*  set receive flag              */
-  }
+  can_sceIRQ (&CAN_Dev[0]);
 }
+
+void CAN2_SCE_IRQHandler (void) {
+
+  can_sceIRQ (&CAN_Dev[1]);
+}
+
+
+#ifndef __CAN_RX_USER                     /* vectors may come from CanCtrl.hpp */
+CAN_RAMFUNC void CAN1_RX0_IRQHandler (void) {
+
+  can_rxIRQ (&CAN_Dev[0]);
+}
+
+CAN_RAMFUNC void CAN2_RX0_IRQHandler (void) {
+
+  can_rxIRQ (&CAN_Dev[1]);
+}
+#endif
@@ -16,12 +16,52 @@
 #ifndef __CAN_H
 #define __CAN_H
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define STANDARD_FORMAT  0
 #define EXTENDED_FORMAT  1
 
 #define DATA_FRAME       0
 #define REMOTE_FRAME     1
 
+#define CAN_SWFILTER_MAX 256             /* ids accepted behind the last filter bank */
+#define CAN_BITRATE   500000             /* bit rate kept across clock profiles */
+#define CAN_INIT_TIMEOUT  10             /* ms to enter initialisation mode */
+#define CAN_SYNC_TIMEOUT 100             /* ms to see 11 recessive bits after start */
+
+/* CAN result codes */
+#define CAN_OK           0
+#define CAN_BUSY         1               /* initialisation still in progress */
+#define CAN_ERR_TIMEOUT -1               /* INAK did not follow INRQ in time */
+#define CAN_ERR_CLOCK   -2               /* no bit timing for the APB1 clock */
+#define CAN_ERR_ALST    -3               /* arbitration lost, not retried (NART) */
+#define CAN_ERR_TERR    -4               /* transmission error or aborted */
+#define CAN_ERR_SETUP   -5               /* CAN_setup not called */
+
+/* initialisation states of CAN_dev, advanced by CAN_poll */
+#define CAN_ST_RESET     0               /* CAN_setup not called yet */
+#define CAN_ST_ENTER     1               /* INRQ set, waiting for INAK */
+#define CAN_ST_INIT      2               /* configured, waiting for CAN_start */
+#define CAN_ST_SYNC      3               /* INRQ cleared, waiting for bus idle */
+#define CAN_ST_READY     4               /* normal mode */
+#define CAN_ST_ERROR     5               /* timed out, see CAN_dev.err */
+
+/* Memory placement, build with __CAN_RAM to run the CAN interrupt paths from
+   SRAM (no flash wait states) and to keep driver state and frame buffers in
+   the 64 KB core coupled memory, see Flash/CAN.sct. CCM is not reachable by
+   DMA, buffers filled by DMA must not use CAN_CCM */
+#ifdef __CAN_RAM
+#define CAN_RAMFUNC      __attribute__((section("RAMCODE")))
+#define CAN_CCM          __attribute__((section("CCMRAM"), zero_init))
+#define CAN_CCM_DATA     __attribute__((section("CCMDATA")))
+#else
+#define CAN_RAMFUNC
+#define CAN_CCM
+#define CAN_CCM_DATA
+#endif
+
 typedef struct  {
   unsigned int   id;                    /* 29 bit identifier */
   unsigned char  data[8];               /* Data field */
@@ -30,20 +70,71 @@ typedef struct  {
   unsigned char  type;                  /* 0 - DATA FRAME, 1 - REMOTE FRAME */
 } CAN_msg;
 
+typedef struct CAN_dev CAN_dev;
+
+/* hooks get the handle of the controller, dev->ctrl is its number 1 or 2 */
+typedef void     (*CAN_txFunc) (CAN_dev *dev, uint32_t tsr);
+typedef uint32_t (*CAN_rxFunc) (CAN_dev *dev, CAN_msg *msg);
+typedef void     (*CAN_doneFunc) (CAN_dev *dev, uint32_t token, int32_t status, uint32_t time);
+
+/* driver state of one controller, CAN_Dev[0] is CAN1, CAN_Dev[1] is CAN2 */
+struct CAN_dev  {
+  void          *reg;                   /* CAN_TypeDef of the controller */
+  uint32_t       ctrl;                  /* controller number 1 or 2 */
+  volatile uint32_t txRdy;              /* CAN HW ready to transmit a message */
+  volatile uint32_t rxRdy;              /* CAN HW received a message */
+  volatile uint32_t sleep;              /* sleep requested, cleared on wake-up */
+  uint32_t       state;                 /* CAN_ST_xxx */
+  uint32_t       start;                 /* CAN_start called */
+  uint32_t       t0;                    /* DWT cycle count at entry of state */
+  int32_t        err;                   /* CAN_ERR_xxx of CAN_ST_ERROR */
+  CAN_txFunc     txHook;                /* called from TX interrupt with TSR */
+  CAN_rxFunc     rxHook;                /* called from RX interrupt, 1 = consumed */
+  CAN_doneFunc   txDone;                /* called from TX interrupt for CAN_submit frames */
+  uint32_t       txTok[3];              /* token of the frame in each mailbox, 0 = none */
+  uint32_t       txSeq;                 /* last token handed out */
+  CAN_msg        txMsg;                 /* CAN message for sending */
+  CAN_msg        rxMsg;                 /* CAN message for receiving */
+  uint32_t       txOk;                  /* mailboxes sent successfully */
+  uint32_t       txErr;                 /* mailboxes completed with error */
+  uint32_t       rxCnt;                 /* frames received */
+  uint32_t       rxDrop;                /* frames rejected by software filter */
+  uint32_t       rxOvr;                 /* FIFO 0 overruns */
+  uint32_t       wakeCnt;               /* wake-ups by bus activity */
+  uint32_t       filterIdx;             /* next free filter bank */
+  uint32_t       swNum;                 /* ids in the software filter */
+  uint32_t       swKey[CAN_SWFILTER_MAX];  /* sorted RIR images of these ids */
+};
+
+#define CAN_DEV(ctrl)    (&CAN_Dev[(ctrl) - 1])
+
 /* Functions defined in module CAN.c */
-void CAN_setup         (uint32_t ctrl);
-void CAN_start         (uint32_t ctrl);
-void CAN_waitReady     (uint32_t ctrl);
-void CAN_wrMsg         (uint32_t ctrl, CAN_msg *msg);
-void CAN_rdMsg         (uint32_t ctrl, CAN_msg *msg);
-void CAN_wrFilter      (uint32_t ctrl, uint32_t id, uint8_t filter_type);
-
-void CAN_testmode      (uint32_t ctrl, uint32_t testmode);
-
-extern CAN_msg       CAN_TxMsg[2];      /* CAN messge for sending */
-extern CAN_msg       CAN_RxMsg[2];      /* CAN message for receiving */                                
-extern unsigned int  CAN_TxRdy[2];      /* CAN HW ready to transmit a message */
-extern unsigned int  CAN_RxRdy[2];      /* CAN HW received a message */
+void CAN_setup         (CAN_dev *dev);
+void CAN_start         (CAN_dev *dev);
+int32_t  CAN_poll      (CAN_dev *dev);
+int32_t  CAN_waitReady (CAN_dev *dev);
+void CAN_wrMsg         (CAN_dev *dev, CAN_msg *msg);
+uint32_t CAN_tryWrMsg  (CAN_dev *dev, CAN_msg *msg);
+int32_t  CAN_wrMbx     (CAN_dev *dev, uint32_t mbxMask, CAN_msg *msg);
+uint32_t CAN_submit    (CAN_dev *dev, uint32_t mbxMask, CAN_msg *msg);
+void CAN_txNotify      (CAN_dev *dev);
+void CAN_rdMsg         (CAN_dev *dev, CAN_msg *msg);
+void CAN_wrFilter      (CAN_dev *dev, uint32_t id, uint8_t filter_type);
+
+void CAN_testmode      (CAN_dev *dev, uint32_t testmode);
+uint32_t CAN_sleep     (CAN_dev *dev);
+void CAN_wakeup        (CAN_dev *dev);
+
+/* critical section against the CAN interrupts, for state that the hooks
+   share with the main loop; nests, the key restores the previous state */
+uint32_t CAN_lock      (void);
+void CAN_unlock        (uint32_t key);
+
+extern CAN_dev       CAN_Dev[2];
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
 
@@ -0,0 +1,131 @@
+/*----------------------------------------------------------------------------
+ * Name:    CanCtrl.hpp
+ * Purpose: compile time specialised CAN controller access (C++)
+ * Note(s): header only. The controller base address, the number of TX
+ *          mailboxes in use and the RX FIFO are template parameters, so
+ *          every register access below has a constant address and the
+ *          functions inline to straight-line loads and stores.
+ *
+ *          The C API of CAN.h stays the driver of record: CAN_setup,
+ *          CAN_wrFilter and the hooks keep working and CAN_Dev holds the
+ *          state. CanCtrl only replaces the per-frame paths.
+ *
+ *          To inline the RX interrupt, build CAN.c with __CAN_RX_USER
+ *          defined and provide the vector in the application:
+ *
+ *            uint32_t onFrame (CAN_msg *msg) { ... }
+ *            extern "C" void CAN1_RX0_IRQHandler (void) {
+ *              Can1::rxIRQ<onFrame> ();
+ *            }
+ *
+ *          The software acceptance stage and the statistics of CAN_Dev
+ *          are not applied on this path.
+ *----------------------------------------------------------------------------*/
+
+#ifndef __CANCTRL_HPP
+#define __CANCTRL_HPP
+
+#include <stdint.h>
+#include <stm32f4xx.h>
+#include "CAN.h"
+
+template <uint32_t Base, uint32_t Mailboxes = 3, uint32_t Fifo = 0>
+class CanCtrl  {
+  typedef char checkMbx [(Mailboxes >= 1 && Mailboxes <= 3) ? 1 : -1];
+  typedef char checkFifo[(Fifo <= 1) ? 1 : -1];
+
+public:
+  enum { MBX_MASK = (1u << Mailboxes) - 1 };
+
+  static CAN_TypeDef *reg (void)  {
+    return (reinterpret_cast<CAN_TypeDef *>(Base));
+  }
+
+  /*--------------------------------------------------------------------------
+    load mailbox 'mbx' and request transmission, the mailbox must be empty
+   *--------------------------------------------------------------------------*/
+  static void wrMsg (uint32_t mbx, const CAN_msg *msg)  {
+    CAN_TxMailBox_TypeDef *mb = &reg()->sTxMailBox[mbx];
+    uint32_t               tir;
+
+    tir = (msg->format == STANDARD_FORMAT) ? (msg->id << 21)
+                                           : ((msg->id << 3) | CAN_TI0R_IDE);
+    if (msg->type != DATA_FRAME) tir |= CAN_TI0R_RTR;
+
+    mb->TDTR = msg->len & CAN_TDT0R_DLC;
+    mb->TDLR = ((uint32_t)msg->data[3] << 24) | ((uint32_t)msg->data[2] << 16) |
+               ((uint32_t)msg->data[1] <<  8) |  (uint32_t)msg->data[0];
+    mb->TDHR = ((uint32_t)msg->data[7] << 24) | ((uint32_t)msg->data[6] << 16) |
+               ((uint32_t)msg->data[5] <<  8) |  (uint32_t)msg->data[4];
+    mb->TIR  = tir | CAN_TI0R_TXRQ;       /* id and request in one store   */
+  }
+
+  /*--------------------------------------------------------------------------
+    write to the first empty mailbox of mbxMask, returns it or -1 if busy
+   *--------------------------------------------------------------------------*/
+  static int32_t wrMbx (const CAN_msg *msg, uint32_t mbxMask = MBX_MASK)  {
+    uint32_t tme = ((reg()->TSR & CAN_TSR_TME) >> 26) & mbxMask & MBX_MASK;
+    uint32_t mbx;
+
+    if (tme == 0) return (-1);
+    mbx = (tme & 1) ? 0 : ((tme & 2) ? 1 : 2);
+    wrMsg (mbx, msg);
+    return ((int32_t)mbx);
+  }
+
+  /*--------------------------------------------------------------------------
+    number of frames waiting in the RX FIFO
+   *--------------------------------------------------------------------------*/
+  static uint32_t pending (void)  {
+    return ((Fifo ? reg()->RF1R : reg()->RF0R) & CAN_RF0R_FMP0);
+  }
+
+  /*--------------------------------------------------------------------------
+    read the FIFO output mailbox and release it
+   *--------------------------------------------------------------------------*/
+  static void rdMsg (CAN_msg *msg)  {
+    CAN_FIFOMailBox_TypeDef *mb  = &reg()->sFIFOMailBox[Fifo];
+    uint32_t                 rir = mb->RIR;
+    uint32_t                 lo  = mb->RDLR;
+    uint32_t                 hi  = mb->RDHR;
+
+    if (rir & CAN_RI0R_IDE) {
+      msg->format = EXTENDED_FORMAT;
+      msg->id     = rir >> 3;
+    } else {
+      msg->format = STANDARD_FORMAT;
+      msg->id     = rir >> 21;
+    }
+    msg->type    = (rir & CAN_RI0R_RTR) ? REMOTE_FRAME : DATA_FRAME;
+    msg->len     = mb->RDTR & CAN_RDT0R_DLC;
+    msg->data[0] = (uint8_t)(lo      );
+    msg->data[1] = (uint8_t)(lo >>  8);
+    msg->data[2] = (uint8_t)(lo >> 16);
+    msg->data[3] = (uint8_t)(lo >> 24);
+    msg->data[4] = (uint8_t)(hi      );
+    msg->data[5] = (uint8_t)(hi >>  8);
+    msg->data[6] = (uint8_t)(hi >> 16);
+    msg->data[7] = (uint8_t)(hi >> 24);
+
+    if (Fifo) reg()->RF1R = CAN_RF1R_RFOM1;
+    else      reg()->RF0R = CAN_RF0R_RFOM0;
+  }
+
+  /*--------------------------------------------------------------------------
+    RX interrupt body, drains the FIFO into Handler
+   *--------------------------------------------------------------------------*/
+  template <uint32_t (*Handler)(CAN_msg *)>
+  static void rxIRQ (void)  {
+    CAN_msg msg;
+
+    while (pending ()) {
+      rdMsg (&msg);
+      Handler (&msg);
+    }
+  }
+};
+
+typedef CanCtrl<CAN1_BASE> Can1;
+typedef CanCtrl<CAN2_BASE> Can2;
+
+#endif
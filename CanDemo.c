@@ -2,7 +2,10 @@
 #include <stm32f4xx.h>
 #include "Serial.h"
 #include "CAN.h"
-#include "LED.h"
+#include "LedStatus.h"
+#include "Cyclic.h"
+#include "Clock.h"
+#include "CanLog.h"
 #include "stm32f4xx_hal.h"
 
 unsigned int val_Tx = 0, val_Rx = 0;              /* Globals used for display */
@@ -30,15 +33,12 @@ void Delay (uint32_t dlyTicks) {
  *---------------------------------------------------------------------------*/
 void val_display (void) {
 
-  LED_Out (val_Rx);                               /* display RX val on LEDs  */
   printf ("Tx: 0x%02X, Rx: 0x%02X\r\n", val_Tx, val_Rx); // send out Printf Viewer
   Delay (10);                                     /* delay for 10ms           */
 }
 
 /* System Clock Configuration */
 void SystemClock_Config(void) {
-  RCC_OscInitTypeDef RCC_OscInitStruct;
-  RCC_ClkInitTypeDef RCC_ClkInitStruct;
 
   /* Enable Power Control clock */
   __PWR_CLK_ENABLE();
@@ -47,39 +47,33 @@ void SystemClock_Config(void) {
      device is clocked below the maximum system frequency (see datasheet). */
   __HAL_PWR_VOLTAGESCALING_CONFIG(PWR_REGULATOR_VOLTAGE_SCALE1);
 
-  /* Enable HSE Oscillator and activate PLL with HSE as source */
-  RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSE;
-  RCC_OscInitStruct.HSEState = RCC_HSE_ON;
-  RCC_OscInitStruct.PLL.PLLState = RCC_PLL_ON;
-  RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_HSE;
-  RCC_OscInitStruct.PLL.PLLM = 8;
-  RCC_OscInitStruct.PLL.PLLN = 336;
-  RCC_OscInitStruct.PLL.PLLP = RCC_PLLP_DIV2;
-  RCC_OscInitStruct.PLL.PLLQ = 7;
-  HAL_RCC_OscConfig(&RCC_OscInitStruct);
-
-  /* Select PLL as system clock source and configure the HCLK, PCLK1 and PCLK2
-     clocks dividers */
-  RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_SYSCLK | RCC_CLOCKTYPE_PCLK1 |
-                                RCC_CLOCKTYPE_PCLK2;
-  RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK;
-  RCC_ClkInitStruct.AHBCLKDivider = RCC_SYSCLK_DIV1;
-  RCC_ClkInitStruct.APB1CLKDivider = RCC_HCLK_DIV4;
-  RCC_ClkInitStruct.APB2CLKDivider = RCC_HCLK_DIV2;
-  HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_5);
+  /* HSE 8 MHz, PLL 336 MHz / 2: SYSCLK 168 MHz, APB1 42 MHz, APB2 84 MHz */
+  CLK_set (CLK_FULL);
 }
 
 /*----------------------------------------------------------------------------
-  initialize CAN interface
+  initialize CAN interface, the controllers start in the background
  *----------------------------------------------------------------------------*/
 void can_Init (void) {
-  CAN_setup (1);                                  /* setup CAN Controller #1  */
-  CAN_setup (2);                                  /* setup CAN Controller #2  */
-  CAN_wrFilter (1, 33, STANDARD_FORMAT);          /* Enable reception of msgs */
-  CAN_start (1);                                  /* start CAN Controller #1  */
-  CAN_start (2);                                  /* start CAN Controller #2  */
-  CAN_waitReady (1);                              /* wait til tx mbx is empty */
-  CAN_waitReady (2);                              /* wait til tx mbx is empty */
+  CAN_setup (CAN_DEV(1));                         /* setup CAN Controller #1  */
+  CAN_setup (CAN_DEV(2));                         /* setup CAN Controller #2  */
+  CAN_wrFilter (CAN_DEV(1), 33, STANDARD_FORMAT); /* Enable reception of msgs */
+  CAN_start (CAN_DEV(1));                         /* start CAN Controller #1  */
+  CAN_start (CAN_DEV(2));                         /* start CAN Controller #2  */
+}
+
+/*----------------------------------------------------------------------------
+  wait for both controllers, bounded by the CAN init timeouts
+ *----------------------------------------------------------------------------*/
+void can_Ready (void) {
+  int32_t res1, res2;
+
+  do {
+    res1 = CAN_poll (CAN_DEV(1));
+    res2 = CAN_poll (CAN_DEV(2));
+  } while (res1 == CAN_BUSY || res2 == CAN_BUSY);
+  if (res1 != CAN_OK) printf ("CAN1 not ready (%d)\r\n", (int)res1);
+  if (res2 != CAN_OK) printf ("CAN2 not ready (%d)\r\n", (int)res2);
 }
 
 /*----------------------------------------------------------------------------
@@ -88,37 +82,46 @@ void can_Init (void) {
 int main (void)  {
   int i;
   SystemClock_Config();
-  LED_Init ();                                    /* initialize the LEDs      */
+  LST_init ();                                    /* bus status on the LEDs   */
 
   SystemCoreClockUpdate();                        /* Get Core Clock Frequency */
   SysTick_Config(SystemCoreClock /1000);          /* SysTick 1 msec irq       */
+#ifdef __CAN_LOG
+  LOG_init ();                                    /* continue the flash log   */
+#endif
 	can_Init ();                                    /* initialize CAN interface */
 
-  CAN_TxMsg[1].id = 33;                           /* initialize msg to send   */
-  for (i = 0; i < 8; i++) CAN_TxMsg[0].data[i] = 0;
-  CAN_TxMsg[1].len = 1;
-  CAN_TxMsg[1].format = STANDARD_FORMAT;
-	CAN_TxMsg[1].type = DATA_FRAME;
+  CAN_Dev[1].txMsg.id = 33;                       /* initialize msg to send   */
+  for (i = 0; i < 8; i++) CAN_Dev[0].txMsg.data[i] = 0;
+  CAN_Dev[1].txMsg.len = 1;
+  CAN_Dev[1].txMsg.format = STANDARD_FORMAT;
+	CAN_Dev[1].txMsg.type = DATA_FRAME;
+	for (i = 1; i < 8; i++) CAN_Dev[1].txMsg.data[i] = 0x77;
+
+  CYC_init ();                                    /* tx msg on CAN Ctrl #2    */
+  can_Ready ();                                   /* CAN started meanwhile    */
+  CYC_add (CAN_DEV(2), &CAN_Dev[1].txMsg, 500, CYC_AUTO);  /* every 500 ms from TIM7   */
+  CYC_start ();
 
   while (1) {
 
     val_Tx = (val_Tx + 1) % 15;
-
-    if (CAN_TxRdy[1]) {                           /* tx msg on CAN Ctrl #2    */
-      CAN_TxRdy[1] = 0;
-      CAN_TxMsg[1].data[0] = val_Tx;              /* data[0] = ADC value      */
-			for (i = 1; i < 8; i++) CAN_TxMsg[1].data[i] = 0x77;
-      CAN_wrMsg (2, &CAN_TxMsg[1]);               /* transmit message         */
-    }
+    CAN_Dev[1].txMsg.data[0] = val_Tx;            /* sent with next period    */
 
     Delay (10);                                   /* delay for 10ms           */
 
-    if (CAN_RxRdy[0]) {                           /* rx msg on CAN Ctrl #1    */
-      CAN_RxRdy[0] = 0;
-      val_Rx = CAN_RxMsg[0].data[0];
+    if (CAN_Dev[0].rxRdy) {                       /* rx msg on CAN Ctrl #1    */
+      CAN_Dev[0].rxRdy = 0;
+      val_Rx = CAN_Dev[0].rxMsg.data[0];
     }
 
     val_display ();                               /* display TX and RX values */
+#ifdef __CAN_LOG
+    LOG_process ();                               /* program logged frames    */
+    if (LOG_erasePending ()) {
+      LOG_erase ();                               /* the demo can stall 1..2 s */
+    }
+#endif
     Delay (500);                                  /* delay for 500ms          */
   }
 }
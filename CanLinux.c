@@ -0,0 +1,587 @@
+#define _GNU_SOURCE                             /* recvmmsg / sendmmsg         */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include "CanLinux.h"
+
+/* TSR bits passed to CAN_txHook: request completed / transmission ok */
+#define LNX_TSR_MBX(m)    (0x00000003UL << (8 * (m)))
+#define LNX_TSR_TXOK      0x00020202UL
+
+typedef struct  {
+  int              fd;                  /* raw socket, -1 in process */
+  const char      *ifName;
+  uint32_t         started;             /* CAN_start called */
+  uint32_t         testmode;            /* CAN_BTR_SILM / CAN_BTR_LBKM */
+  uint32_t         notify;              /* CAN_txNotify pending */
+  struct can_frame tx[LNX_BATCH];       /* frames handed to the "mailboxes" */
+  uint32_t         tok[LNX_BATCH];      /* CAN_submit token of each frame, 0 none */
+  uint32_t         txNum;
+  uint32_t         txTsr;               /* mailboxes used since last flush */
+  struct can_frame rx[LNX_BATCH];       /* last recvmmsg batch, the "FIFO" */
+  uint32_t         rxNum;
+  uint32_t         rxIdx;
+  struct can_frame loc[LNX_LOCAL];      /* frames from the own process */
+  uint32_t         locIn;
+  uint32_t         locOut;
+} LNX_port;
+
+static LNX_port    LNX_tab[2] = {
+  { .fd = -1, .ifName = LNX_IFNAME },
+  { .fd = -1, .ifName = LNX_IFNAME }
+};
+static uint32_t    LNX_transport = LNX_SOCKET;
+
+CAN_dev       CAN_Dev[2] = {                     /* driver state of CAN1 and CAN2 */
+  { .reg = &LNX_tab[0], .ctrl = 1 },
+  { .reg = &LNX_tab[1], .ctrl = 2 }
+};
+
+
+/*----------------------------------------------------------------------------
+  CAN_msg <-> struct can_frame
+ *----------------------------------------------------------------------------*/
+static void lnx_toFrame (const CAN_msg *msg, struct can_frame *f)  {
+
+  memset (f, 0, sizeof (*f));
+  if (msg->format == STANDARD_FORMAT) {
+    f->can_id = msg->id & CAN_SFF_MASK;
+  } else {
+    f->can_id = (msg->id & CAN_EFF_MASK) | CAN_EFF_FLAG;
+  }
+  if (msg->type != DATA_FRAME) {
+    f->can_id |= CAN_RTR_FLAG;
+  }
+  f->can_dlc = (msg->len > 8) ? 8 : msg->len;
+  memcpy (f->data, msg->data, 8);
+}
+
+static void lnx_fromFrame (const struct can_frame *f, CAN_msg *msg)  {
+
+  if (f->can_id & CAN_EFF_FLAG) {
+    msg->format = EXTENDED_FORMAT;
+    msg->id     = f->can_id & CAN_EFF_MASK;
+  } else {
+    msg->format = STANDARD_FORMAT;
+    msg->id     = f->can_id & CAN_SFF_MASK;
+  }
+  msg->type = (f->can_id & CAN_RTR_FLAG) ? REMOTE_FRAME : DATA_FRAME;
+  msg->len  = f->can_dlc;
+  memcpy (msg->data, f->data, 8);
+}
+
+/*----------------------------------------------------------------------------
+  acceptance check for frames passed in process, the same exact match the
+  list mode filter banks do: identifier, IDE and RTR; dev->swKey is sorted
+ *----------------------------------------------------------------------------*/
+static uint32_t lnx_accept (CAN_dev *dev, uint32_t canId)  {
+  uint32_t lo = 0, hi = dev->swNum, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) >> 1;
+    if (dev->swKey[mid] < canId) lo = mid + 1;
+    else                         hi = mid;
+  }
+  return (lo < dev->swNum && dev->swKey[lo] == canId);
+}
+
+/*----------------------------------------------------------------------------
+  queue a frame for reception by dev without going through a socket
+ *----------------------------------------------------------------------------*/
+static void lnx_local (CAN_dev *dev, const struct can_frame *f)  {
+  LNX_port *port = dev->reg;
+
+  if (!port->started || !lnx_accept (dev, f->can_id)) {
+    return;
+  }
+  if (port->locIn - port->locOut >= LNX_LOCAL) {
+    dev->rxOvr++;                           /* same as a FIFO overrun        */
+    return;
+  }
+  port->loc[port->locIn++ % LNX_LOCAL] = *f;
+}
+
+/*----------------------------------------------------------------------------
+  monotonic time in bit times, the 16 bit counter of the bxCAN time stamps
+ *----------------------------------------------------------------------------*/
+static uint32_t lnx_bitTime (void)  {
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ((uint32_t)(((uint64_t)ts.tv_sec * CAN_BITRATE +
+                      (uint64_t)ts.tv_nsec * CAN_BITRATE / 1000000000) & 0xFFFF));
+}
+
+/*----------------------------------------------------------------------------
+  send the queued frames of a controller, then report the mailboxes as
+  completed to CAN_txDone and CAN_txHook
+ *----------------------------------------------------------------------------*/
+static void lnx_flush (CAN_dev *dev)  {
+  LNX_port       *port = dev->reg;
+  CAN_dev        *peer = &CAN_Dev[2 - dev->ctrl];
+  struct mmsghdr  mm[LNX_BATCH];
+  struct iovec    iov[LNX_BATCH];
+  struct pollfd   pfd;
+  uint32_t        tok[LNX_BATCH];
+  uint32_t        i, num, sent = 0, tsr, time;
+  int             n;
+
+  if (port->txNum == 0) {
+    return;
+  }
+  for (i = 0; i < port->txNum; i++) {
+    if (port->testmode & CAN_BTR_LBKM) {    /* loop back to own receiver     */
+      lnx_local (dev, &port->tx[i]);
+    }
+    if (LNX_transport == LNX_LOOPBACK &&
+        !(port->testmode & CAN_BTR_SILM) && !(((LNX_port *)peer->reg)->testmode & CAN_BTR_LBKM)) {
+      lnx_local (peer, &port->tx[i]);
+    }
+  }
+
+  if (LNX_transport == LNX_LOOPBACK || (port->testmode & CAN_BTR_SILM)) {
+    sent = port->txNum;
+  } else {
+    memset (mm, 0, sizeof (mm));
+    for (i = 0; i < port->txNum; i++) {
+      iov[i].iov_base = &port->tx[i];
+      iov[i].iov_len  = sizeof (struct can_frame);
+      mm[i].msg_hdr.msg_iov    = &iov[i];
+      mm[i].msg_hdr.msg_iovlen = 1;
+    }
+    while (sent < port->txNum) {
+      n = sendmmsg (port->fd, &mm[sent], port->txNum - sent, MSG_DONTWAIT);
+      if (n > 0) {
+        sent += (uint32_t)n;
+        continue;
+      }
+      pfd.fd     = port->fd;                /* TX queue full, wait a little  */
+      pfd.events = POLLOUT;
+      if (poll (&pfd, 1, 10) <= 0) {
+        break;
+      }
+    }
+  }
+  dev->txOk  += sent;
+  dev->txErr += port->txNum - sent;
+
+  tsr = port->txTsr;
+  if (sent < port->txNum) {
+    tsr &= ~LNX_TSR_TXOK;                   /* report the mailboxes failed   */
+  }
+  num = port->txNum;
+  memcpy (tok, port->tok, num * sizeof (tok[0]));
+  port->txNum = 0;
+  port->txTsr = 0;
+  dev->txRdy  = 1;
+  time = lnx_bitTime ();
+  for (i = 0; i < num; i++) {               /* callbacks may queue again     */
+    if (tok[i] && dev->txDone) {
+      dev->txDone (dev, tok[i], (i < sent) ? CAN_OK : CAN_ERR_TERR, time);
+    }
+  }
+  if (dev->txHook) {
+    dev->txHook (dev, tsr);
+  }
+}
+
+/*----------------------------------------------------------------------------
+  hand a frame to the controller, it is sent with the next flush
+ *----------------------------------------------------------------------------*/
+static void lnx_queue (CAN_dev *dev, uint32_t mbx, const CAN_msg *msg, uint32_t tok)  {
+  LNX_port *port = dev->reg;
+
+  if (port->txNum >= LNX_BATCH) {
+    lnx_flush (dev);
+  }
+  port->tok[port->txNum] = tok;
+  lnx_toFrame (msg, &port->tx[port->txNum++]);
+  port->txTsr |= LNX_TSR_MBX(mbx);
+}
+
+/*----------------------------------------------------------------------------
+  next received frame of a controller, own process first, then the socket
+  returns 0 if there is none
+ *----------------------------------------------------------------------------*/
+static uint32_t lnx_next (CAN_dev *dev, struct can_frame *f)  {
+  LNX_port       *port = dev->reg;
+  struct mmsghdr  mm[LNX_BATCH];
+  struct iovec    iov[LNX_BATCH];
+  uint32_t        i;
+  int             n;
+
+  if (port->locOut != port->locIn) {
+    *f = port->loc[port->locOut++ % LNX_LOCAL];
+    return (1);
+  }
+  if (port->rxIdx == port->rxNum) {
+    if (port->fd < 0 || (port->testmode & CAN_BTR_LBKM)) {
+      return (0);                           /* loop back ignores the bus     */
+    }
+    memset (mm, 0, sizeof (mm));
+    for (i = 0; i < LNX_BATCH; i++) {
+      iov[i].iov_base = &port->rx[i];
+      iov[i].iov_len  = sizeof (struct can_frame);
+      mm[i].msg_hdr.msg_iov    = &iov[i];
+      mm[i].msg_hdr.msg_iovlen = 1;
+    }
+    n = recvmmsg (port->fd, mm, LNX_BATCH, MSG_DONTWAIT, NULL);
+    if (n <= 0) {
+      return (0);
+    }
+    port->rxNum = (uint32_t)n;
+    port->rxIdx = 0;
+  }
+  *f = port->rx[port->rxIdx++];
+  return (1);
+}
+
+/*----------------------------------------------------------------------------
+  deliver received frames like the RX interrupt does, stops when a frame is
+  left in rxMsg for the application
+ *----------------------------------------------------------------------------*/
+static uint32_t lnx_deliver (CAN_dev *dev)  {
+  struct can_frame f;
+  uint32_t         cnt = 0;
+
+  while (dev->rxRdy == 0 && lnx_next (dev, &f)) {
+    if (dev->sleep) {                       /* woken up by bus activity      */
+      dev->sleep = 0;
+      dev->wakeCnt++;
+    }
+    lnx_fromFrame (&f, &dev->rxMsg);
+    dev->rxCnt++;
+    cnt++;
+    if (dev->rxHook == 0 || dev->rxHook (dev, &dev->rxMsg) == 0) {
+      dev->rxRdy = 1;                       /*  set receive flag if not consumed */
+    }
+  }
+  return (cnt);
+}
+
+/*----------------------------------------------------------------------------
+  load the kernel filter of a controller from dev->swKey, no entry means
+  no frame is received, as with all filter banks inactive
+ *----------------------------------------------------------------------------*/
+static void lnx_setFilter (CAN_dev *dev)  {
+  LNX_port         *port = dev->reg;
+  struct can_filter flt[CAN_SWFILTER_MAX];
+  uint32_t          i;
+
+  if (port->fd < 0) {
+    return;
+  }
+  for (i = 0; i < dev->swNum; i++) {
+    flt[i].can_id   = dev->swKey[i];
+    flt[i].can_mask = CAN_EFF_FLAG | CAN_RTR_FLAG |
+                      ((dev->swKey[i] & CAN_EFF_FLAG) ? CAN_EFF_MASK : CAN_SFF_MASK);
+  }
+  setsockopt (port->fd, SOL_CAN_RAW, CAN_RAW_FILTER, flt, dev->swNum * sizeof (flt[0]));
+}
+
+/*----------------------------------------------------------------------------
+  open the raw socket of a controller, returns -1 on failure
+ *----------------------------------------------------------------------------*/
+static int lnx_open (const char *ifName)  {
+  struct sockaddr_can addr;
+  struct ifreq        ifr;
+  int                 fd;
+
+  fd = socket (PF_CAN, SOCK_RAW, CAN_RAW);
+  if (fd < 0) {
+    return (-1);
+  }
+  memset (&ifr, 0, sizeof (ifr));
+  strncpy (ifr.ifr_name, ifName, IFNAMSIZ - 1);
+  memset (&addr, 0, sizeof (addr));
+  addr.can_family = AF_CAN;
+  if (ioctl (fd, SIOCGIFINDEX, &ifr) < 0 ||
+      (addr.can_ifindex = ifr.ifr_ifindex,
+       bind (fd, (struct sockaddr *)&addr, sizeof (addr)) < 0)) {
+    close (fd);
+    return (-1);
+  }
+  return (fd);
+}
+
+/*----------------------------------------------------------------------------
+  select the interfaces of CAN1 / CAN2, call before CAN_setup
+  NULL keeps LNX_IFNAME
+ *----------------------------------------------------------------------------*/
+void LNX_init (const char *if1, const char *if2)  {
+
+  if (if1) LNX_tab[0].ifName = if1;
+  if (if2) LNX_tab[1].ifName = if2;
+}
+
+/*----------------------------------------------------------------------------
+  transport in use, LNX_SOCKET or LNX_LOOPBACK
+ *----------------------------------------------------------------------------*/
+uint32_t LNX_mode (void)  {
+
+  return (LNX_transport);
+}
+
+/*----------------------------------------------------------------------------
+  run the work of the CAN interrupts: send queued frames, receive and
+  dispatch frames. Waits up to timeoutMs for a frame if none is pending
+  returns the number of frames received
+ *----------------------------------------------------------------------------*/
+uint32_t LNX_poll (uint32_t timeoutMs)  {
+  struct pollfd pfd[2];
+  uint32_t      i, n, cnt = 0;
+
+  for (i = 0; i < 2; i++) {
+    lnx_flush (&CAN_Dev[i]);
+    if (LNX_tab[i].notify) {                /* mailboxes are empty now       */
+      LNX_tab[i].notify = 0;
+      if (CAN_Dev[i].txHook) CAN_Dev[i].txHook (&CAN_Dev[i], 0);
+    }
+  }
+  for (i = 0; i < 2; i++) {
+    if (LNX_tab[i].started) cnt += lnx_deliver (&CAN_Dev[i]);
+  }
+  if (cnt == 0 && timeoutMs && LNX_transport == LNX_SOCKET) {
+    for (i = n = 0; i < 2; i++) {
+      if (LNX_tab[i].started && LNX_tab[i].fd >= 0 && CAN_Dev[i].rxRdy == 0) {
+        pfd[n].fd     = LNX_tab[i].fd;
+        pfd[n].events = POLLIN;
+        n++;
+      }
+    }
+    if (n && poll (pfd, n, (int)timeoutMs) > 0) {
+      for (i = 0; i < 2; i++) {
+        if (LNX_tab[i].started) cnt += lnx_deliver (&CAN_Dev[i]);
+      }
+    }
+  }
+  for (i = 0; i < 2; i++) {
+    lnx_flush (&CAN_Dev[i]);                /* replies sent from the hooks   */
+  }
+  return (cnt);
+}
+
+/*----------------------------------------------------------------------------
+  setup CAN interface
+  falls back to in process transport for both controllers if the socket
+  cannot be opened
+ *----------------------------------------------------------------------------*/
+void CAN_setup (CAN_dev *dev)  {
+  LNX_port *port = dev->reg;
+  uint32_t  i;
+
+  if (LNX_transport == LNX_SOCKET && port->fd < 0) {
+    port->fd = lnx_open (port->ifName);
+    if (port->fd < 0) {
+      fprintf (stderr, "CAN%u: cannot open %s, using in process loopback\n",
+               (unsigned)dev->ctrl, port->ifName);
+      for (i = 0; i < 2; i++) {
+        if (LNX_tab[i].fd >= 0) close (LNX_tab[i].fd);
+        LNX_tab[i].fd = -1;
+      }
+      LNX_transport = LNX_LOOPBACK;
+    }
+  }
+  port->started  = 0;
+  port->testmode = 0;
+  port->txNum    = port->txTsr = 0;
+  port->rxNum    = port->rxIdx = 0;
+  port->locIn    = port->locOut = 0;
+  dev->filterIdx = 0;
+  dev->swNum     = 0;
+  dev->start     = 0;
+  dev->err       = CAN_OK;
+  dev->state     = CAN_ST_INIT;
+  lnx_setFilter (dev);                      /* nothing accepted yet          */
+}
+
+/*----------------------------------------------------------------------------
+  leave initialisation mode
+ *----------------------------------------------------------------------------*/
+void CAN_start (CAN_dev *dev)  {
+  LNX_port *port = dev->reg;
+
+  port->started = 1;
+  dev->start    = 1;
+  dev->state    = CAN_ST_READY;
+  dev->txRdy    = 1;                        /* the "mailbox" is free at once */
+}
+
+/*----------------------------------------------------------------------------
+  a socket is usable as soon as it is open, there is nothing to wait for
+ *----------------------------------------------------------------------------*/
+int32_t CAN_poll (CAN_dev *dev)  {
+
+  if (dev->state == CAN_ST_RESET) {
+    return (CAN_ERR_SETUP);
+  }
+  return ((dev->state == CAN_ST_READY) ? CAN_OK : CAN_BUSY);
+}
+
+/*----------------------------------------------------------------------------
+  set the testmode
+ *----------------------------------------------------------------------------*/
+void CAN_testmode (CAN_dev *dev, uint32_t testmode) {
+  LNX_port *port = dev->reg;
+
+  port->testmode = testmode & (CAN_BTR_SILM | CAN_BTR_LBKM);
+}
+
+/*----------------------------------------------------------------------------
+  sleep mode is only recorded, the socket keeps receiving
+ *----------------------------------------------------------------------------*/
+uint32_t CAN_sleep (CAN_dev *dev)  {
+  LNX_port *port = dev->reg;
+
+  if (port->txNum) {
+    return (0);
+  }
+  dev->sleep = 1;
+  return (1);
+}
+
+void CAN_wakeup (CAN_dev *dev)  {
+
+  dev->sleep = 0;
+}
+
+/*----------------------------------------------------------------------------
+  check if transmit mailbox is empty
+ *----------------------------------------------------------------------------*/
+int32_t CAN_waitReady (CAN_dev *dev)  {
+
+  if (dev->state != CAN_ST_READY) {
+    return (CAN_ERR_TIMEOUT);               /* CAN_start not called          */
+  }
+  lnx_flush (dev);
+  dev->txRdy = 1;
+  return (CAN_OK);
+}
+
+/*----------------------------------------------------------------------------
+  wite a message to CAN peripheral and transmit it
+  the mailbox is free again as soon as the frame is queued
+ *----------------------------------------------------------------------------*/
+void CAN_wrMsg (CAN_dev *dev, CAN_msg *msg)  {
+
+  dev->sleep = 0;
+  lnx_queue (dev, 0, msg, 0);
+  dev->txRdy = 1;
+}
+
+/*----------------------------------------------------------------------------
+  write a message into the first mailbox selected by mbxMask and transmit it
+  returns the mailbox used, or -1 if the mask selects none
+ *----------------------------------------------------------------------------*/
+int32_t CAN_wrMbx (CAN_dev *dev, uint32_t mbxMask, CAN_msg *msg)  {
+  uint32_t mbx;
+
+  mbxMask &= 0x07;
+  if (mbxMask == 0) {
+    return (-1);
+  }
+  mbx = (mbxMask & 1) ? 0 : ((mbxMask & 2) ? 1 : 2);
+  dev->sleep = 0;
+  lnx_queue (dev, mbx, msg, 0);
+  return ((int32_t)mbx);
+}
+
+/*----------------------------------------------------------------------------
+  queue a message like CAN_wrMbx, dev->txDone follows from the flush
+  returns the token, 0 if the mask selects no mailbox
+ *----------------------------------------------------------------------------*/
+uint32_t CAN_submit (CAN_dev *dev, uint32_t mbxMask, CAN_msg *msg)  {
+  uint32_t mbx;
+
+  mbxMask &= 0x07;
+  if (mbxMask == 0) {
+    return (0);
+  }
+  mbx = (mbxMask & 1) ? 0 : ((mbxMask & 2) ? 1 : 2);
+  if (++dev->txSeq == 0) {
+    dev->txSeq = 1;
+  }
+  dev->sleep = 0;
+  lnx_queue (dev, mbx, msg, dev->txSeq);
+  return (dev->txSeq);
+}
+
+/*----------------------------------------------------------------------------
+  transmit a message if the transmit mailbox is free
+  returns 1 if the message was handed to the mailbox, 0 if it is still busy
+ *----------------------------------------------------------------------------*/
+uint32_t CAN_tryWrMsg (CAN_dev *dev, CAN_msg *msg)  {
+
+  if (dev->txRdy == 0) {
+    return (0);
+  }
+  dev->txRdy = 0;
+  CAN_wrMsg (dev, msg);
+  return (1);
+}
+
+/*----------------------------------------------------------------------------
+  hooks run from LNX_poll in the caller's thread, nothing to mask
+ *----------------------------------------------------------------------------*/
+uint32_t CAN_lock (void)  {
+
+  return (0);
+}
+
+void CAN_unlock (uint32_t key)  {
+
+}
+
+/*----------------------------------------------------------------------------
+  request a TX hook call from the next LNX_poll
+ *----------------------------------------------------------------------------*/
+void CAN_txNotify (CAN_dev *dev)  {
+  LNX_port *port = dev->reg;
+
+  port->notify = 1;
+}
+
+/*----------------------------------------------------------------------------
+  read the next received message, msg is left unchanged if there is none
+ *----------------------------------------------------------------------------*/
+void CAN_rdMsg (CAN_dev *dev, CAN_msg *msg)  {
+  struct can_frame f;
+
+  if (lnx_next (dev, &f)) {
+    lnx_fromFrame (&f, msg);
+  }
+}
+
+/*----------------------------------------------------------------------------
+  setup acceptance filter
+  each id is an exact match, data frames only, as in the list filter banks
+ *----------------------------------------------------------------------------*/
+void CAN_wrFilter (CAN_dev *dev, uint32_t id, uint8_t format)  {
+  uint32_t key, i;
+
+  if (format == STANDARD_FORMAT) {
+    key = id & CAN_SFF_MASK;
+  } else {
+    key = (id & CAN_EFF_MASK) | CAN_EFF_FLAG;
+  }
+  for (i = 0; i < dev->swNum; i++) {
+    if (dev->swKey[i] == key) return;       /* already accepted              */
+  }
+  if (dev->swNum >= CAN_SWFILTER_MAX) {
+    return;
+  }
+  for (i = dev->swNum; i > 0 && dev->swKey[i-1] > key; i--) {
+    dev->swKey[i] = dev->swKey[i-1];
+  }
+  dev->swKey[i] = key;
+  dev->swNum++;
+  dev->filterIdx++;
+  lnx_setFilter (dev);
+}
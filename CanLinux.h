@@ -0,0 +1,50 @@
+/*----------------------------------------------------------------------------
+ * Name:    CanLinux.h
+ * Purpose: SocketCAN backend of the CAN.h API for Linux hosts
+ * Note(s): CanLinux.c replaces CAN.c at link time, the protocol modules
+ *          (ISOTP, J1939, SDO, PDO, OD, RxDispatch) build unchanged, e.g.
+ *            gcc -O2 -I. -o node app.c CanLinux.c ISOTP.c J1939.c
+ *          It is not part of the uVision project. The modules guard state
+ *          they share with the hooks with CAN_lock / CAN_unlock, which do
+ *          nothing here.
+ *
+ *          Both controllers open the same interface by default, so like
+ *          CAN1 and CAN2 wired together on the board each one receives what
+ *          the other sends. If no SocketCAN interface can be opened (no
+ *          vcan module, no permission) the frames are passed between the
+ *          controllers in process instead.
+ *
+ *          There are no interrupts: LNX_poll sends the queued frames with
+ *          sendmmsg, reads up to LNX_BATCH frames per recvmmsg and runs
+ *          the TX / RX hooks and rxRdy the way the interrupt handlers of
+ *          CAN.c do. Call it from the main loop in place of waiting for
+ *          an interrupt.
+ *----------------------------------------------------------------------------*/
+
+#ifndef __CANLINUX_H
+#define __CANLINUX_H
+
+#include <stdint.h>
+#include "CAN.h"
+
+/* Backend configuration */
+#define LNX_BATCH          32                /* frames per sendmmsg / recvmmsg */
+#define LNX_LOCAL         256                /* frames queued per controller in process */
+#define LNX_IFNAME    "vcan0"                /* default interface of both controllers */
+
+/* Transport in use */
+#define LNX_SOCKET          0                /* SocketCAN raw socket           */
+#define LNX_LOOPBACK        1                /* in process, no interface       */
+
+/* CAN_testmode bits, as in the bxCAN BTR register */
+#ifndef CAN_BTR_LBKM
+#define CAN_BTR_LBKM     ((uint32_t)0x40000000)
+#define CAN_BTR_SILM     ((uint32_t)0x80000000)
+#endif
+
+/* Functions defined in module CanLinux.c */
+void     LNX_init      (const char *if1, const char *if2);
+uint32_t LNX_mode      (void);
+uint32_t LNX_poll      (uint32_t timeoutMs);
+
+#endif
@@ -0,0 +1,365 @@
+#include <stdio.h>
+#include <stm32f4xx.h>
+#include "Clock.h"
+#include "CanLog.h"
+
+#define LOG_MAGIC         0x31474F4CUL          /* "LOG1"                      */
+#define LOG_PAGE_RECS     ((LOG_PAGE_SIZE / 16) - 1)
+#define LOG_SECTOR_PAGES  (LOG_SECTOR_SIZE / LOG_PAGE_SIZE)
+#define LOG_PAGES         (LOG_SECTORS * LOG_SECTOR_PAGES)
+#define LOG_PAGE_ADDR(p)  (LOG_FLASH_START + (uint32_t)(p) * LOG_PAGE_SIZE)
+#define LOG_SR_ERR        (FLASH_SR_PGSERR | FLASH_SR_PGPERR | FLASH_SR_PGAERR | FLASH_SR_WRPERR)
+
+/* page layout, identical in RAM and flash; a record is
+   [0] ms time stamp (28 bit) | dlc << 28
+   [1] id | EXT << 29 | RTR << 30 | (ctrl-1) << 31
+   [2] data[0..3]  [3] data[4..7]                                            */
+typedef struct  {
+  uint32_t       magic;                 /* programmed last */
+  uint32_t       seq;                   /* page sequence number */
+  uint32_t       count;                 /* records in the page */
+  uint32_t       dropped;               /* frames lost before this page */
+  uint32_t       rec[LOG_PAGE_RECS][4];
+} LOG_page;
+
+#define LOG_IDLE    0
+#define LOG_PROG    1
+
+static LOG_page           LOG_ram[LOG_RAM_PAGES] CAN_CCM;
+static volatile uint32_t  LOG_head;               /* RAM page being filled     */
+static volatile uint32_t  LOG_tail;               /* next RAM page to program  */
+static volatile uint32_t  LOG_headTime;           /* time of its first record  */
+static volatile uint32_t  LOG_dropCnt;
+
+static uint32_t           LOG_state;
+static uint32_t           LOG_word;               /* words of the page done    */
+static uint32_t           LOG_wrPage;             /* next flash page           */
+static uint32_t           LOG_seq;                /* next sequence number      */
+static uint32_t           LOG_erased;             /* sectors known to be blank */
+static uint32_t           LOG_eraseReq;           /* sectors to erase          */
+
+static uint32_t           LOG_ms;                 /* millisecond clock from    */
+static uint32_t           LOG_cyc;                /* the DWT cycle counter     */
+static uint32_t           LOG_cycPerMs;
+
+
+/*----------------------------------------------------------------------------
+  millisecond time, called with interrupts disabled
+  must run at least once per cycle counter wrap, LOG_process takes care
+ *----------------------------------------------------------------------------*/
+static uint32_t log_clock (void)  {
+  uint32_t ms = (DWT->CYCCNT - LOG_cyc) / LOG_cycPerMs;
+
+  LOG_ms  += ms;
+  LOG_cyc += ms * LOG_cycPerMs;
+  return (LOG_ms);
+}
+
+/*----------------------------------------------------------------------------
+  close the RAM page being filled, called with interrupts disabled
+  returns 0 if no free page is left
+ *----------------------------------------------------------------------------*/
+static uint32_t log_advance (void)  {
+  uint32_t next = (LOG_head + 1) % LOG_RAM_PAGES;
+
+  if (next == LOG_tail) {
+    return (0);
+  }
+  LOG_ram[next].count   = 0;
+  LOG_ram[next].dropped = LOG_dropCnt;
+  LOG_head = next;
+  return (1);
+}
+
+/*----------------------------------------------------------------------------
+  check that a flash area is erased
+ *----------------------------------------------------------------------------*/
+static uint32_t log_blank (uint32_t addr, uint32_t size)  {
+  const uint32_t *p = (const uint32_t *)addr;
+
+  for (size /= 4; size; size--) {
+    if (*p++ != 0xFFFFFFFF) return (0);
+  }
+  return (1);
+}
+
+/*----------------------------------------------------------------------------
+  flash page p holds a complete page
+ *----------------------------------------------------------------------------*/
+static __inline const LOG_page *log_valid (uint32_t p)  {
+  const LOG_page *pg = (const LOG_page *)LOG_PAGE_ADDR (p);
+
+  return ((pg->magic == LOG_MAGIC && pg->count <= LOG_PAGE_RECS) ? pg : 0);
+}
+
+/*----------------------------------------------------------------------------
+  unlock the flash control register
+ *----------------------------------------------------------------------------*/
+static void log_unlock (void)  {
+
+  if (FLASH->CR & FLASH_CR_LOCK) {
+    FLASH->KEYR = 0x45670123;
+    FLASH->KEYR = 0xCDEF89AB;
+  }
+  FLASH->SR = LOG_SR_ERR | FLASH_SR_EOP;    /* clear stale flags            */
+}
+
+/*----------------------------------------------------------------------------
+  flash word written in step k of programming a page: all records first,
+  then the header with the magic word last
+ *----------------------------------------------------------------------------*/
+static __inline uint32_t log_offset (const LOG_page *pg, uint32_t k)  {
+  static const uint8_t hdr[4] = { 1, 2, 3, 0 };
+  uint32_t n = pg->count * 4;
+
+  return ((k < n) ? 4 + k : hdr[k - n]);
+}
+
+/*----------------------------------------------------------------------------
+  clock profile switch: close the millisecond count at the old core clock
+ *----------------------------------------------------------------------------*/
+static uint32_t log_clkSwitch (uint32_t phase, const CLK_info *clk)  {
+  uint32_t primask = __get_PRIMASK();
+
+  __disable_irq();
+  if (phase == CLK_PRE) {
+    log_clock ();
+  } else if (phase == CLK_POST) {
+    LOG_cyc      = DWT->CYCCNT;
+    LOG_cycPerMs = clk->hclk / 1000;
+  }
+  __set_PRIMASK(primask);
+  return (1);
+}
+
+/*----------------------------------------------------------------------------
+  scan the log area and continue after the newest page
+ *----------------------------------------------------------------------------*/
+void LOG_init (void)  {
+  const LOG_page *pg;
+  uint32_t        p, s, last = LOG_PAGES, seq = 0;
+
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL        |= DWT_CTRL_CYCCNTENA_Msk;
+  LOG_cycPerMs = SystemCoreClock / 1000;
+  LOG_cyc      = DWT->CYCCNT;
+  LOG_ms       = 0;
+  CLK_notify (log_clkSwitch);
+
+  for (p = 0; p < LOG_PAGES; p++) {
+    pg = log_valid (p);
+    if (pg && (last == LOG_PAGES || (int32_t)(pg->seq - seq) > 0)) {
+      last = p;
+      seq  = pg->seq;
+    }
+  }
+  if (last == LOG_PAGES) {
+    LOG_wrPage = 0;
+    LOG_seq    = 0;
+  } else {
+    LOG_wrPage = (last + 1) % LOG_PAGES;
+    LOG_seq    = seq + 1;
+  }
+
+  LOG_erased = LOG_eraseReq = 0;
+  s = LOG_wrPage / LOG_SECTOR_PAGES;
+  if (LOG_wrPage % LOG_SECTOR_PAGES == 0) {
+    if (log_blank (LOG_PAGE_ADDR (LOG_wrPage), LOG_SECTOR_SIZE)) LOG_erased |= 1UL << s;
+  } else {                                  /* skip pages a reset spoiled   */
+    while (LOG_wrPage % LOG_SECTOR_PAGES && !log_blank (LOG_PAGE_ADDR (LOG_wrPage), LOG_PAGE_SIZE)) {
+      LOG_wrPage++;
+    }
+    if (LOG_wrPage % LOG_SECTOR_PAGES) {
+      LOG_erased |= 1UL << s;               /* rest of the sector is blank  */
+      s = (s + 1) % LOG_SECTORS;
+      if (log_blank (LOG_FLASH_START + s * LOG_SECTOR_SIZE, LOG_SECTOR_SIZE)) LOG_erased |= 1UL << s;
+      else                                                                     LOG_eraseReq |= 1UL << s;
+    } else {
+      LOG_wrPage %= LOG_PAGES;
+    }
+  }
+
+  LOG_head = LOG_tail = 0;
+  LOG_dropCnt = 0;
+  LOG_ram[0].count   = 0;
+  LOG_ram[0].dropped = 0;
+  LOG_state = LOG_IDLE;
+}
+
+/*----------------------------------------------------------------------------
+  append a frame to the RAM page, may be called from interrupts
+ *----------------------------------------------------------------------------*/
+void LOG_frame (uint32_t ctrl, CAN_msg *msg)  {
+  uint32_t  primask = __get_PRIMASK();
+  uint32_t *r;
+  LOG_page *pg;
+
+  if (LOG_cycPerMs == 0) {                  /* LOG_init not yet called      */
+    return;
+  }
+  __disable_irq();
+  pg = &LOG_ram[LOG_head];
+  if (pg->count == LOG_PAGE_RECS) {
+    if (log_advance () == 0) {
+      LOG_dropCnt++;
+      __set_PRIMASK(primask);
+      return;
+    }
+    pg = &LOG_ram[LOG_head];
+  }
+  r = pg->rec[pg->count];
+  r[0] = (log_clock () & 0x0FFFFFFF) | ((uint32_t)(msg->len & 0x0F) << 28);
+  r[1] = (msg->id & 0x1FFFFFFF) | ((ctrl - 1) << 31);
+  if (msg->format == EXTENDED_FORMAT) r[1] |= 1UL << 29;
+  if (msg->type   == REMOTE_FRAME)    r[1] |= 1UL << 30;
+  r[2] = ((uint32_t)msg->data[3] << 24) | ((uint32_t)msg->data[2] << 16) |
+         ((uint32_t)msg->data[1] <<  8) |  (uint32_t)msg->data[0];
+  r[3] = ((uint32_t)msg->data[7] << 24) | ((uint32_t)msg->data[6] << 16) |
+         ((uint32_t)msg->data[5] <<  8) |  (uint32_t)msg->data[4];
+  if (pg->count++ == 0) {
+    LOG_headTime = LOG_ms;
+  }
+  __set_PRIMASK(primask);
+}
+
+/*----------------------------------------------------------------------------
+  background work: close full or old RAM pages and program them into flash,
+  the sector ahead of the write position is left to LOG_erase
+ *----------------------------------------------------------------------------*/
+void LOG_process (void)  {
+  LOG_page *pg;
+  uint32_t  primask, now, n, s, off;
+
+  primask = __get_PRIMASK();
+  __disable_irq();
+  now = log_clock ();
+  pg  = &LOG_ram[LOG_head];
+  if (pg->count == LOG_PAGE_RECS || (pg->count && now - LOG_headTime >= LOG_FLUSH)) {
+    log_advance ();
+  }
+  __set_PRIMASK(primask);
+
+  if (FLASH->SR & FLASH_SR_BSY) {
+    return;
+  }
+
+  if (LOG_state == LOG_IDLE) {
+    if (LOG_tail == LOG_head) {             /* nothing to program           */
+      return;
+    }
+    s = LOG_wrPage / LOG_SECTOR_PAGES;
+    if (LOG_wrPage % LOG_SECTOR_PAGES == 0) {
+      if ((LOG_erased & (1UL << s)) == 0) {
+        LOG_eraseReq |= 1UL << s;           /* late, the RAM pages fill up  */
+        return;
+      }
+      LOG_erased  &= ~(1UL << s);           /* sector is being written now  */
+      LOG_eraseReq |= 1UL << ((s + 1) % LOG_SECTORS);
+    }
+    pg = &LOG_ram[LOG_tail];
+    pg->magic = LOG_MAGIC;
+    pg->seq   = LOG_seq;
+    log_unlock ();
+    FLASH->CR = FLASH_CR_PSIZE_1 | FLASH_CR_PG;
+    LOG_word  = 0;
+    LOG_state = LOG_PROG;
+  }
+
+  if (LOG_state == LOG_PROG) {
+    pg = &LOG_ram[LOG_tail];
+    n  = pg->count * 4 + 4;
+    for (s = 0; s < LOG_BURST && LOG_word < n; s++, LOG_word++) {
+      off = log_offset (pg, LOG_word);
+      while (FLASH->SR & FLASH_SR_BSY);
+      *(volatile uint32_t *)(LOG_PAGE_ADDR (LOG_wrPage) + off * 4) = ((uint32_t *)pg)[off];
+    }
+    if (LOG_word == n) {                    /* page complete                */
+      while (FLASH->SR & FLASH_SR_BSY);
+      FLASH->SR = LOG_SR_ERR | FLASH_SR_EOP;
+      FLASH->CR = FLASH_CR_LOCK;
+      LOG_wrPage = (LOG_wrPage + 1) % LOG_PAGES;
+      LOG_seq++;
+      LOG_tail  = (LOG_tail + 1) % LOG_RAM_PAGES;
+      LOG_state = LOG_IDLE;
+    }
+  }
+}
+
+/*----------------------------------------------------------------------------
+  sectors waiting for LOG_erase, bit n for sector n of the log area
+ *----------------------------------------------------------------------------*/
+uint32_t LOG_erasePending (void)  {
+
+  return (LOG_eraseReq);
+}
+
+/*----------------------------------------------------------------------------
+  erase one pending sector, returns when done; everything executing from
+  flash, interrupts included, stalls meanwhile. Returns 0 if no sector is
+  due or a page is being programmed (call LOG_process and retry)
+ *----------------------------------------------------------------------------*/
+uint32_t LOG_erase (void)  {
+  uint32_t s;
+
+  if (LOG_state != LOG_IDLE || LOG_eraseReq == 0 || (FLASH->SR & FLASH_SR_BSY)) {
+    return (0);
+  }
+  for (s = 0; (LOG_eraseReq & (1UL << s)) == 0; s++);
+  log_unlock ();
+  FLASH->CR = FLASH_CR_PSIZE_1 | FLASH_CR_SER | ((LOG_FIRST_SECTOR + s) << 3);
+  FLASH->CR |= FLASH_CR_STRT;
+  while (FLASH->SR & FLASH_SR_BSY);
+  FLASH->SR = LOG_SR_ERR | FLASH_SR_EOP;
+  FLASH->CR = FLASH_CR_LOCK;
+  LOG_erased   |=  1UL << s;
+  LOG_eraseReq &= ~(1UL << s);
+  return (1);
+}
+
+/*----------------------------------------------------------------------------
+  print the log, oldest page first, in candump log format
+ *----------------------------------------------------------------------------*/
+void LOG_dump (void)  {
+  const LOG_page *pg;
+  const uint32_t *r;
+  uint32_t        p, i, k, len, first = LOG_PAGES, seq = 0;
+
+  for (p = 0; p < LOG_PAGES; p++) {
+    pg = log_valid (p);
+    if (pg && (first == LOG_PAGES || (int32_t)(pg->seq - seq) < 0)) {
+      first = p;
+      seq   = pg->seq;
+    }
+  }
+  if (first == LOG_PAGES) {
+    return;
+  }
+  for (p = 0; p < LOG_PAGES; p++) {
+    pg = log_valid ((first + p) % LOG_PAGES);
+    if (pg == 0) continue;
+    for (i = 0; i < pg->count; i++) {
+      r   = pg->rec[i];
+      len = r[0] >> 28;
+      printf ("(%lu.%03lu000) can%lu ", (unsigned long)((r[0] & 0x0FFFFFFF) / 1000),
+              (unsigned long)((r[0] & 0x0FFFFFFF) % 1000), (unsigned long)(r[1] >> 31));
+      if (r[1] & (1UL << 29)) printf ("%08lX#", (unsigned long)(r[1] & 0x1FFFFFFF));
+      else                    printf ("%03lX#", (unsigned long)(r[1] & 0x7FF));
+      if (r[1] & (1UL << 30)) {
+        printf ("R");
+      } else {
+        for (k = 0; k < len && k < 8; k++) {
+          printf ("%02X", (unsigned int)((r[2 + k / 4] >> (8 * (k % 4))) & 0xFF));
+        }
+      }
+      printf ("\r\n");
+    }
+  }
+}
+
+/*----------------------------------------------------------------------------
+  frames lost because all RAM pages were waiting for flash
+ *----------------------------------------------------------------------------*/
+uint32_t LOG_dropped (void)  {
+
+  return (LOG_dropCnt);
+}
@@ -0,0 +1,47 @@
+/*----------------------------------------------------------------------------
+ * Name:    CanLog.h
+ * Purpose: circular log of received CAN frames in on-chip flash
+ * Note(s): frames are collected in RAM pages and written to the flash
+ *          sectors reserved below from LOG_process, one page at a time.
+ *          The sector following the one being written must be erased ahead
+ *          of time, so the log keeps between LOG_SECTORS-2 and LOG_SECTORS-1
+ *          sectors of history. Pages carry a sequence number and are only
+ *          valid once their header is programmed, the log survives resets.
+ *          While a sector erase runs (1..2 s for 128 KB) the flash cannot be
+ *          read, code executing from flash, interrupts included, stalls
+ *          until it ends. LOG_process therefore never erases: it only marks
+ *          the sector, and the application calls LOG_erase in a window where
+ *          it can afford the stall (CAN stopped, before a restart, ...).
+ *          Calling LOG_erase is required: LOG_erasePending tells when one
+ *          is due, and if the write position reaches a sector not yet
+ *          erased, pages stay in RAM and every frame is counted as dropped
+ *          once LOG_RAM_PAGES are full. CanDemo.c shows the main loop.
+ *          CAN.c logs received frames when compiled with __CAN_LOG.
+ *----------------------------------------------------------------------------*/
+
+#ifndef __CANLOG_H
+#define __CANLOG_H
+
+#include <stdint.h>
+#include "CAN.h"
+
+/* Log configuration, the flash area is excluded from ER_IROM1 in CAN.sct */
+#define LOG_FLASH_START  0x080A0000UL        /* sectors 9..11                  */
+#define LOG_FIRST_SECTOR    9
+#define LOG_SECTORS         3
+#define LOG_SECTOR_SIZE  0x20000UL           /* 128 KB sectors                 */
+#define LOG_PAGE_SIZE     512                /* bytes per RAM / flash page     */
+#define LOG_RAM_PAGES       4                /* pages buffered in RAM          */
+#define LOG_BURST          32                /* words programmed per call      */
+#define LOG_FLUSH        1000                /* ms before a partial page is written */
+
+/* Functions defined in module CanLog.c */
+void     LOG_init      (void);
+void     LOG_frame     (uint32_t ctrl, CAN_msg *msg);
+void     LOG_process   (void);
+uint32_t LOG_erasePending (void);
+uint32_t LOG_erase     (void);
+void     LOG_dump      (void);
+uint32_t LOG_dropped   (void);
+
+#endif
@@ -0,0 +1,187 @@
+/*----------------------------------------------------------------------------
+ * Name:    CanMsg.hpp
+ * Purpose: typed CAN messages with compile time signal layout (C++11)
+ * Note(s): header only, needs C++11 (armcc --cpp11). A message is a type
+ *          that carries its identifier, format, DLC and signals as
+ *          template arguments:
+ *
+ *            typedef CanSignal< 0, 16>              EngRpm;
+ *            typedef CanSignal<16,  8, true, true>  EngTemp;
+ *            typedef CanSignal<39, 12, false>       EngLoad;   (Motorola)
+ *            typedef CanMessage<0x100, STANDARD_FORMAT, 8,
+ *                               EngRpm, EngTemp, EngLoad>  Engine;
+ *
+ *            if (Engine::match (msg)) rpm = Engine::get<EngRpm> (msg);
+ *
+ *          Start bits and byte order follow the DBC convention: an Intel
+ *          signal starts at its lsb, a Motorola signal at its msb, bit 7
+ *          of byte 0 being the first bit on the bus. Every position, shift
+ *          and mask is a constant, so get / set reduce to the loads of the
+ *          one or two data words the signal touches, a shift and a mask.
+ *          Signals that overlap, leave the DLC or do not belong to the
+ *          message are rejected by static_assert. Values are raw, scaling
+ *          stays with the application (dbcgen generates the C variant).
+ *----------------------------------------------------------------------------*/
+
+#ifndef __CANMSG_HPP
+#define __CANMSG_HPP
+
+#if __cplusplus < 201103L
+#error "CanMsg.hpp needs C++11"
+#endif
+
+#include <stdint.h>
+#include "CAN.h"
+
+namespace CanMsgDetail  {
+
+/* Len bits from Pos of the little endian frame image, byte n at bit 8n */
+constexpr uint64_t bits (uint32_t pos, uint32_t len)  {
+  return ((len == 0) ? 0 : ((len >= 64) ? ~0ULL : ((1ULL << len) - 1)) << pos);
+}
+
+/* position in the little endian image of bit 'be' of the big endian image */
+constexpr uint32_t leBit (uint32_t be)  {
+  return (8 * (7 - be / 8) + be % 8);
+}
+
+constexpr uint64_t beBits (uint32_t be, uint32_t len)  {
+  return ((len == 0) ? 0 : ((1ULL << leBit (be)) | beBits (be + 1, len - 1)));
+}
+
+template <bool C, class T, class F> struct Select              { typedef T type; };
+template <class T, class F>         struct Select<false, T, F> { typedef F type; };
+
+template <class A, class B> struct Same       { static constexpr bool value = false; };
+template <class A>          struct Same<A, A> { static constexpr bool value = true;  };
+
+/* union of the signal layouts, and whether they are disjoint */
+template <class... S> struct Layout  {
+  static constexpr uint64_t used     = 0;
+  static constexpr bool     disjoint = true;
+};
+template <class H, class... T> struct Layout<H, T...>  {
+  static constexpr uint64_t used     = H::layout | Layout<T...>::used;
+  static constexpr bool     disjoint = (H::layout & Layout<T...>::used) == 0 && Layout<T...>::disjoint;
+};
+
+template <class S, class... L> struct Has  { static constexpr bool value = false; };
+template <class S, class H, class... T> struct Has<S, H, T...>  {
+  static constexpr bool value = Same<S, H>::value || Has<S, T...>::value;
+};
+
+}
+
+/*----------------------------------------------------------------------------
+  signal of Len bits, Intel (little endian) or Motorola (big endian)
+  the value is taken from the frame image of its byte order: the little
+  endian image for Intel, the big endian one (byte 0 at bits 63..56) for
+  Motorola; word w of an image covers its bits 32w..32w+31
+ *----------------------------------------------------------------------------*/
+template <uint32_t Start, uint32_t Len, bool Intel = true, bool Signed = false>
+struct CanSignal  {
+  static constexpr uint32_t msb  = (7 - Start / 8) * 8 + Start % 8;  /* Motorola, big endian image */
+  static constexpr uint32_t pos  = Intel ? Start : msb + 1 - Len;   /* lsb in the image          */
+  static constexpr uint32_t mask = (Len >= 32) ? 0xFFFFFFFFUL : ((1UL << Len) - 1);
+  static constexpr uint64_t layout = Intel ? CanMsgDetail::bits (Start, Len)
+                                           : CanMsgDetail::beBits (pos, Len);
+
+  static_assert (Len >= 1 && Len <= 32, "signal length must be 1..32");
+  static_assert (Start < 64, "start bit beyond the frame");
+  static_assert (Intel ? (Start + Len <= 64) : (msb + 1 >= Len), "signal leaves the frame");
+
+  typedef typename CanMsgDetail::Select<Signed, int32_t, uint32_t>::type type;
+
+  static type get (const CAN_msg &m)  {
+    uint32_t raw;
+
+    if (pos / 32 == (pos + Len - 1) / 32) {
+      raw = (word (m.data, pos / 32) >> (pos % 32)) & mask;
+    } else {                                  /* pos % 32 != 0 here          */
+      raw = ((word (m.data, 0) >> (pos % 32)) | (word (m.data, 1) << ((32 - pos % 32) % 32))) & mask;
+    }
+    if (Signed && Len < 32 && (raw >> (Len - 1))) {
+      raw |= ~mask;                           /* sign extension              */
+    }
+    return (static_cast<type>(raw));
+  }
+
+  static void set (CAN_msg &m, type val)  {
+    uint32_t raw = static_cast<uint32_t>(val) & mask;
+    uint32_t w   = pos / 32;
+    uint32_t sh  = pos % 32;
+
+    if (w == (pos + Len - 1) / 32) {
+      store (m.data, w, (word (m.data, w) & ~(mask << sh)) | (raw << sh));
+    } else {
+      store (m.data, 0, (word (m.data, 0) & ~(mask << sh)) | (raw << sh));
+      store (m.data, 1, (word (m.data, 1) & ~(mask >> (32 - sh))) | (raw >> (32 - sh)));
+    }
+  }
+
+private:
+  static uint32_t word (const unsigned char *d, uint32_t w)  {
+    if (Intel) {
+      d += 4 * w;
+      return (((uint32_t)d[3] << 24) | ((uint32_t)d[2] << 16) | ((uint32_t)d[1] << 8) | d[0]);
+    }
+    d += 4 * (1 - w);
+    return (((uint32_t)d[0] << 24) | ((uint32_t)d[1] << 16) | ((uint32_t)d[2] << 8) | d[3]);
+  }
+
+  static void store (unsigned char *d, uint32_t w, uint32_t v)  {
+    if (Intel) {
+      d += 4 * w;
+      d[0] = (unsigned char)v;         d[1] = (unsigned char)(v >> 8);
+      d[2] = (unsigned char)(v >> 16); d[3] = (unsigned char)(v >> 24);
+    } else {
+      d += 4 * (1 - w);
+      d[3] = (unsigned char)v;         d[2] = (unsigned char)(v >> 8);
+      d[1] = (unsigned char)(v >> 16); d[0] = (unsigned char)(v >> 24);
+    }
+  }
+};
+
+/*----------------------------------------------------------------------------
+  data frame with its identifier, format, DLC and signals
+ *----------------------------------------------------------------------------*/
+template <uint32_t Id, uint8_t Format, uint8_t Dlc, class... Signals>
+struct CanMessage  {
+  static constexpr uint32_t id     = Id;
+  static constexpr uint8_t  format = Format;
+  static constexpr uint8_t  dlc    = Dlc;
+
+  static_assert (Format == STANDARD_FORMAT || Format == EXTENDED_FORMAT, "unknown format");
+  static_assert (Id <= ((Format == STANDARD_FORMAT) ? 0x7FFUL : 0x1FFFFFFFUL), "identifier out of range");
+  static_assert (Dlc <= 8, "DLC must be 0..8");
+  static_assert (CanMsgDetail::Layout<Signals...>::disjoint, "signals overlap");
+  static_assert ((CanMsgDetail::Layout<Signals...>::used & ~CanMsgDetail::bits (0, 8 * Dlc)) == 0,
+                 "signal beyond the DLC");
+
+  /* identifier, format and length set, data cleared */
+  static void init (CAN_msg &m)  {
+    uint32_t i;
+
+    m.id     = Id;
+    m.format = Format;
+    m.type   = DATA_FRAME;
+    m.len    = Dlc;
+    for (i = 0; i < 8; i++) m.data[i] = 0;
+  }
+
+  static bool match (const CAN_msg &m)  {
+    return (m.id == Id && m.format == Format && m.type == DATA_FRAME && m.len >= Dlc);
+  }
+
+  template <class S> static typename S::type get (const CAN_msg &m)  {
+    static_assert (CanMsgDetail::Has<S, Signals...>::value, "signal is not part of this message");
+    return (S::get (m));
+  }
+
+  template <class S> static void set (CAN_msg &m, typename S::type val)  {
+    static_assert (CanMsgDetail::Has<S, Signals...>::value, "signal is not part of this message");
+    S::set (m, val);
+  }
+};
+
+#endif
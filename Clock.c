@@ -0,0 +1,244 @@
+#include <stm32f4xx.h>
+#include "Clock.h"
+
+typedef struct  {
+  const char    *name;
+  uint16_t       pllm;                  /* 0: SYSCLK from HSE, PLL off */
+  uint16_t       plln;
+  uint8_t        pllp;                  /* 2, 4, 6, 8 */
+  uint8_t        pllq;                  /* USB / SDIO clock divider */
+  uint16_t       hpre;                  /* AHB divider 1..512 */
+  uint8_t        ppre1;                 /* APB1 divider 1..16 */
+  uint8_t        ppre2;                 /* APB2 divider 1..16 */
+} CLK_prof;
+
+static const CLK_prof CLK_tab[CLK_PROFILES] = {
+  /* name        M    N  P  Q  AHB APB1 APB2 */
+  { "full",      8, 336, 2, 7,   1,   4,   2 },
+  { "reduced",   8, 336, 2, 7,   4,   2,   1 },
+  { "hse",       0,   0, 0, 0,   1,   1,   1 },
+};
+
+/* the board crystal must be the one the system files are built for */
+typedef char CLK_hseCheck[(HSE_VALUE == CLK_HSE) ? 1 : -1];
+
+static uint32_t           CLK_cur = CLK_RESET;
+static CLK_info           CLK_now = {                  /* HSI after reset     */
+  16000000, 16000000, 16000000, 16000000, 16000000, 16000000
+};
+static CLK_func           CLK_client[CLK_CLIENTS];
+static uint32_t           CLK_num;
+
+
+/*----------------------------------------------------------------------------
+  prescaler field values of a divider, 0xFF if the divider does not exist
+ *----------------------------------------------------------------------------*/
+static uint32_t clk_hpre (uint32_t div)  {
+
+  switch (div) {
+    case   1: return (0);
+    case   2: return (8);
+    case   4: return (9);
+    case   8: return (10);
+    case  16: return (11);
+    case  64: return (12);
+    case 128: return (13);
+    case 256: return (14);
+    case 512: return (15);
+  }
+  return (0xFF);
+}
+
+static uint32_t clk_ppre (uint32_t div)  {
+
+  switch (div) {
+    case  1: return (0);
+    case  2: return (4);
+    case  4: return (5);
+    case  8: return (6);
+    case 16: return (7);
+  }
+  return (0xFF);
+}
+
+/*----------------------------------------------------------------------------
+  compute the clocks of a profile and check them against the PLL and bus
+  limits of the STM32F407; returns 0 if the profile is invalid
+ *----------------------------------------------------------------------------*/
+static uint32_t clk_calc (const CLK_prof *p, CLK_info *clk)  {
+  uint32_t vco;
+
+  if (p->pllm == 0) {
+    clk->sysclk = HSE_VALUE;
+  } else {
+    if (p->pllm < 2 || p->pllm > 63 || (HSE_VALUE % p->pllm) != 0 ||
+        HSE_VALUE / p->pllm < 1000000 || HSE_VALUE / p->pllm > 2000000) {
+      return (0);                           /* VCO input 1..2 MHz            */
+    }
+    vco = (HSE_VALUE / p->pllm) * p->plln;
+    if (p->plln < 50 || p->plln > 432 || vco < 100000000 || vco > 432000000) {
+      return (0);
+    }
+    if ((p->pllp & 1) || p->pllp < 2 || p->pllp > 8 ||
+        p->pllq < 2 || p->pllq > 15 || vco / p->pllq > 48000000) {
+      return (0);
+    }
+    clk->sysclk = vco / p->pllp;
+  }
+  if (clk->sysclk > 168000000 || clk_hpre (p->hpre) == 0xFF ||
+      clk_ppre (p->ppre1) == 0xFF || clk_ppre (p->ppre2) == 0xFF) {
+    return (0);
+  }
+  clk->hclk  = clk->sysclk / p->hpre;
+  clk->pclk1 = clk->hclk / p->ppre1;
+  clk->pclk2 = clk->hclk / p->ppre2;
+  clk->tim1  = (p->ppre1 == 1) ? clk->pclk1 : 2 * clk->pclk1;
+  clk->tim2  = (p->ppre2 == 1) ? clk->pclk2 : 2 * clk->pclk2;
+  return (clk->pclk1 <= 42000000 && clk->pclk2 <= 84000000);
+}
+
+/*----------------------------------------------------------------------------
+  flash wait states for HCLK at 2.7 .. 3.6 V
+ *----------------------------------------------------------------------------*/
+static uint32_t clk_latency (uint32_t hclk)  {
+
+  return ((hclk - 1) / 30000000);
+}
+
+static void clk_setLatency (uint32_t ws)  {
+
+  FLASH->ACR = (FLASH->ACR & ~FLASH_ACR_LATENCY) | ws;
+  while ((FLASH->ACR & FLASH_ACR_LATENCY) != ws);
+}
+
+/*----------------------------------------------------------------------------
+  select the SYSCLK source, 0 = HSI, 1 = HSE, 2 = PLL
+ *----------------------------------------------------------------------------*/
+static void clk_source (uint32_t sw)  {
+
+  RCC->CFGR = (RCC->CFGR & ~RCC_CFGR_SW) | sw;
+  while (((RCC->CFGR & RCC_CFGR_SWS) >> 2) != sw);
+}
+
+/*----------------------------------------------------------------------------
+  reprogram the clock tree, the bus prescalers are written in one store
+  old is 0 while the chip still runs on the reset clock
+ *----------------------------------------------------------------------------*/
+static int32_t clk_switch (const CLK_prof *p, const CLK_prof *old, const CLK_info *clk)  {
+  uint32_t pllcfgr, tmo;
+
+  if (clk_latency (clk->hclk) > (FLASH->ACR & FLASH_ACR_LATENCY)) {
+    clk_setLatency (clk_latency (clk->hclk));  /* slow flash down first      */
+  }
+
+  RCC->CR |= RCC_CR_HSEON;
+  for (tmo = CLK_TIMEOUT; (RCC->CR & RCC_CR_HSERDY) == 0; tmo--) {
+    if (tmo == 0) return (CLK_ERR_HW);
+  }
+
+  if (old == 0 || p->pllm == 0 || p->pllm != old->pllm || p->plln != old->plln ||
+      p->pllp != old->pllp || p->pllq != old->pllq || (RCC->CR & RCC_CR_PLLRDY) == 0) {
+    clk_source (1);                         /* run from HSE meanwhile        */
+    RCC->CR &= ~RCC_CR_PLLON;
+    while (RCC->CR & RCC_CR_PLLRDY);
+    if (p->pllm != 0) {
+      pllcfgr = p->pllm | ((uint32_t)p->plln << 6) | ((uint32_t)(p->pllp / 2 - 1) << 16) |
+                RCC_PLLCFGR_PLLSRC_HSE | ((uint32_t)p->pllq << 24);
+      RCC->PLLCFGR = pllcfgr;
+      RCC->CR |= RCC_CR_PLLON;
+      for (tmo = CLK_TIMEOUT; (RCC->CR & RCC_CR_PLLRDY) == 0; tmo--) {
+        if (tmo == 0) return (CLK_ERR_HW);
+      }
+    }
+  }
+
+  RCC->CFGR = (RCC->CFGR & ~(RCC_CFGR_HPRE | RCC_CFGR_PPRE1 | RCC_CFGR_PPRE2)) |
+              (clk_hpre (p->hpre) << 4) | (clk_ppre (p->ppre1) << 10) | (clk_ppre (p->ppre2) << 13);
+  clk_source ((p->pllm != 0) ? 2 : 1);
+
+  clk_setLatency (clk_latency (clk->hclk));
+  return (CLK_OK);
+}
+
+/*----------------------------------------------------------------------------
+  switch to a clock profile
+  the drivers registered with CLK_notify are asked first and then follow
+  the switch; SysTick keeps its 1 ms period
+ *----------------------------------------------------------------------------*/
+int32_t CLK_set (uint32_t profile)  {
+  CLK_info  clk;
+  uint32_t  i, primask;
+  int32_t   res;
+
+  if (profile >= CLK_PROFILES || clk_calc (&CLK_tab[profile], &clk) == 0) {
+    return (CLK_ERR_PARAM);
+  }
+  for (i = 0; i < CLK_num; i++) {
+    if (CLK_client[i] (CLK_CHECK, &clk) == 0) {
+      return (CLK_ERR_CLIENT);
+    }
+  }
+  for (i = 0; i < CLK_num; i++) {
+    CLK_client[i] (CLK_PRE, &clk);
+  }
+
+  primask = __get_PRIMASK();
+  __disable_irq();
+  res = clk_switch (&CLK_tab[profile], (CLK_cur < CLK_PROFILES) ? &CLK_tab[CLK_cur] : 0, &clk);
+  if (res == CLK_OK) {
+    CLK_cur = profile;
+    CLK_now = clk;
+  } else if (CLK_cur < CLK_PROFILES) {
+    clk_switch (&CLK_tab[CLK_cur], &CLK_tab[CLK_cur], &CLK_now);
+  } else {
+    clk_source (0);                         /* back to HSI, wait states kept */
+  }
+  SystemCoreClockUpdate();
+  if (SysTick->CTRL & SysTick_CTRL_ENABLE_Msk) {
+    SysTick->LOAD = CLK_now.hclk / 1000 - 1;
+    SysTick->VAL  = 0;
+  }
+  __set_PRIMASK(primask);
+
+  for (i = 0; i < CLK_num; i++) {
+    CLK_client[i] (CLK_POST, &CLK_now);
+  }
+  return (res);
+}
+
+/*----------------------------------------------------------------------------
+  profile in use, its name and the resulting clocks
+ *----------------------------------------------------------------------------*/
+uint32_t CLK_profile (void)  {
+
+  return (CLK_cur);
+}
+
+const char *CLK_name (uint32_t profile)  {
+
+  if (profile == CLK_RESET) {
+    return ("reset");
+  }
+  return ((profile < CLK_PROFILES) ? CLK_tab[profile].name : "");
+}
+
+const CLK_info *CLK_get (void)  {
+
+  return (&CLK_now);
+}
+
+/*----------------------------------------------------------------------------
+  register a driver to be asked before and updated after a switch
+ *----------------------------------------------------------------------------*/
+int32_t CLK_notify (CLK_func func)  {
+  uint32_t i;
+
+  for (i = 0; i < CLK_num; i++) {
+    if (CLK_client[i] == func) return (CLK_OK);
+  }
+  if (CLK_num >= CLK_CLIENTS) {
+    return (CLK_ERR_FULL);
+  }
+  CLK_client[CLK_num++] = func;
+  return (CLK_OK);
+}
@@ -0,0 +1,65 @@
+/*----------------------------------------------------------------------------
+ * Name:    Clock.h
+ * Purpose: named clock profiles, switchable at runtime
+ * Note(s): CLK_set validates the PLL settings of a profile against
+ *          HSE_VALUE and the bus limits, then asks every registered driver
+ *          whether it can run at the new clocks (CLK_CHECK). Only if all
+ *          agree the drivers stop (CLK_PRE), the clock tree is switched and
+ *          the drivers recompute their dividers (CLK_POST).
+ *          CAN is put into initialisation mode around the switch, so no
+ *          frame is cut and the bit rate is kept. Profiles that keep the
+ *          PLL configuration only change the bus prescalers and switch in
+ *          a few cycles; the others run from HSE while the PLL relocks.
+ *          Until the first CLK_set the reset clock is reported
+ *          (CLK_RESET, 16 MHz HSI, flash at 0 wait states), so
+ *          SystemClock_Config calls CLK_set before any driver is set up.
+ *----------------------------------------------------------------------------*/
+
+#ifndef __CLOCK_H
+#define __CLOCK_H
+
+#include <stdint.h>
+
+/* Clock configuration */
+#define CLK_HSE       8000000                /* crystal of the board           */
+#define CLK_CLIENTS         8                /* drivers notified on a switch   */
+#define CLK_TIMEOUT    100000                /* polls for HSE / PLL ready      */
+
+/* Clock profiles */
+#define CLK_FULL            0                /* 168 MHz, APB1 42 MHz           */
+#define CLK_REDUCED         1                /* HCLK 42 MHz, APB1 21 MHz, PLL kept */
+#define CLK_HSE_ONLY        2                /* 8 MHz from HSE, PLL off        */
+#define CLK_PROFILES        3
+#define CLK_RESET           CLK_PROFILES     /* HSI 16 MHz, before the first CLK_set */
+
+/* Driver notification phases */
+#define CLK_CHECK           0                /* return 0 if clk is unusable    */
+#define CLK_PRE             1                /* stop using the old clocks      */
+#define CLK_POST            2                /* recompute dividers for clk     */
+
+/* Clock result codes */
+#define CLK_OK              0
+#define CLK_ERR_PARAM      -1                /* unknown or invalid profile     */
+#define CLK_ERR_CLIENT     -2                /* a driver cannot run at it      */
+#define CLK_ERR_HW         -3                /* HSE or PLL did not get ready   */
+#define CLK_ERR_FULL       -4                /* too many drivers registered    */
+
+typedef struct  {
+  uint32_t       sysclk;
+  uint32_t       hclk;                  /* core, SysTick, DWT */
+  uint32_t       pclk1;                 /* APB1: CAN, UART4 */
+  uint32_t       tim1;                  /* timers on APB1: TIM2..7 */
+  uint32_t       pclk2;                 /* APB2 */
+  uint32_t       tim2;                  /* timers on APB2 */
+} CLK_info;
+
+typedef uint32_t (*CLK_func) (uint32_t phase, const CLK_info *clk);
+
+/* Functions defined in module Clock.c */
+int32_t          CLK_set       (uint32_t profile);
+uint32_t         CLK_profile   (void);
+const char      *CLK_name      (uint32_t profile);
+const CLK_info  *CLK_get       (void);
+int32_t          CLK_notify    (CLK_func func);
+
+#endif
@@ -0,0 +1,213 @@
+#include <stm32f4xx.h>
+#include "CAN.h"
+#include "Clock.h"
+#include "Cyclic.h"
+
+#define CYC_MBX         0x06                    /* TX mailboxes 1 and 2        */
+
+typedef struct  {
+  CAN_msg       *msg;                   /* frame, data owned by application */
+  CAN_dev       *dev;                   /* CAN controller */
+  uint16_t       period;                /* period in ticks */
+  uint16_t       cnt;                   /* ticks until next transmission */
+  uint8_t        pending;               /* due but not yet in a mailbox */
+} CYC_entry;
+
+static CYC_entry          CYC_tab[CYC_MAX] CAN_CCM;
+static volatile uint32_t  CYC_num;                /* entries in the table      */
+static uint8_t            CYC_load[CYC_WINDOW];   /* frames due per tick       */
+static uint32_t           CYC_pend[2];            /* pending entries per ctrl  */
+static volatile uint32_t  CYC_lateCnt;            /* frames delayed by a tick  */
+static volatile uint32_t  CYC_skipCnt;            /* frames dropped as overrun */
+
+
+/*----------------------------------------------------------------------------
+  load pending frames of a controller into free mailboxes
+  frames are loaded in table order; whatever does not fit is retried from
+  the TX interrupt, so TMEIE stays enabled while frames are pending.
+  TIM7 and the CAN TX interrupts share the default priority, so this is
+  never re-entered
+ *----------------------------------------------------------------------------*/
+static void cyc_flush (CAN_dev *dev)  {
+  uint32_t    *pend = &CYC_pend[dev->ctrl-1];
+  CYC_entry   *e;
+  uint32_t     i;
+
+  for (i = 0; i < CYC_num && *pend; i++) {
+    e = &CYC_tab[i];
+    if (e->pending && e->dev == dev) {
+      if (CAN_wrMbx (dev, CYC_MBX, e->msg) < 0) {
+        CAN_txNotify (dev);                 /* refill on mailbox empty      */
+        return;
+      }
+      e->pending = 0;
+      (*pend)--;
+    }
+  }
+}
+
+/*----------------------------------------------------------------------------
+  TX interrupt hook: a mailbox became empty
+ *----------------------------------------------------------------------------*/
+static void cyc_txIRQ (CAN_dev *dev, uint32_t tsr)  {
+
+  if (CYC_pend[dev->ctrl-1]) {
+    cyc_flush (dev);
+  }
+}
+
+/*----------------------------------------------------------------------------
+  choose the offset whose ticks carry the least load within CYC_WINDOW
+ *----------------------------------------------------------------------------*/
+static uint32_t cyc_offset (uint32_t period)  {
+  uint32_t o, t, peak, sum, best = 0, bestPeak = 0xFFFFFFFF, bestSum = 0xFFFFFFFF;
+  uint32_t last = (period < CYC_WINDOW) ? period : CYC_WINDOW;
+
+  for (o = 0; o < last; o++) {
+    peak = sum = 0;
+    for (t = o; t < CYC_WINDOW; t += period) {
+      if (CYC_load[t] > peak) peak = CYC_load[t];
+      sum += CYC_load[t];
+    }
+    if (peak < bestPeak || (peak == bestPeak && sum < bestSum)) {
+      best     = o;
+      bestPeak = peak;
+      bestSum  = sum;
+    }
+  }
+  return (best);
+}
+
+/*----------------------------------------------------------------------------
+  clock profile switch: keep the 1 MHz counter clock, the new prescaler
+  takes effect with the next tick
+ *----------------------------------------------------------------------------*/
+static uint32_t cyc_clock (uint32_t phase, const CLK_info *clk)  {
+
+  if (phase == CLK_CHECK) {
+    return (clk->tim1 % 1000000 == 0);
+  }
+  if (phase == CLK_POST) {
+    TIM7->PSC = (clk->tim1 / 1000000) - 1;
+  }
+  return (1);
+}
+
+/*----------------------------------------------------------------------------
+  initialise the scheduler and the tick timer TIM7, the table is empty
+ *----------------------------------------------------------------------------*/
+int32_t CYC_init (void)  {
+  uint32_t i;
+
+  for (i = 0; i < 2; i++) {
+    if (CAN_Dev[i].txHook != 0 && CAN_Dev[i].txHook != cyc_txIRQ) {
+      return (CYC_ERR_BUSY);
+    }
+  }
+  CYC_num     = 0;
+  CYC_pend[0] = CYC_pend[1] = 0;
+  CYC_lateCnt = CYC_skipCnt = 0;
+  for (i = 0; i < CYC_WINDOW; i++) CYC_load[i] = 0;
+
+  CAN_Dev[0].txHook = cyc_txIRQ;
+  CAN_Dev[1].txHook = cyc_txIRQ;
+
+  RCC->APB1ENR |= (1UL << 5);               /* Enable TIM7 clock            */
+  TIM7->CR1  = 0;
+  TIM7->PSC  = (CLK_get ()->tim1 / 1000000) - 1;  /* 1 MHz counter clock    */
+  TIM7->ARR  = CYC_TICK_US - 1;
+  TIM7->EGR  = TIM_EGR_UG;                  /* load prescaler               */
+  TIM7->SR   = 0;
+  TIM7->DIER = TIM_DIER_UIE;
+  NVIC_EnableIRQ (TIM7_IRQn);
+  CLK_notify (cyc_clock);
+  return (CYC_OK);
+}
+
+/*----------------------------------------------------------------------------
+  add a message to the schedule, period and offset are given in ticks
+  CYC_AUTO as offset staggers the message against the existing entries
+  the application may update msg->data at any time between transmissions
+ *----------------------------------------------------------------------------*/
+int32_t CYC_add (CAN_dev *dev, CAN_msg *msg, uint32_t period, uint32_t offset)  {
+  CYC_entry *e;
+  uint32_t   t;
+
+  if (CYC_num >= CYC_MAX) {
+    return (CYC_ERR_FULL);
+  }
+  if ((dev != &CAN_Dev[0] && dev != &CAN_Dev[1]) || period == 0 || period > 0xFFFF ||
+      (offset != CYC_AUTO && offset >= period)) {
+    return (CYC_ERR_PARAM);
+  }
+  if (offset == CYC_AUTO) {
+    offset = cyc_offset (period);
+  }
+  for (t = offset; t < CYC_WINDOW; t += period) {
+    if (CYC_load[t] < 0xFF) CYC_load[t]++;
+  }
+
+  e = &CYC_tab[CYC_num];
+  e->msg     = msg;
+  e->dev     = dev;
+  e->period  = period;
+  e->cnt     = offset + 1;                  /* due at tick 'offset'         */
+  e->pending = 0;
+  CYC_num++;                                /* visible to the ISR last      */
+  return (CYC_OK);
+}
+
+/*----------------------------------------------------------------------------
+  start / stop the scheduler tick
+ *----------------------------------------------------------------------------*/
+void CYC_start (void)  {
+
+  TIM7->CNT  = 0;
+  TIM7->CR1 |= TIM_CR1_CEN;
+}
+
+void CYC_stop (void)  {
+
+  TIM7->CR1 &= ~TIM_CR1_CEN;
+}
+
+/*----------------------------------------------------------------------------
+  statistics: frames that waited for a mailbox / frames skipped as overrun
+ *----------------------------------------------------------------------------*/
+uint32_t CYC_late (void)  {
+
+  return (CYC_lateCnt);
+}
+
+uint32_t CYC_skipped (void)  {
+
+  return (CYC_skipCnt);
+}
+
+/*----------------------------------------------------------------------------
+  TIM7 interrupt handler: scheduler tick
+ *----------------------------------------------------------------------------*/
+void TIM7_IRQHandler (void) {
+  CYC_entry *e;
+  uint32_t   i;
+
+  if (TIM7->SR & TIM_SR_UIF) {
+    TIM7->SR = ~TIM_SR_UIF;                 /* clear update flag            */
+
+    for (i = 0; i < CYC_num; i++) {
+      e = &CYC_tab[i];
+      if (--e->cnt == 0) {
+        e->cnt = e->period;
+        if (e->pending) {
+          CYC_skipCnt++;                    /* previous one still waiting   */
+        } else {
+          e->pending = 1;
+          CYC_pend[e->dev->ctrl-1]++;
+        }
+      }
+    }
+    if (CYC_pend[0]) cyc_flush (&CAN_Dev[0]);
+    if (CYC_pend[1]) cyc_flush (&CAN_Dev[1]);
+    CYC_lateCnt += CYC_pend[0] + CYC_pend[1];
+  }
+}
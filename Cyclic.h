@@ -0,0 +1,37 @@
+/*----------------------------------------------------------------------------
+ * Name:    Cyclic.h
+ * Purpose: timer driven transmission of cyclic CAN messages
+ * Note(s): TIM7 provides the scheduler tick, due frames are loaded into
+ *          TX mailboxes 1 and 2 directly from the timer interrupt.
+ *          The scheduler owns these mailboxes and the TX hooks of both
+ *          controllers, it cannot run together with replay or the stress
+ *          generator: CYC_init fails if another module holds a TX hook.
+ *----------------------------------------------------------------------------*/
+
+#ifndef __CYCLIC_H
+#define __CYCLIC_H
+
+#include <stdint.h>
+#include "CAN.h"
+
+/* Cyclic scheduler configuration */
+#define CYC_MAX            64                /* entries in the schedule table  */
+#define CYC_TICK_US      1000                /* scheduler tick in us           */
+#define CYC_WINDOW       1000                /* ticks used to balance offsets  */
+#define CYC_AUTO   0xFFFFFFFF                /* offset: choose least loaded    */
+
+/* Cyclic scheduler result codes */
+#define CYC_OK              0
+#define CYC_ERR_FULL       -1                /* schedule table is full         */
+#define CYC_ERR_PARAM      -2                /* invalid period or offset       */
+#define CYC_ERR_BUSY       -3                /* TX hook owned by another module */
+
+/* Functions defined in module Cyclic.c */
+int32_t  CYC_init      (void);
+int32_t  CYC_add       (CAN_dev *dev, CAN_msg *msg, uint32_t period, uint32_t offset);
+void     CYC_start     (void);
+void     CYC_stop      (void);
+uint32_t CYC_late      (void);
+uint32_t CYC_skipped   (void);
+
+#endif
@@ -0,0 +1,463 @@
+#include <stdint.h>
+#include <string.h>
+#include "CAN.h"
+#include "ISOTP.h"
+
+/* ISO-TP protocol control information (upper nibble of byte 0) */
+#define ISOTP_PCI_SF          0x00              /* single frame                */
+#define ISOTP_PCI_FF          0x10              /* first frame                 */
+#define ISOTP_PCI_CF          0x20              /* consecutive frame           */
+#define ISOTP_PCI_FC          0x30              /* flow control frame          */
+
+/* flow status of a flow control frame */
+#define ISOTP_FS_CTS          0                 /* continue to send            */
+#define ISOTP_FS_WAIT         1                 /* wait for next flow control  */
+#define ISOTP_FS_OVFLW        2                 /* receive buffer overflow     */
+
+/* channel states */
+#define ISOTP_IDLE            0
+#define ISOTP_TX_FIRST        1                 /* SF or FF waiting for mbx    */
+#define ISOTP_TX_WAIT_FC      2                 /* FF/block sent, wait for FC  */
+#define ISOTP_TX_CONSEC       3                 /* sending consecutive frames  */
+#define ISOTP_RX_CONSEC       1                 /* receiving consecutive frames*/
+#define ISOTP_RX_DONE         2                 /* message ready for the user  */
+
+typedef struct  {
+  ISOTP_cfg      cfg;                   /* channel configuration */
+  uint32_t       open;                  /* channel has been opened */
+                                        /* transmit side */
+  const uint8_t *txBuf;                 /* caller buffer, not copied */
+  uint32_t       txLen;                 /* total length of message */
+  uint32_t       txOfs;                 /* bytes already sent */
+  uint32_t       txTime;                /* time of last tx event */
+  uint32_t       txStMin;               /* peer STmin in ms ticks */
+  uint8_t        txState;
+  uint8_t        txSn;                  /* next sequence number */
+  uint8_t        txBs;                  /* peer block size */
+  uint8_t        txBsCnt;               /* CFs sent in this block */
+  uint8_t        txWft;                 /* FC.WAIT received in a row */
+  int32_t        txResult;
+                                        /* receive side */
+  uint8_t       *rxBuf;                 /* buffer taken from the pool */
+  uint32_t       rxLen;
+  uint32_t       rxOfs;
+  uint32_t       rxTime;                /* time of last rx event */
+  uint8_t        rxState;
+  uint8_t        rxSn;                  /* expected sequence number */
+  uint8_t        rxBsCnt;               /* CFs received in this block */
+  uint8_t        rxFcPending;           /* flow status still to be sent, 0xFF none */
+  int32_t        rxResult;
+} ISOTP_chn;
+
+static ISOTP_chn ISOTP_chan[ISOTP_CHANNELS];
+static uint8_t   ISOTP_pool[ISOTP_POOL_BUFS][ISOTP_MAX_LEN];
+static uint32_t  ISOTP_poolUsed;                  /* bitmap of used pool buffers */
+static uint32_t  ISOTP_now;                       /* time of last ISOTP_process  */
+
+
+/*----------------------------------------------------------------------------
+  take a reassembly buffer from the pool
+ *----------------------------------------------------------------------------*/
+static uint8_t *isotp_alloc (void)  {
+  uint32_t i;
+
+  for (i = 0; i < ISOTP_POOL_BUFS; i++) {
+    if ((ISOTP_poolUsed & (1UL << i)) == 0) {
+      ISOTP_poolUsed |= (1UL << i);
+      return (ISOTP_pool[i]);
+    }
+  }
+  return (0);
+}
+
+/*----------------------------------------------------------------------------
+  return a reassembly buffer to the pool
+ *----------------------------------------------------------------------------*/
+static void isotp_free (uint8_t *buf)  {
+  uint32_t i;
+
+  for (i = 0; i < ISOTP_POOL_BUFS; i++) {
+    if (buf == ISOTP_pool[i]) {
+      ISOTP_poolUsed &= ~(1UL << i);
+    }
+  }
+}
+
+/*----------------------------------------------------------------------------
+  convert a STmin parameter into ms ticks
+  the tick may advance right after a frame is sent, so one tick is added to
+  guarantee the minimum separation; 100-900 us values round up to one tick
+  and get the extra tick as well
+ *----------------------------------------------------------------------------*/
+static uint32_t isotp_stMin (uint8_t st)  {
+
+  if (st == 0)                 return (0);
+  if (st <= 0x7F)              return (st + 1);
+  if (st >= 0xF1 && st <= 0xF9) return (2);
+  return (0x7F + 1);                        /* reserved values: use maximum */
+}
+
+/*----------------------------------------------------------------------------
+  prepare a frame for the channel with padding applied
+ *----------------------------------------------------------------------------*/
+static void isotp_frame (ISOTP_chn *c, CAN_msg *msg)  {
+
+  msg->id     = c->cfg.txId;
+  msg->format = c->cfg.format;
+  msg->type   = DATA_FRAME;
+  msg->len    = 8;
+  memset (msg->data, ISOTP_PAD_BYTE, 8);
+}
+
+/*----------------------------------------------------------------------------
+  send a pending flow control frame of a receiving channel
+ *----------------------------------------------------------------------------*/
+static void isotp_sendFc (ISOTP_chn *c)  {
+  CAN_msg msg;
+
+  isotp_frame (c, &msg);
+  msg.data[0] = ISOTP_PCI_FC | c->rxFcPending;
+  msg.data[1] = c->cfg.blockSize;
+  msg.data[2] = c->cfg.stMin;
+  if (CAN_tryWrMsg (c->cfg.dev, &msg)) {
+    c->rxFcPending = 0xFF;
+  }
+}
+
+/*----------------------------------------------------------------------------
+  send the next frame of a transmitting channel if it is due
+ *----------------------------------------------------------------------------*/
+static void isotp_sendNext (ISOTP_chn *c)  {
+  CAN_msg  msg;
+  uint32_t n;
+
+  if (c->txState == ISOTP_TX_FIRST) {
+    isotp_frame (c, &msg);
+    if (c->txLen <= 7) {                    /* single frame                 */
+      msg.data[0] = ISOTP_PCI_SF | c->txLen;
+      memcpy (&msg.data[1], c->txBuf, c->txLen);
+      if (CAN_tryWrMsg (c->cfg.dev, &msg)) {
+        c->txResult = ISOTP_OK;
+        c->txState  = ISOTP_IDLE;
+      }
+    } else {                                /* first frame                  */
+      msg.data[0] = ISOTP_PCI_FF | (c->txLen >> 8);
+      msg.data[1] = c->txLen & 0xFF;
+      memcpy (&msg.data[2], c->txBuf, 6);
+      if (CAN_tryWrMsg (c->cfg.dev, &msg)) {
+        c->txOfs   = 6;
+        c->txSn    = 1;
+        c->txWft   = 0;
+        c->txTime  = ISOTP_now;
+        c->txState = ISOTP_TX_WAIT_FC;
+      }
+    }
+  } else if (c->txState == ISOTP_TX_CONSEC) {
+    if ((ISOTP_now - c->txTime) < c->txStMin) {
+      return;                               /* separation time not elapsed  */
+    }
+    n = c->txLen - c->txOfs;
+    if (n > 7) n = 7;
+    isotp_frame (c, &msg);
+    msg.data[0] = ISOTP_PCI_CF | c->txSn;
+    memcpy (&msg.data[1], c->txBuf + c->txOfs, n);
+    if (CAN_tryWrMsg (c->cfg.dev, &msg)) {
+      c->txOfs += n;
+      c->txSn   = (c->txSn + 1) & 0x0F;
+      c->txTime = ISOTP_now;
+      if (c->txOfs >= c->txLen) {
+        c->txResult = ISOTP_OK;
+        c->txState  = ISOTP_IDLE;
+      } else if (c->txBs != 0 && ++c->txBsCnt >= c->txBs) {
+        c->txState  = ISOTP_TX_WAIT_FC;       /* block complete, wait for FC */
+      }
+    }
+  }
+}
+
+/*----------------------------------------------------------------------------
+  abort the reception of a channel
+ *----------------------------------------------------------------------------*/
+static void isotp_rxAbort (ISOTP_chn *c, int32_t result)  {
+
+  if (c->rxBuf != 0) {
+    isotp_free (c->rxBuf);
+    c->rxBuf = 0;
+  }
+  c->rxState  = ISOTP_IDLE;
+  c->rxResult = result;
+}
+
+/*----------------------------------------------------------------------------
+  initialise the ISO-TP layer, all channels are closed
+ *----------------------------------------------------------------------------*/
+void ISOTP_init (void)  {
+
+  memset (ISOTP_chan, 0, sizeof (ISOTP_chan));
+  ISOTP_poolUsed = 0;
+}
+
+/*----------------------------------------------------------------------------
+  open a channel with the given identifiers and flow control parameters
+ *----------------------------------------------------------------------------*/
+int32_t ISOTP_open (uint32_t ch, const ISOTP_cfg *cfg)  {
+  ISOTP_chn *c;
+
+  if (ch >= ISOTP_CHANNELS || (cfg->dev != &CAN_Dev[0] && cfg->dev != &CAN_Dev[1])) {
+    return (ISOTP_ERR_PARAM);
+  }
+  c = &ISOTP_chan[ch];
+  ISOTP_close (ch);
+  c->cfg         = *cfg;
+  c->rxFcPending = 0xFF;
+  c->open        = 1;
+  return (ISOTP_OK);
+}
+
+/*----------------------------------------------------------------------------
+  close a channel and return its reassembly buffer to the pool
+ *----------------------------------------------------------------------------*/
+void ISOTP_close (uint32_t ch)  {
+  ISOTP_chn *c;
+
+  if (ch >= ISOTP_CHANNELS) {
+    return;
+  }
+  c = &ISOTP_chan[ch];
+  if (c->rxBuf != 0) {
+    isotp_free (c->rxBuf);
+  }
+  memset (c, 0, sizeof (*c));
+}
+
+/*----------------------------------------------------------------------------
+  start transmission of a message
+  the buffer is not copied and must stay valid until ISOTP_txStatus() no
+  longer returns ISOTP_BUSY
+ *----------------------------------------------------------------------------*/
+int32_t ISOTP_send (uint32_t ch, const uint8_t *buf, uint32_t len)  {
+  ISOTP_chn *c;
+
+  if (ch >= ISOTP_CHANNELS || len == 0 || len > ISOTP_MAX_LEN) {
+    return (ISOTP_ERR_PARAM);
+  }
+  c = &ISOTP_chan[ch];
+  if (!c->open) {
+    return (ISOTP_ERR_PARAM);
+  }
+  if (c->txState != ISOTP_IDLE) {
+    return (ISOTP_BUSY);
+  }
+  c->txBuf    = buf;
+  c->txLen    = len;
+  c->txOfs    = 0;
+  c->txResult = ISOTP_BUSY;
+  c->txState  = ISOTP_TX_FIRST;
+  isotp_sendNext (c);                     /* try to start immediately       */
+  return (ISOTP_OK);
+}
+
+/*----------------------------------------------------------------------------
+  result of the last transmission, ISOTP_BUSY while still in progress
+ *----------------------------------------------------------------------------*/
+int32_t ISOTP_txStatus (uint32_t ch)  {
+
+  if (ch >= ISOTP_CHANNELS) {
+    return (ISOTP_ERR_PARAM);
+  }
+  return (ISOTP_chan[ch].txResult);
+}
+
+/*----------------------------------------------------------------------------
+  get a completely received message, returns 0 if none is available
+  the buffer belongs to the channel until ISOTP_release() is called
+ *----------------------------------------------------------------------------*/
+uint8_t *ISOTP_receive (uint32_t ch, uint32_t *len)  {
+  ISOTP_chn *c;
+
+  if (ch >= ISOTP_CHANNELS) {
+    return (0);
+  }
+  c = &ISOTP_chan[ch];
+  if (c->rxState != ISOTP_RX_DONE) {
+    return (0);
+  }
+  *len = c->rxLen;
+  return (c->rxBuf);
+}
+
+/*----------------------------------------------------------------------------
+  hand a received message buffer back to the pool
+ *----------------------------------------------------------------------------*/
+void ISOTP_release (uint32_t ch)  {
+
+  if (ch < ISOTP_CHANNELS && ISOTP_chan[ch].rxState == ISOTP_RX_DONE) {
+    isotp_rxAbort (&ISOTP_chan[ch], ISOTP_OK);
+  }
+}
+
+/*----------------------------------------------------------------------------
+  result of the last reception, ISOTP_BUSY while a message is assembled
+ *----------------------------------------------------------------------------*/
+int32_t ISOTP_rxStatus (uint32_t ch)  {
+
+  if (ch >= ISOTP_CHANNELS) {
+    return (ISOTP_ERR_PARAM);
+  }
+  return (ISOTP_chan[ch].rxResult);
+}
+
+/*----------------------------------------------------------------------------
+  process a received CAN frame
+  frames that do not belong to an open channel are ignored
+ *----------------------------------------------------------------------------*/
+void ISOTP_rxMsg (CAN_dev *dev, CAN_msg *msg)  {
+  ISOTP_chn *c;
+  uint32_t   ch, len, n;
+  uint8_t    pci;
+
+  if (msg->type != DATA_FRAME || msg->len == 0) {
+    return;
+  }
+  for (ch = 0; ch < ISOTP_CHANNELS; ch++) {
+    c = &ISOTP_chan[ch];
+    if (c->open && c->cfg.dev == dev && c->cfg.rxId == msg->id && c->cfg.format == msg->format) {
+      break;
+    }
+  }
+  if (ch == ISOTP_CHANNELS) {
+    return;
+  }
+
+  pci = msg->data[0] & 0xF0;
+  switch (pci) {
+    case ISOTP_PCI_SF:
+      len = msg->data[0] & 0x0F;
+      if (len == 0 || len > 7 || len >= msg->len || c->rxState == ISOTP_RX_DONE) {
+        break;                              /* invalid or previous unread   */
+      }
+      if (c->rxState == ISOTP_RX_CONSEC) {
+        isotp_rxAbort (c, ISOTP_ERR_SEQ);   /* SF interrupts a reception    */
+      }
+      if ((c->rxBuf = isotp_alloc ()) == 0) {
+        break;
+      }
+      memcpy (c->rxBuf, &msg->data[1], len);
+      c->rxLen    = len;
+      c->rxResult = ISOTP_OK;
+      c->rxState  = ISOTP_RX_DONE;
+      break;
+
+    case ISOTP_PCI_FF:
+      len = ((msg->data[0] & 0x0F) << 8) | msg->data[1];
+      if (len < 8 || msg->len < 8) {
+        break;
+      }
+      if (c->rxState == ISOTP_RX_CONSEC) {
+        isotp_rxAbort (c, ISOTP_ERR_SEQ);
+      }
+      if (c->rxState == ISOTP_RX_DONE || (c->rxBuf = isotp_alloc ()) == 0) {
+        c->rxFcPending = ISOTP_FS_OVFLW;    /* previous unread or pool empty*/
+        isotp_sendFc (c);
+        break;
+      }
+      memcpy (c->rxBuf, &msg->data[2], 6);
+      c->rxLen       = len;
+      c->rxOfs       = 6;
+      c->rxSn        = 1;
+      c->rxBsCnt     = 0;
+      c->rxTime      = ISOTP_now;
+      c->rxResult    = ISOTP_BUSY;
+      c->rxState     = ISOTP_RX_CONSEC;
+      c->rxFcPending = ISOTP_FS_CTS;
+      isotp_sendFc (c);
+      break;
+
+    case ISOTP_PCI_CF:
+      if (c->rxState != ISOTP_RX_CONSEC) {
+        break;
+      }
+      if ((msg->data[0] & 0x0F) != c->rxSn) {
+        isotp_rxAbort (c, ISOTP_ERR_SEQ);
+        break;
+      }
+      n = c->rxLen - c->rxOfs;
+      if (n > 7) n = 7;
+      if (n >= msg->len) n = msg->len - 1;
+      memcpy (c->rxBuf + c->rxOfs, &msg->data[1], n);
+      c->rxOfs += n;
+      c->rxSn   = (c->rxSn + 1) & 0x0F;
+      c->rxTime = ISOTP_now;
+      if (c->rxOfs >= c->rxLen) {
+        c->rxResult = ISOTP_OK;
+        c->rxState  = ISOTP_RX_DONE;
+      } else if (c->cfg.blockSize != 0 && ++c->rxBsCnt >= c->cfg.blockSize) {
+        c->rxBsCnt     = 0;
+        c->rxFcPending = ISOTP_FS_CTS;      /* request the next block       */
+        isotp_sendFc (c);
+      }
+      break;
+
+    case ISOTP_PCI_FC:
+      if (c->txState != ISOTP_TX_WAIT_FC || msg->len < 3) {
+        break;
+      }
+      switch (msg->data[0] & 0x0F) {
+        case ISOTP_FS_CTS:
+          c->txBs    = msg->data[1];
+          c->txBsCnt = 0;
+          c->txWft   = 0;
+          c->txStMin = isotp_stMin (msg->data[2]);
+          c->txTime  = ISOTP_now - c->txStMin;  /* first CF is due at once  */
+          c->txState = ISOTP_TX_CONSEC;
+          isotp_sendNext (c);
+          break;
+        case ISOTP_FS_WAIT:
+          if (++c->txWft > ISOTP_WFT_MAX) { /* N_WFTmax exceeded            */
+            c->txResult = ISOTP_ERR_TIMEOUT;
+            c->txState  = ISOTP_IDLE;
+            break;
+          }
+          c->txTime  = ISOTP_now;           /* restart N_Bs                 */
+          break;
+        default:
+          c->txResult = ISOTP_ERR_OVFLW;
+          c->txState  = ISOTP_IDLE;
+          break;
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+/*----------------------------------------------------------------------------
+  run the channel state machines, now is a free running ms tick
+ *----------------------------------------------------------------------------*/
+void ISOTP_process (uint32_t now)  {
+  ISOTP_chn *c;
+  uint32_t   ch;
+
+  ISOTP_now = now;
+  for (ch = 0; ch < ISOTP_CHANNELS; ch++) {
+    c = &ISOTP_chan[ch];
+    if (!c->open) {
+      continue;
+    }
+    if (c->rxFcPending != 0xFF) {
+      isotp_sendFc (c);
+    }
+    if (c->rxState == ISOTP_RX_CONSEC && (now - c->rxTime) > ISOTP_TIMEOUT) {
+      isotp_rxAbort (c, ISOTP_ERR_TIMEOUT); /* N_Cr expired                 */
+    }
+    if (c->txState == ISOTP_TX_WAIT_FC) {
+      if ((now - c->txTime) > ISOTP_TIMEOUT) {
+        c->txResult = ISOTP_ERR_TIMEOUT;    /* N_Bs expired                 */
+        c->txState  = ISOTP_IDLE;
+      }
+    } else if (c->txState != ISOTP_IDLE) {
+      isotp_sendNext (c);
+    }
+  }
+}
@@ -0,0 +1,51 @@
+/*----------------------------------------------------------------------------
+ * Name:    ISOTP.h
+ * Purpose: ISO 15765-2 (ISO-TP) transport layer definitions
+ * Note(s): payloads of up to 4095 bytes are segmented into single, first,
+ *          consecutive and flow control frames on top of CAN.c
+ *----------------------------------------------------------------------------*/
+
+#ifndef __ISOTP_H
+#define __ISOTP_H
+
+#include <stdint.h>
+#include "CAN.h"
+
+/* ISO-TP configuration */
+#define ISOTP_CHANNELS      4                /* concurrent channels            */
+#define ISOTP_POOL_BUFS     2                /* reassembly buffers in the pool */
+#define ISOTP_MAX_LEN    4095                /* largest ISO-TP message         */
+#define ISOTP_PAD_BYTE   0xCC                /* frames are padded to 8 bytes   */
+#define ISOTP_TIMEOUT    1000                /* N_Bs / N_Cr timeout in ms      */
+#define ISOTP_WFT_MAX      10                /* FC.WAIT accepted in a row      */
+
+/* ISO-TP result codes */
+#define ISOTP_OK            0
+#define ISOTP_BUSY         -1                /* channel busy, try again later  */
+#define ISOTP_ERR_PARAM    -2                /* invalid channel or length      */
+#define ISOTP_ERR_TIMEOUT  -3                /* flow control / CF timed out    */
+#define ISOTP_ERR_OVFLW    -4                /* receiver reported overflow     */
+#define ISOTP_ERR_SEQ      -5                /* wrong sequence number          */
+
+typedef struct  {
+  CAN_dev       *dev;                   /* CAN controller, CAN_DEV(1) or CAN_DEV(2) */
+  uint32_t       txId;                  /* identifier of transmitted frames */
+  uint32_t       rxId;                  /* identifier of received frames */
+  unsigned char  format;                /* 0 - STANDARD, 1- EXTENDED IDENTIFIER */
+  unsigned char  blockSize;             /* BS sent in our flow control frames */
+  unsigned char  stMin;                 /* STmin sent in our flow control frames */
+} ISOTP_cfg;
+
+/* Functions defined in module ISOTP.c */
+void     ISOTP_init      (void);
+int32_t  ISOTP_open      (uint32_t ch, const ISOTP_cfg *cfg);
+void     ISOTP_close     (uint32_t ch);
+int32_t  ISOTP_send      (uint32_t ch, const uint8_t *buf, uint32_t len);
+int32_t  ISOTP_txStatus  (uint32_t ch);
+uint8_t *ISOTP_receive   (uint32_t ch, uint32_t *len);
+void     ISOTP_release   (uint32_t ch);
+int32_t  ISOTP_rxStatus  (uint32_t ch);
+void     ISOTP_rxMsg     (CAN_dev *dev, CAN_msg *msg);
+void     ISOTP_process   (uint32_t now);
+
+#endif
@@ -0,0 +1,608 @@
+#include <stdint.h>
+#include <string.h>
+#include "CAN.h"
+#include "J1939.h"
+
+/* transport protocol connection management control bytes */
+#define J1939_TP_RTS          16                /* request to send             */
+#define J1939_TP_CTS          17                /* clear to send               */
+#define J1939_TP_EOMA         19                /* end of message acknowledge  */
+#define J1939_TP_BAM          32                /* broadcast announce message  */
+#define J1939_TP_ABORT       255                /* connection abort            */
+
+/* connection abort reasons */
+#define J1939_ABORT_BUSY       1                /* already in a session        */
+#define J1939_ABORT_RESOURCE   2                /* lacking resources           */
+#define J1939_ABORT_TIMEOUT    3
+#define J1939_ABORT_SIZE       9                /* bad size or packet count    */
+
+/* transport protocol timeouts in ms */
+#define J1939_T1             750                /* between received packets    */
+#define J1939_T2            1250                /* after CTS was sent          */
+#define J1939_T3            1250                /* after last packet / RTS     */
+#define J1939_T4            1050                /* after CTS(0) hold           */
+
+#define J1939_TP_PRIO          7                /* priority of TP frames       */
+#define J1939_TXQ_SIZE         8                /* queued control frames       */
+
+/* address claim states */
+#define J1939_AC_CLAIMING      0                /* claim sent, waiting 250 ms  */
+#define J1939_AC_CLAIMED       1
+#define J1939_AC_LOST          2                /* no address available        */
+
+/* transport session states */
+#define J1939_TP_IDLE          0
+#define J1939_TP_TX_CM         1                /* RTS or BAM waiting for mbx  */
+#define J1939_TP_TX_DT         2                /* sending data packets        */
+#define J1939_TP_TX_WAIT_CTS   3
+#define J1939_TP_TX_WAIT_EOMA  4
+#define J1939_TP_RX_DT         1                /* receiving data packets      */
+
+typedef struct  {
+  uint8_t        state;
+  uint8_t        bam;                   /* broadcast session */
+  uint8_t        peer;                  /* address of the other node */
+  uint8_t        prio;
+  uint32_t       pgn;                   /* PGN being transported */
+  uint32_t       len;
+  uint8_t        packets;               /* total number of packets */
+  uint8_t        next;                  /* next packet sequence number */
+  uint8_t        last;                  /* last packet of the current window */
+  uint8_t        limit;                 /* packets per CTS allowed by RTS */
+  uint32_t       time;                  /* start of the running timeout */
+  uint32_t       timeout;
+} J1939_tp;
+
+static J1939_cfg      J1939_conf;
+static uint8_t        J1939_addr;                 /* current source address   */
+static uint8_t        J1939_acState;
+static uint32_t       J1939_acTime;
+static uint32_t       J1939_now;
+
+static CAN_msg        J1939_txq[J1939_TXQ_SIZE];  /* pending control frames   */
+static uint32_t       J1939_txqIn, J1939_txqOut;
+
+static J1939_tp       J1939_txTp;                 /* single transmit session  */
+static const uint8_t *J1939_txBuf;                /* caller buffer, not copied*/
+static int32_t        J1939_txResult;
+
+static J1939_tp       J1939_rxTp [J1939_RX_SESSIONS];
+static uint8_t        J1939_rxBuf[J1939_RX_SESSIONS][J1939_TP_MAX];
+
+
+/*----------------------------------------------------------------------------
+  build a 29 bit identifier
+ *----------------------------------------------------------------------------*/
+uint32_t J1939_id (uint8_t prio, uint32_t pgn, uint8_t sa, uint8_t da)  {
+
+  if (((pgn >> 8) & 0xFF) < 240) {         /* PDU1: PS is destination      */
+    pgn = (pgn & 0x3FF00) | da;
+  }
+  return (((uint32_t)(prio & 0x07) << 26) | ((pgn & 0x3FFFF) << 8) | sa);
+}
+
+/*----------------------------------------------------------------------------
+  decode a received frame into a PDU, data is not copied
+ *----------------------------------------------------------------------------*/
+void J1939_decode (CAN_msg *msg, J1939_pdu *pdu)  {
+  uint32_t id = msg->id;
+
+  pdu->pgn  = J1939_PGN(id);
+  pdu->prio = J1939_PRIO(id);
+  pdu->sa   = J1939_SA(id);
+  pdu->da   = J1939_DA(id);
+  pdu->len  = msg->len;
+  pdu->data = msg->data;
+}
+
+/*----------------------------------------------------------------------------
+  transmit queued control frames as long as the mailbox accepts them
+ *----------------------------------------------------------------------------*/
+static void j1939_flush (void)  {
+
+  while (J1939_txqOut != J1939_txqIn) {
+    if (!CAN_tryWrMsg (J1939_conf.dev, &J1939_txq[J1939_txqOut % J1939_TXQ_SIZE])) {
+      break;
+    }
+    J1939_txqOut++;
+  }
+}
+
+/*----------------------------------------------------------------------------
+  queue a frame built from PGN, destination and 8 data bytes
+ *----------------------------------------------------------------------------*/
+static void j1939_queue (uint8_t prio, uint32_t pgn, uint8_t da, const uint8_t *data)  {
+  CAN_msg *msg;
+
+  if (J1939_txqIn - J1939_txqOut >= J1939_TXQ_SIZE) {
+    return;                                 /* queue full: frame is lost    */
+  }
+  msg = &J1939_txq[J1939_txqIn % J1939_TXQ_SIZE];
+  msg->id     = J1939_id (prio, pgn, J1939_addr, da);
+  msg->format = EXTENDED_FORMAT;
+  msg->type   = DATA_FRAME;
+  msg->len    = 8;
+  memcpy (msg->data, data, 8);
+  J1939_txqIn++;
+  j1939_flush ();
+}
+
+/*----------------------------------------------------------------------------
+  queue a transport protocol connection management frame
+ *----------------------------------------------------------------------------*/
+static void j1939_cm (uint8_t da, uint8_t c0, uint8_t c1, uint8_t c2, uint8_t c3, uint8_t c4, uint32_t pgn)  {
+  uint8_t d[8];
+
+  d[0] = c0; d[1] = c1; d[2] = c2; d[3] = c3; d[4] = c4;
+  d[5] = pgn & 0xFF;
+  d[6] = (pgn >>  8) & 0xFF;
+  d[7] = (pgn >> 16) & 0xFF;
+  j1939_queue (J1939_TP_PRIO, J1939_PGN_TP_CM, da, d);
+}
+
+/*----------------------------------------------------------------------------
+  send our address claim, or cannot claim if no address is left
+ *----------------------------------------------------------------------------*/
+static void j1939_claim (void)  {
+
+  j1939_queue (6, J1939_PGN_ADDR, J1939_ADDR_GLOBAL, J1939_conf.name);
+  J1939_acTime = J1939_now;
+}
+
+/*----------------------------------------------------------------------------
+  compare a received NAME against ours, > 0 if ours has lower priority
+ *----------------------------------------------------------------------------*/
+static int32_t j1939_cmpName (const uint8_t *name)  {
+  int32_t i;
+
+  for (i = 7; i >= 0; i--) {                /* most significant byte last   */
+    if (J1939_conf.name[i] != name[i]) {
+      return ((int32_t)J1939_conf.name[i] - (int32_t)name[i]);
+    }
+  }
+  return (0);
+}
+
+/*----------------------------------------------------------------------------
+  handle an address claim of another node
+ *----------------------------------------------------------------------------*/
+static void j1939_rxClaim (uint8_t sa, const uint8_t *name)  {
+
+  if (sa != J1939_addr || J1939_acState == J1939_AC_LOST) {
+    return;
+  }
+  if (j1939_cmpName (name) < 0) {           /* our NAME wins: defend        */
+    j1939_claim ();
+    return;
+  }
+  if (J1939_conf.name[7] & 0x80) {          /* arbitrary address capable    */
+    do {
+      J1939_addr = (J1939_addr < 128 || J1939_addr >= 247) ? 128 : J1939_addr + 1;
+    } while (J1939_addr == sa);
+    J1939_acState = J1939_AC_CLAIMING;
+  } else {
+    J1939_addr    = J1939_ADDR_NULL;
+    J1939_acState = J1939_AC_LOST;
+  }
+  j1939_claim ();
+}
+
+/*----------------------------------------------------------------------------
+  number of packets needed for len bytes
+ *----------------------------------------------------------------------------*/
+static uint8_t j1939_packets (uint32_t len)  {
+
+  return ((uint8_t)((len + 6) / 7));
+}
+
+/*----------------------------------------------------------------------------
+  close the transmit session with a result
+ *----------------------------------------------------------------------------*/
+static void j1939_txDone (int32_t result)  {
+
+  J1939_txTp.state = J1939_TP_IDLE;
+  J1939_txResult   = result;
+}
+
+/*----------------------------------------------------------------------------
+  advance the transmit session
+ *----------------------------------------------------------------------------*/
+static void j1939_txRun (void)  {
+  J1939_tp *tp = &J1939_txTp;
+  CAN_msg   msg;
+  uint32_t  ofs, n;
+
+  if (tp->state == J1939_TP_TX_CM) {
+    if (tp->bam) {
+      j1939_cm (J1939_ADDR_GLOBAL, J1939_TP_BAM, tp->len & 0xFF, tp->len >> 8, tp->packets, 0xFF, tp->pgn);
+      tp->last  = tp->packets;
+      tp->state = J1939_TP_TX_DT;
+    } else {
+      j1939_cm (tp->peer, J1939_TP_RTS, tp->len & 0xFF, tp->len >> 8, tp->packets, 0xFF, tp->pgn);
+      tp->timeout = J1939_T3;
+      tp->state   = J1939_TP_TX_WAIT_CTS;
+    }
+    tp->next = 1;
+    tp->time = J1939_now;
+    return;
+  }
+  if (tp->state != J1939_TP_TX_DT) {
+    return;
+  }
+  if (tp->bam && (J1939_now - tp->time) < J1939_BAM_GAP) {
+    return;                                 /* BAM and its packets paced    */
+  }
+  while (tp->next <= tp->last) {
+    ofs = (uint32_t)(tp->next - 1) * 7;
+    n   = tp->len - ofs;
+    if (n > 7) n = 7;
+    msg.id      = J1939_id (J1939_TP_PRIO, J1939_PGN_TP_DT, J1939_addr, tp->bam ? J1939_ADDR_GLOBAL : tp->peer);
+    msg.format  = EXTENDED_FORMAT;
+    msg.type    = DATA_FRAME;
+    msg.len     = 8;
+    msg.data[0] = tp->next;
+    memset (&msg.data[1], 0xFF, 7);
+    memcpy (&msg.data[1], J1939_txBuf + ofs, n);
+    if (!CAN_tryWrMsg (J1939_conf.dev, &msg)) {
+      return;                               /* retry from J1939_process     */
+    }
+    tp->next++;
+    tp->time = J1939_now;
+    if (tp->bam) {
+      break;
+    }
+  }
+  if (tp->next > tp->packets) {
+    if (tp->bam) {
+      j1939_txDone (J1939_OK);
+    } else {
+      tp->timeout = J1939_T3;
+      tp->state   = J1939_TP_TX_WAIT_EOMA;
+    }
+  } else if (tp->next > tp->last) {
+    tp->timeout = J1939_T3;
+    tp->state   = J1939_TP_TX_WAIT_CTS;
+  }
+}
+
+/*----------------------------------------------------------------------------
+  find the receive session of a peer, or a free one if alloc is set
+ *----------------------------------------------------------------------------*/
+static J1939_tp *j1939_rxSession (uint8_t sa, uint8_t bam, uint32_t alloc)  {
+  uint32_t i;
+
+  for (i = 0; i < J1939_RX_SESSIONS; i++) {
+    if (J1939_rxTp[i].state != J1939_TP_IDLE && J1939_rxTp[i].peer == sa && J1939_rxTp[i].bam == bam) {
+      return (&J1939_rxTp[i]);
+    }
+  }
+  if (alloc) {
+    for (i = 0; i < J1939_RX_SESSIONS; i++) {
+      if (J1939_rxTp[i].state == J1939_TP_IDLE) {
+        return (&J1939_rxTp[i]);
+      }
+    }
+  }
+  return (0);
+}
+
+/*----------------------------------------------------------------------------
+  grant the next window of packets to a CMDT sender
+ *----------------------------------------------------------------------------*/
+static void j1939_cts (J1939_tp *tp)  {
+  uint32_t n = tp->packets - tp->next + 1;
+
+  if (n > J1939_CTS_PACKETS) n = J1939_CTS_PACKETS;
+  if (n > tp->limit)         n = tp->limit;
+  j1939_cm (tp->peer, J1939_TP_CTS, n, tp->next, 0xFF, 0xFF, tp->pgn);
+  tp->last    = tp->next + n - 1;
+  tp->time    = J1939_now;
+  tp->timeout = J1939_T2;
+}
+
+/*----------------------------------------------------------------------------
+  handle a connection management frame
+ *----------------------------------------------------------------------------*/
+static void j1939_rxCm (const J1939_pdu *pdu)  {
+  const uint8_t *d = pdu->data;
+  J1939_tp      *tp;
+  uint32_t       pgn = d[5] | ((uint32_t)d[6] << 8) | ((uint32_t)d[7] << 16);
+  uint32_t       len = d[1] | ((uint32_t)d[2] << 8);
+  uint32_t       end;
+
+  switch (d[0]) {
+    case J1939_TP_BAM:
+    case J1939_TP_RTS:
+      if (d[0] == J1939_TP_RTS && pdu->da != J1939_addr) {
+        break;
+      }
+      tp = j1939_rxSession (pdu->sa, d[0] == J1939_TP_BAM, 1);
+      if (tp == 0 || len > J1939_TP_MAX || len < 9 || d[3] != j1939_packets (len)) {
+        if (d[0] == J1939_TP_RTS) {
+          j1939_cm (pdu->sa, J1939_TP_ABORT, tp ? J1939_ABORT_SIZE : J1939_ABORT_RESOURCE, 0xFF, 0xFF, 0xFF, pgn);
+        }
+        break;
+      }
+      tp->bam     = (d[0] == J1939_TP_BAM);
+      tp->peer    = pdu->sa;
+      tp->prio    = pdu->prio;
+      tp->pgn     = pgn;
+      tp->len     = len;
+      tp->packets = d[3];
+      tp->next    = 1;
+      tp->last    = tp->packets;
+      tp->limit   = (d[4] == 0) ? 0xFF : d[4];
+      tp->time    = J1939_now;
+      tp->timeout = J1939_T1;
+      tp->state   = J1939_TP_RX_DT;
+      if (!tp->bam) {
+        j1939_cts (tp);
+      }
+      break;
+
+    case J1939_TP_CTS:
+      tp = &J1939_txTp;
+      if (tp->state != J1939_TP_TX_WAIT_CTS || tp->bam || pdu->sa != tp->peer) {
+        break;
+      }
+      tp->time = J1939_now;
+      if (d[1] == 0) {                      /* hold the connection open     */
+        tp->timeout = J1939_T4;
+        break;
+      }
+      if (d[2] == 0 || d[2] > tp->packets) {
+        break;
+      }
+      end = (uint32_t)d[2] + d[1] - 1;      /* up to 509, clamp before store */
+      if (end > tp->packets) end = tp->packets;
+      tp->next  = d[2];
+      tp->last  = (uint8_t)end;
+      tp->state = J1939_TP_TX_DT;
+      j1939_txRun ();
+      break;
+
+    case J1939_TP_EOMA:
+      if (J1939_txTp.state == J1939_TP_TX_WAIT_EOMA && pdu->sa == J1939_txTp.peer) {
+        j1939_txDone (J1939_OK);
+      }
+      break;
+
+    case J1939_TP_ABORT:
+      if (J1939_txTp.state != J1939_TP_IDLE && !J1939_txTp.bam && pdu->sa == J1939_txTp.peer) {
+        j1939_txDone (J1939_ERR_ABORT);
+      }
+      if ((tp = j1939_rxSession (pdu->sa, 0, 0)) != 0) {
+        tp->state = J1939_TP_IDLE;
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+/*----------------------------------------------------------------------------
+  handle a data transfer frame
+ *----------------------------------------------------------------------------*/
+static void j1939_rxDt (const J1939_pdu *pdu)  {
+  J1939_tp  *tp;
+  uint32_t   s;
+  J1939_pdu  out;
+  uint32_t   ofs, n;
+
+  tp = j1939_rxSession (pdu->sa, pdu->da == J1939_ADDR_GLOBAL, 0);
+  if (tp == 0 || pdu->data[0] != tp->next) {
+    return;                                 /* unknown session or sequence  */
+  }
+  s   = tp - J1939_rxTp;
+  ofs = (uint32_t)(tp->next - 1) * 7;
+  n   = tp->len - ofs;
+  if (n > 7) n = 7;
+  memcpy (&J1939_rxBuf[s][ofs], &pdu->data[1], n);
+  tp->next++;
+  tp->time    = J1939_now;
+  tp->timeout = J1939_T1;
+
+  if (tp->next > tp->packets) {             /* message complete             */
+    if (!tp->bam) {
+      j1939_cm (tp->peer, J1939_TP_EOMA, tp->len & 0xFF, tp->len >> 8, tp->packets, 0xFF, tp->pgn);
+    }
+    tp->state = J1939_TP_IDLE;
+    out.pgn   = tp->pgn;
+    out.prio  = tp->prio;
+    out.sa    = tp->peer;
+    out.da    = tp->bam ? J1939_ADDR_GLOBAL : J1939_addr;
+    out.len   = tp->len;
+    out.data  = J1939_rxBuf[s];
+    if (J1939_conf.rxFunc) {
+      J1939_conf.rxFunc (&out);
+    }
+  } else if (!tp->bam && tp->next > tp->last) {
+    j1939_cts (tp);                         /* window done, grant the next  */
+  }
+}
+
+/*----------------------------------------------------------------------------
+  initialise the J1939 layer and start claiming the preferred address
+ *----------------------------------------------------------------------------*/
+void J1939_init (const J1939_cfg *cfg, uint32_t now)  {
+
+  J1939_conf     = *cfg;
+  J1939_now      = now;
+  J1939_txqIn    = J1939_txqOut = 0;
+  J1939_txResult = J1939_OK;
+  memset (&J1939_txTp, 0, sizeof (J1939_txTp));
+  memset (J1939_rxTp,  0, sizeof (J1939_rxTp));
+
+  J1939_addr    = cfg->address;
+  J1939_acState = J1939_AC_CLAIMING;
+  j1939_claim ();
+}
+
+/*----------------------------------------------------------------------------
+  current source address, J1939_ADDR_NULL while no address is claimed
+ *----------------------------------------------------------------------------*/
+uint8_t J1939_address (void)  {
+
+  return ((J1939_acState == J1939_AC_CLAIMED) ? J1939_addr : J1939_ADDR_NULL);
+}
+
+/*----------------------------------------------------------------------------
+  send a parameter group
+  up to 8 bytes are sent in one frame, longer messages use BAM when sent to
+  the global address and CMDT otherwise; the buffer of a transport session
+  is not copied and must stay valid until J1939_txStatus() is not J1939_BUSY
+ *----------------------------------------------------------------------------*/
+int32_t J1939_send (uint32_t pgn, uint8_t prio, uint8_t da, const uint8_t *data, uint32_t len)  {
+  CAN_msg  msg;
+  uint32_t key;
+
+  if (J1939_acState != J1939_AC_CLAIMED) {
+    return (J1939_ERR_ADDR);
+  }
+  if (len > J1939_TP_MAX) {
+    return (J1939_ERR_PARAM);
+  }
+  if (len <= 8) {
+    msg.id     = J1939_id (prio, pgn, J1939_addr, da);
+    msg.format = EXTENDED_FORMAT;
+    msg.type   = DATA_FRAME;
+    msg.len    = len;
+    memcpy (msg.data, data, len);
+    return (CAN_tryWrMsg (J1939_conf.dev, &msg) ? J1939_OK : J1939_BUSY);
+  }
+  key = CAN_lock ();                        /* session is shared with RX    */
+  if (J1939_txTp.state != J1939_TP_IDLE) {
+    CAN_unlock (key);
+    return (J1939_BUSY);
+  }
+  J1939_txBuf        = data;
+  J1939_txResult     = J1939_BUSY;
+  J1939_txTp.bam     = (da == J1939_ADDR_GLOBAL);
+  J1939_txTp.peer    = da;
+  J1939_txTp.prio    = prio;
+  J1939_txTp.pgn     = pgn;
+  J1939_txTp.len     = len;
+  J1939_txTp.packets = j1939_packets (len);
+  J1939_txTp.state   = J1939_TP_TX_CM;
+  j1939_txRun ();
+  CAN_unlock (key);
+  return (J1939_OK);
+}
+
+/*----------------------------------------------------------------------------
+  result of the last transport session, J1939_BUSY while in progress
+ *----------------------------------------------------------------------------*/
+int32_t J1939_txStatus (void)  {
+
+  return (J1939_txResult);
+}
+
+/*----------------------------------------------------------------------------
+  process a received CAN frame
+  the identifier is decoded once here; data link layer PGNs are consumed,
+  all others addressed to us or global are passed to the rxFunc callback;
+  the claim, the transmit queue and the sessions are shared with
+  J1939_process and J1939_send and only changed under CAN_lock
+ *----------------------------------------------------------------------------*/
+void J1939_rxMsg (CAN_dev *dev, CAN_msg *msg)  {
+  J1939_pdu pdu;
+  uint32_t  req;
+  uint32_t  key;
+
+  if (dev != J1939_conf.dev || msg->format != EXTENDED_FORMAT || msg->type != DATA_FRAME) {
+    return;
+  }
+  J1939_decode (msg, &pdu);
+  if (pdu.da != J1939_ADDR_GLOBAL && pdu.da != J1939_addr) {
+    return;                                 /* addressed to another node    */
+  }
+
+  switch (pdu.pgn) {
+    case J1939_PGN_ADDR:
+      if (pdu.len == 8) {
+        key = CAN_lock ();
+        j1939_rxClaim (pdu.sa, pdu.data);
+        CAN_unlock (key);
+      }
+      break;
+
+    case J1939_PGN_REQUEST:
+      req = pdu.data[0] | ((uint32_t)pdu.data[1] << 8) | ((uint32_t)pdu.data[2] << 16);
+      if (pdu.len >= 3 && req == J1939_PGN_ADDR) {
+        key = CAN_lock ();
+        j1939_claim ();
+        CAN_unlock (key);
+      } else if (J1939_conf.rxFunc) {
+        J1939_conf.rxFunc (&pdu);
+      }
+      break;
+
+    case J1939_PGN_TP_CM:
+      if (pdu.len == 8) {
+        key = CAN_lock ();
+        j1939_rxCm (&pdu);
+        CAN_unlock (key);
+      }
+      break;
+
+    case J1939_PGN_TP_DT:
+      if (pdu.len == 8) {
+        key = CAN_lock ();
+        j1939_rxDt (&pdu);
+        CAN_unlock (key);
+      }
+      break;
+
+    default:
+      if (J1939_conf.rxFunc) {
+        J1939_conf.rxFunc (&pdu);
+      }
+      break;
+  }
+}
+
+/*----------------------------------------------------------------------------
+  run address claim and transport timers, now is a free running ms tick
+ *----------------------------------------------------------------------------*/
+void J1939_process (uint32_t now)  {
+  J1939_tp *tp;
+  uint32_t  i;
+  uint32_t  key;
+
+  key = CAN_lock ();
+  J1939_now = now;
+  j1939_flush ();
+
+  if (J1939_acState == J1939_AC_CLAIMING && (now - J1939_acTime) >= J1939_CLAIM_TIME) {
+    J1939_acState = J1939_AC_CLAIMED;       /* nobody contested the claim   */
+  }
+
+  tp = &J1939_txTp;
+  switch (tp->state) {
+    case J1939_TP_TX_CM:
+    case J1939_TP_TX_DT:
+      j1939_txRun ();
+      break;
+    case J1939_TP_TX_WAIT_CTS:
+    case J1939_TP_TX_WAIT_EOMA:
+      if ((now - tp->time) > tp->timeout) {
+        j1939_cm (tp->peer, J1939_TP_ABORT, J1939_ABORT_TIMEOUT, 0xFF, 0xFF, 0xFF, tp->pgn);
+        j1939_txDone (J1939_ERR_TIMEOUT);
+      }
+      break;
+    default:
+      break;
+  }
+
+  for (i = 0; i < J1939_RX_SESSIONS; i++) {
+    tp = &J1939_rxTp[i];
+    if (tp->state != J1939_TP_IDLE && (now - tp->time) > tp->timeout) {
+      if (!tp->bam) {
+        j1939_cm (tp->peer, J1939_TP_ABORT, J1939_ABORT_TIMEOUT, 0xFF, 0xFF, 0xFF, tp->pgn);
+      }
+      tp->state = J1939_TP_IDLE;
+    }
+  }
+  CAN_unlock (key);
+}
@@ -0,0 +1,76 @@
+/*----------------------------------------------------------------------------
+ * Name:    J1939.h
+ * Purpose: SAE J1939 data link layer definitions
+ * Note(s): identifier decoding, address claim and BAM / CMDT transport
+ *          protocol on top of CAN.c, extended identifiers only
+ *----------------------------------------------------------------------------*/
+
+#ifndef __J1939_H
+#define __J1939_H
+
+#include <stdint.h>
+#include "CAN.h"
+
+/* J1939 configuration */
+#define J1939_RX_SESSIONS   2                /* concurrent TP receptions       */
+#define J1939_TP_MAX     1785                /* 255 packets * 7 bytes          */
+#define J1939_CTS_PACKETS  16                /* packets granted per CTS        */
+#define J1939_BAM_GAP      50                /* ms between BAM data packets    */
+#define J1939_CLAIM_TIME  250                /* ms before a claim is valid     */
+
+/* special addresses */
+#define J1939_ADDR_GLOBAL  0xFF
+#define J1939_ADDR_NULL    0xFE              /* cannot claim an address        */
+
+/* parameter group numbers used by the data link layer */
+#define J1939_PGN_REQUEST  0x0EA00
+#define J1939_PGN_ADDR     0x0EE00           /* address claimed                */
+#define J1939_PGN_TP_CM    0x0EC00           /* transport connection manage    */
+#define J1939_PGN_TP_DT    0x0EB00           /* transport data transfer        */
+
+/* J1939 result codes */
+#define J1939_OK            0
+#define J1939_BUSY         -1                /* mailbox or session busy        */
+#define J1939_ERR_PARAM    -2                /* invalid length or address      */
+#define J1939_ERR_ADDR     -3                /* no address claimed             */
+#define J1939_ERR_TIMEOUT  -4                /* peer did not answer in time    */
+#define J1939_ERR_ABORT    -5                /* peer aborted the transfer      */
+
+/* 29 bit identifier fields */
+#define J1939_PRIO(id)   (((id) >> 26) & 0x07)
+#define J1939_PF(id)     (((id) >> 16) & 0xFF)
+#define J1939_PS(id)     (((id) >>  8) & 0xFF)
+#define J1939_SA(id)     ( (id)        & 0xFF)
+#define J1939_PDU2(id)   (J1939_PF(id) >= 240)
+#define J1939_PGN(id)    (J1939_PDU2(id) ? (((id) >> 8) & 0x3FFFF) : (((id) >> 8) & 0x3FF00))
+#define J1939_DA(id)     (J1939_PDU2(id) ? J1939_ADDR_GLOBAL : J1939_PS(id))
+
+typedef struct  {
+  uint32_t       pgn;                   /* parameter group number */
+  unsigned char  prio;                  /* priority 0..7 */
+  unsigned char  sa;                    /* source address */
+  unsigned char  da;                    /* destination, 0xFF - global */
+  uint16_t       len;                   /* length of data */
+  const uint8_t *data;                  /* message data */
+} J1939_pdu;
+
+typedef void (*J1939_rxFunc) (const J1939_pdu *pdu);
+
+typedef struct  {
+  CAN_dev       *dev;                   /* CAN controller, CAN_DEV(1) or CAN_DEV(2) */
+  uint8_t        name[8];               /* 64 bit NAME, byte 0 sent first */
+  unsigned char  address;               /* preferred source address */
+  J1939_rxFunc   rxFunc;                /* called for every received PDU */
+} J1939_cfg;
+
+/* Functions defined in module J1939.c */
+uint32_t J1939_id        (uint8_t prio, uint32_t pgn, uint8_t sa, uint8_t da);
+void     J1939_decode    (CAN_msg *msg, J1939_pdu *pdu);
+void     J1939_init      (const J1939_cfg *cfg, uint32_t now);
+uint8_t  J1939_address   (void);
+int32_t  J1939_send      (uint32_t pgn, uint8_t prio, uint8_t da, const uint8_t *data, uint32_t len);
+int32_t  J1939_txStatus  (void);
+void     J1939_rxMsg     (CAN_dev *dev, CAN_msg *msg);
+void     J1939_process   (uint32_t now);
+
+#endif
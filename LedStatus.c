@@ -0,0 +1,161 @@
+#include <stm32f4xx.h>
+#include "Clock.h"
+#include "LedStatus.h"
+
+#define LST_STEPS         (100000 / LST_PWM_HZ)   /* 100 kHz counter clock     */
+#define LST_DIV           ((LST_PERIOD * LST_PWM_HZ) / 1000)
+#define LST_PINS          (0x0FUL << 12)          /* PD12..15                  */
+#define LST_MODER_MASK    (0xFFUL << 24)
+
+#define LST_RX      0                             /* green                     */
+#define LST_WARN    1                             /* orange                    */
+#define LST_ERR     2                             /* red                       */
+#define LST_TX      3                             /* blue                      */
+
+static uint16_t           LST_level[4];           /* 0 off .. LST_STEPS on     */
+static uint32_t           LST_tick;
+static uint32_t           LST_rx, LST_tx, LST_txErr;  /* counters last seen    */
+
+
+/*----------------------------------------------------------------------------
+  error state of the controllers that are clocked, CAN_ESR_xxx flags ored
+ *----------------------------------------------------------------------------*/
+static uint32_t lst_esr (void)  {
+  uint32_t esr = 0;
+
+  if (RCC->APB1ENR & (1UL << 25)) {
+    esr |= ((CAN_TypeDef *)CAN_Dev[0].reg)->ESR;
+    if (RCC->APB1ENR & (1UL << 26)) {
+      esr |= ((CAN_TypeDef *)CAN_Dev[1].reg)->ESR;
+    }
+  }
+  return (esr & (CAN_ESR_EWGF | CAN_ESR_EPVF | CAN_ESR_BOFF));
+}
+
+/*----------------------------------------------------------------------------
+  level of an activity LED: full on a change of the counter, else fading
+ *----------------------------------------------------------------------------*/
+static uint16_t lst_activity (uint16_t level, uint32_t cnt, uint32_t *last)  {
+
+  if (cnt != *last) {
+    *last = cnt;
+    return (LST_STEPS);
+  }
+  return (level >> 1);
+}
+
+/*----------------------------------------------------------------------------
+  sample the bus state and drive the LEDs
+  static LEDs are written with a single BSRR store before they leave the
+  PWM function, so they do not glitch
+ *----------------------------------------------------------------------------*/
+static void lst_update (void)  {
+  uint32_t esr   = lst_esr ();
+  uint32_t on    = 0, off = 0, moder = 0;
+  uint32_t i, lvl;
+
+  LST_level[LST_RX] = lst_activity (LST_level[LST_RX],
+                                    CAN_Dev[0].rxCnt + CAN_Dev[1].rxCnt, &LST_rx);
+  LST_level[LST_TX] = lst_activity (LST_level[LST_TX],
+                                    CAN_Dev[0].txOk  + CAN_Dev[1].txOk,  &LST_tx);
+  LST_level[LST_ERR] = lst_activity (LST_level[LST_ERR],
+                                    CAN_Dev[0].txErr + CAN_Dev[1].txErr, &LST_txErr);
+  if (esr & CAN_ESR_BOFF) {
+    LST_level[LST_ERR] = LST_STEPS;
+  }
+  if (esr & CAN_ESR_EPVF) {
+    LST_level[LST_WARN] = LST_STEPS;
+  } else if (esr & CAN_ESR_EWGF) {
+    LST_level[LST_WARN] = LST_STEPS / 8;
+  } else {
+    LST_level[LST_WARN] = 0;
+  }
+
+  for (i = 0; i < 4; i++) {
+    lvl = LST_level[i];
+    if (lvl == 0) {
+      off   |= 1UL << (12 + i);
+      moder |= 1UL << (2 * (12 + i));      /* general purpose output        */
+    } else if (lvl >= LST_STEPS) {
+      on    |= 1UL << (12 + i);
+      moder |= 1UL << (2 * (12 + i));
+    } else {
+      moder |= 2UL << (2 * (12 + i));      /* alternate function, TIM4 CHx  */
+    }
+  }
+  TIM4->CCR1 = LST_level[0];
+  TIM4->CCR2 = LST_level[1];
+  TIM4->CCR3 = LST_level[2];
+  TIM4->CCR4 = LST_level[3];
+  *(__IO uint32_t *)&GPIOD->BSRRL = on | (off << 16);
+  if ((GPIOD->MODER & LST_MODER_MASK) != moder) {
+    GPIOD->MODER = (GPIOD->MODER & ~LST_MODER_MASK) | moder;
+  }
+}
+
+/*----------------------------------------------------------------------------
+  clock profile switch: keep the 100 kHz counter clock of the PWM
+ *----------------------------------------------------------------------------*/
+static uint32_t lst_clock (uint32_t phase, const CLK_info *clk)  {
+
+  if (phase == CLK_CHECK) {
+    return (clk->tim1 % 100000 == 0);
+  }
+  if (phase == CLK_POST) {
+    TIM4->PSC = (clk->tim1 / 100000) - 1;
+  }
+  return (1);
+}
+
+/*----------------------------------------------------------------------------
+  set up PD12..15 and TIM4, all LEDs off
+ *----------------------------------------------------------------------------*/
+void LST_init (void)  {
+
+  LST_level[0] = LST_level[1] = LST_level[2] = LST_level[3] = 0;
+  LST_tick = 0;
+  LST_rx   = CAN_Dev[0].rxCnt + CAN_Dev[1].rxCnt;
+  LST_tx   = CAN_Dev[0].txOk  + CAN_Dev[1].txOk;
+  LST_txErr = CAN_Dev[0].txErr + CAN_Dev[1].txErr;
+
+  RCC->AHB1ENR  |= (1UL << 3);              /* Enable GPIOD clock           */
+  RCC->APB1ENR  |= (1UL << 2);              /* Enable TIM4 clock            */
+
+  GPIOD->BSRRH    =  LST_PINS;              /* LEDs off                     */
+  GPIOD->OTYPER  &= ~LST_PINS;              /* push-pull                    */
+  GPIOD->OSPEEDR &= ~LST_MODER_MASK;        /* 2 MHz low speed              */
+  GPIOD->PUPDR   &= ~LST_MODER_MASK;
+  GPIOD->AFR[1]  &= ~0xFFFF0000UL;
+  GPIOD->AFR[1]  |=  0x22220000UL;          /* AF2: TIM4 CH1..4             */
+  GPIOD->MODER    = (GPIOD->MODER & ~LST_MODER_MASK) | 0x55000000UL;  /* outputs */
+
+  TIM4->CR1   = 0;
+  TIM4->PSC   = (CLK_get ()->tim1 / 100000) - 1;  /* 100 kHz counter clock  */
+  TIM4->ARR   = LST_STEPS - 1;
+  TIM4->CCMR1 = (6UL << 4) | (1UL << 3) | (6UL << 12) | (1UL << 11);  /* PWM 1, preload */
+  TIM4->CCMR2 = (6UL << 4) | (1UL << 3) | (6UL << 12) | (1UL << 11);
+  TIM4->CCR1  = TIM4->CCR2 = TIM4->CCR3 = TIM4->CCR4 = 0;
+  TIM4->CCER  = TIM_CCER_CC1E | TIM_CCER_CC2E | TIM_CCER_CC3E | TIM_CCER_CC4E;
+  TIM4->EGR   = TIM_EGR_UG;                 /* load prescaler               */
+  TIM4->SR    = 0;
+  TIM4->DIER  = TIM_DIER_UIE;
+  TIM4->CR1   = TIM_CR1_ARPE | TIM_CR1_CEN;
+
+  NVIC_SetPriority (TIM4_IRQn, (1UL << __NVIC_PRIO_BITS) - 1);  /* below CAN */
+  NVIC_EnableIRQ (TIM4_IRQn);
+  CLK_notify (lst_clock);
+}
+
+/*----------------------------------------------------------------------------
+  TIM4 interrupt handler: PWM period, status update every LST_PERIOD ms
+ *----------------------------------------------------------------------------*/
+void TIM4_IRQHandler (void) {
+
+  if (TIM4->SR & TIM_SR_UIF) {
+    TIM4->SR = ~TIM_SR_UIF;                 /* clear update flag            */
+    if (++LST_tick >= LST_DIV) {
+      LST_tick = 0;
+      lst_update ();
+    }
+  }
+}
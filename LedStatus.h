@@ -0,0 +1,31 @@
+/*----------------------------------------------------------------------------
+ * Name:    LedStatus.h
+ * Purpose: bus status on the user LEDs PD12..15, driven from TIM4
+ * Note(s): green  PD12  RX activity, fades out after the last frame
+ *          orange PD13  error warning (dim) / error passive (on)
+ *          red    PD14  TX errors, fades out / bus-off (on)
+ *          blue   PD15  TX activity, fades out after the last frame
+ *
+ *          The TIM4 update interrupt samples the counters of CAN_Dev and
+ *          the ESR registers every LST_PERIOD ms, nothing is added to the
+ *          CAN interrupt handlers. LEDs that fade run on the TIM4 PWM
+ *          channels (AF2), LEDs that are fully on or off are switched back
+ *          to GPIO outputs and set with one BSRR write. TIM4 runs at the
+ *          lowest interrupt priority. The module owns PD12..15, LED_Out
+ *          must not be used together with it.
+ *----------------------------------------------------------------------------*/
+
+#ifndef __LEDSTATUS_H
+#define __LEDSTATUS_H
+
+#include <stdint.h>
+#include "CAN.h"
+
+/* LED status configuration */
+#define LST_PWM_HZ        200                /* PWM frequency of the LEDs      */
+#define LST_PERIOD         50                /* ms between status updates      */
+
+/* Functions defined in module LedStatus.c */
+void     LST_init      (void);
+
+#endif
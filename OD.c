@@ -0,0 +1,50 @@
+#include <stdint.h>
+#include "OD.h"
+
+#define OD_KEY(index, sub)  (((uint32_t)(index) << 8) | (sub))
+
+static const OD_entry *OD_table;                 /* application dictionary     */
+static uint32_t        OD_num;                   /* number of entries          */
+
+
+/*----------------------------------------------------------------------------
+  register the object dictionary of the application
+  the table must be sorted by index and sub-index, otherwise it is rejected
+ *----------------------------------------------------------------------------*/
+int32_t OD_init (const OD_entry *table, uint32_t num)  {
+  uint32_t i;
+
+  for (i = 1; i < num; i++) {
+    if (OD_KEY(table[i-1].index, table[i-1].subIndex) >= OD_KEY(table[i].index, table[i].subIndex)) {
+      OD_num = 0;
+      return (OD_ERR_ORDER);
+    }
+  }
+  OD_table = table;
+  OD_num   = num;
+  return (OD_OK);
+}
+
+/*----------------------------------------------------------------------------
+  find an object by binary search, returns 0 if it does not exist
+ *----------------------------------------------------------------------------*/
+const OD_entry *OD_find (uint16_t index, uint8_t subIndex)  {
+  uint32_t key = OD_KEY(index, subIndex);
+  uint32_t lo  = 0;
+  uint32_t hi  = OD_num;
+  uint32_t mid, k;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    k   = OD_KEY(OD_table[mid].index, OD_table[mid].subIndex);
+    if (k == key) {
+      return (&OD_table[mid]);
+    }
+    if (k < key) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return (0);
+}
@@ -0,0 +1,37 @@
+/*----------------------------------------------------------------------------
+ * Name:    OD.h
+ * Purpose: CANopen object dictionary definitions
+ * Note(s): the application provides the dictionary as a table of entries,
+ *          one entry per index / sub-index pair, sorted by index and
+ *          sub-index so that objects are found by binary search
+ *----------------------------------------------------------------------------*/
+
+#ifndef __OD_H
+#define __OD_H
+
+#include <stdint.h>
+
+/* object attributes */
+#define OD_READ          0x01                /* readable via SDO               */
+#define OD_WRITE         0x02                /* writable via SDO               */
+#define OD_RW            (OD_READ | OD_WRITE)
+#define OD_TPDO          0x04                /* may be mapped into a TPDO      */
+#define OD_RPDO          0x08                /* may be mapped into a RPDO      */
+
+/* OD result codes */
+#define OD_OK               0
+#define OD_ERR_ORDER       -1                /* table not sorted or duplicate  */
+
+typedef struct  {
+  uint16_t       index;                 /* object index */
+  uint8_t        subIndex;              /* object sub-index */
+  uint8_t        attr;                  /* OD_READ, OD_WRITE, OD_TPDO, OD_RPDO */
+  uint32_t       size;                  /* size of object data in bytes */
+  void          *data;                  /* object data in RAM, little endian */
+} OD_entry;
+
+/* Functions defined in module OD.c */
+int32_t         OD_init   (const OD_entry *table, uint32_t num);
+const OD_entry *OD_find   (uint16_t index, uint8_t subIndex);
+
+#endif
@@ -0,0 +1,323 @@
+#include <stdint.h>
+#include <string.h>
+#include "CAN.h"
+#include "OD.h"
+#include "PDO.h"
+
+/* one step of a copy plan */
+typedef struct  {
+  uint8_t       *obj;                   /* object data in RAM */
+  uint8_t        pos;                   /* byte offset (copy) or bit offset */
+  uint8_t        len;                   /* bytes to copy, 0 - bit field step */
+  uint8_t        size;                  /* object bytes of a bit field step */
+  uint8_t        bits;                  /* width of a bit field step */
+} PDO_step;
+
+typedef struct  {
+  uint32_t       cobId;                 /* 0 - PDO not configured */
+  uint8_t        transType;
+  uint8_t        len;                   /* frame length resulting from mapping */
+  uint8_t        steps;                 /* used steps of the plan */
+  uint8_t        bitSteps;              /* plan contains bit field steps */
+  uint8_t        syncCnt;               /* SYNCs since last transmission */
+  uint8_t        event;                 /* acyclic TPDO: event occurred */
+  uint8_t        rxNew;                 /* sync RPDO: data waits for SYNC */
+  uint8_t        data[8];               /* sync RPDO: buffered frame data */
+  PDO_step       plan[PDO_MAX_STEPS];
+} PDO_obj;
+
+static CAN_dev *PDO_dev;                          /* CAN controller             */
+static PDO_obj  PDO_rx[PDO_RX_NUM];
+static PDO_obj  PDO_tx[PDO_TX_NUM];
+static CAN_msg  PDO_txMsg[PDO_TX_NUM];            /* sampled TPDO frames        */
+static uint32_t PDO_txPending;                    /* bitmap of unsent TPDOs     */
+
+
+/*----------------------------------------------------------------------------
+  compile a mapping into the copy plan of a PDO
+ *----------------------------------------------------------------------------*/
+static int32_t pdo_compile (PDO_obj *pdo, uint8_t attr, const uint32_t *map, uint32_t num)  {
+  const OD_entry *e;
+  PDO_step       *s;
+  uint32_t        i, bit, bits;
+
+  if (num > PDO_MAX_STEPS) {
+    return (PDO_ERR_LEN);
+  }
+  bit = 0;
+  for (i = 0; i < num; i++) {
+    bits = map[i] & 0xFF;
+    e    = OD_find ((uint16_t)(map[i] >> 16), (uint8_t)(map[i] >> 8));
+    if (e == 0 || (e->attr & attr) == 0 || bits == 0 || bits > e->size * 8) {
+      return (PDO_ERR_MAP);
+    }
+    if (bit + bits > 64) {
+      return (PDO_ERR_LEN);
+    }
+    s      = &pdo->plan[i];
+    s->obj = (uint8_t *)e->data;
+    if ((bit % 8) == 0 && (bits % 8) == 0) {  /* byte aligned: plain copy   */
+      s->pos  = bit / 8;
+      s->len  = bits / 8;
+    } else if (bits <= 32) {                  /* shifted bit field          */
+      s->pos  = bit;
+      s->len  = 0;
+      s->size = (e->size > 4) ? 4 : e->size;
+      s->bits = bits;
+      pdo->bitSteps = 1;
+    } else {
+      return (PDO_ERR_MAP);
+    }
+    bit += bits;
+  }
+  pdo->steps = num;
+  pdo->len   = (bit + 7) / 8;
+  return (PDO_OK);
+}
+
+/*----------------------------------------------------------------------------
+  execute a plan: frame data into objects
+  bit field steps extract from the frame loaded as one little endian word
+ *----------------------------------------------------------------------------*/
+static void pdo_unpack (const PDO_obj *pdo, const uint8_t *data)  {
+  const PDO_step *s   = pdo->plan;
+  const PDO_step *end = s + pdo->steps;
+  uint64_t        w   = 0;
+  uint32_t        v, i;
+
+  if (pdo->bitSteps) {
+    for (i = 0; i < 8; i++) w |= (uint64_t)data[i] << (i * 8);
+  }
+  for (; s < end; s++) {
+    if (s->len) {
+      memcpy (s->obj, &data[s->pos], s->len);
+    } else {
+      v = (uint32_t)(w >> s->pos) & (0xFFFFFFFFUL >> (32 - s->bits));
+      for (i = 0; i < s->size; i++) s->obj[i] = (uint8_t)(v >> (i * 8));
+    }
+  }
+}
+
+/*----------------------------------------------------------------------------
+  execute a plan: objects into frame data
+ *----------------------------------------------------------------------------*/
+static void pdo_pack (const PDO_obj *pdo, uint8_t *data)  {
+  const PDO_step *s   = pdo->plan;
+  const PDO_step *end = s + pdo->steps;
+  uint64_t        w   = 0;
+  uint32_t        v, i;
+
+  memset (data, 0, 8);
+  for (; s < end; s++) {
+    if (s->len) {
+      memcpy (&data[s->pos], s->obj, s->len);
+    } else {
+      for (v = 0, i = 0; i < s->size; i++) v |= (uint32_t)s->obj[i] << (i * 8);
+      w |= (uint64_t)(v & (0xFFFFFFFFUL >> (32 - s->bits))) << s->pos;
+    }
+  }
+  if (pdo->bitSteps) {
+    for (i = 0; i < 8; i++) data[i] |= (uint8_t)(w >> (i * 8));
+  }
+}
+
+/*----------------------------------------------------------------------------
+  sample a TPDO into its frame and mark it for transmission
+  runs from the main loop and from SYNC in the RX interrupt, the frame and
+  PDO_txPending are only changed with interrupts masked
+ *----------------------------------------------------------------------------*/
+static void pdo_sample (uint32_t n)  {
+  CAN_msg *msg = &PDO_txMsg[n];
+  uint32_t key = CAN_lock ();
+
+  msg->id     = PDO_tx[n].cobId;
+  msg->format = STANDARD_FORMAT;
+  msg->type   = DATA_FRAME;
+  msg->len    = PDO_tx[n].len;
+  pdo_pack (&PDO_tx[n], msg->data);
+  PDO_txPending |= (1UL << n);
+  CAN_unlock (key);
+}
+
+/*----------------------------------------------------------------------------
+  transmit pending TPDOs, lowest PDO number first
+  a SYNC must not resample the frame while it is copied to the mailbox
+ *----------------------------------------------------------------------------*/
+static void pdo_flush (void)  {
+  uint32_t n, sent, key;
+
+  for (n = 0; n < PDO_TX_NUM && PDO_txPending; n++) {
+    key = CAN_lock ();
+    sent = 1;
+    if (PDO_txPending & (1UL << n)) {
+      sent = CAN_tryWrMsg (PDO_dev, &PDO_txMsg[n]);
+      if (sent) {
+        PDO_txPending &= ~(1UL << n);
+      }
+    }
+    CAN_unlock (key);
+    if (!sent) {
+      return;
+    }
+  }
+}
+
+/*----------------------------------------------------------------------------
+  initialise the PDO engine, all PDOs are disabled
+ *----------------------------------------------------------------------------*/
+void PDO_init (CAN_dev *dev)  {
+
+  PDO_dev       = dev;
+  PDO_txPending = 0;
+  memset (PDO_rx, 0, sizeof (PDO_rx));
+  memset (PDO_tx, 0, sizeof (PDO_tx));
+}
+
+/*----------------------------------------------------------------------------
+  configure a RPDO, cobId 0 disables it
+ *----------------------------------------------------------------------------*/
+int32_t PDO_mapRx (uint32_t n, uint32_t cobId, uint8_t transType, const uint32_t *map, uint32_t num)  {
+  PDO_obj  tmp;
+  uint32_t key;
+  int32_t  res;
+
+  if (n >= PDO_RX_NUM || (transType > PDO_SYNC_MAX && transType < 254)) {
+    return (PDO_ERR_PARAM);
+  }
+  memset (&tmp, 0, sizeof (tmp));
+  if ((res = pdo_compile (&tmp, OD_RPDO, map, num)) != PDO_OK) {
+    return (res);
+  }
+  tmp.cobId     = cobId & 0x7FF;
+  tmp.transType = transType;
+  key = CAN_lock ();                        /* PDO_rxMsg may run from the RX */
+  PDO_rx[n] = tmp;                          /* interrupt: no half copied plan */
+  CAN_unlock (key);
+  return (PDO_OK);
+}
+
+/*----------------------------------------------------------------------------
+  configure a TPDO, cobId 0 disables it
+ *----------------------------------------------------------------------------*/
+int32_t PDO_mapTx (uint32_t n, uint32_t cobId, uint8_t transType, const uint32_t *map, uint32_t num)  {
+  PDO_obj  tmp;
+  uint32_t key;
+  int32_t  res;
+
+  if (n >= PDO_TX_NUM || (transType > PDO_SYNC_MAX && transType < 254)) {
+    return (PDO_ERR_PARAM);
+  }
+  memset (&tmp, 0, sizeof (tmp));
+  if ((res = pdo_compile (&tmp, OD_TPDO, map, num)) != PDO_OK) {
+    return (res);
+  }
+  tmp.cobId     = cobId & 0x7FF;
+  tmp.transType = transType;
+  key = CAN_lock ();                        /* SYNC samples TPDOs            */
+  PDO_tx[n]      = tmp;
+  PDO_txPending &= ~(1UL << n);
+  CAN_unlock (key);
+  return (PDO_OK);
+}
+
+/*----------------------------------------------------------------------------
+  signal an application event for a TPDO
+  event driven TPDOs are sent at once, acyclic sync TPDOs at the next SYNC
+ *----------------------------------------------------------------------------*/
+int32_t PDO_txEvent (uint32_t n)  {
+  uint32_t key;
+
+  if (n >= PDO_TX_NUM || PDO_tx[n].cobId == 0) {
+    return (PDO_ERR_PARAM);
+  }
+  if (PDO_tx[n].transType == PDO_SYNC_ACYCLIC) {
+    PDO_tx[n].event = 1;
+    return (PDO_OK);
+  }
+  if (PDO_tx[n].transType <= PDO_SYNC_MAX) {
+    return (PDO_ERR_PARAM);
+  }
+  key = CAN_lock ();                        /* test and sample atomic        */
+  if (PDO_txPending & (1UL << n)) {
+    CAN_unlock (key);
+    return (PDO_BUSY);
+  }
+  pdo_sample (n);
+  CAN_unlock (key);
+  pdo_flush ();
+  return (PDO_OK);
+}
+
+/*----------------------------------------------------------------------------
+  SYNC received: actuate buffered RPDOs and sample due TPDOs
+ *----------------------------------------------------------------------------*/
+void PDO_sync (void)  {
+  PDO_obj  *pdo;
+  uint32_t  n;
+
+  for (n = 0; n < PDO_RX_NUM; n++) {
+    pdo = &PDO_rx[n];
+    if (pdo->rxNew) {
+      pdo->rxNew = 0;
+      pdo_unpack (pdo, pdo->data);
+    }
+  }
+  for (n = 0; n < PDO_TX_NUM; n++) {
+    pdo = &PDO_tx[n];
+    if (pdo->cobId == 0 || pdo->transType > PDO_SYNC_MAX) {
+      continue;
+    }
+    if (pdo->transType == PDO_SYNC_ACYCLIC) {
+      if (pdo->event) {
+        pdo->event = 0;
+        pdo_sample (n);
+      }
+    } else if (++pdo->syncCnt >= pdo->transType) {
+      pdo->syncCnt = 0;
+      pdo_sample (n);
+    }
+  }
+  pdo_flush ();
+}
+
+/*----------------------------------------------------------------------------
+  process a received CAN frame, may be called from the RX interrupt
+ *----------------------------------------------------------------------------*/
+void PDO_rxMsg (CAN_dev *dev, CAN_msg *msg)  {
+  PDO_obj  *pdo;
+  uint32_t  n;
+
+  if (dev != PDO_dev || msg->format != STANDARD_FORMAT || msg->type != DATA_FRAME) {
+    return;
+  }
+  if (msg->id == PDO_SYNC_ID) {
+    PDO_sync ();
+    return;
+  }
+  for (n = 0; n < PDO_RX_NUM; n++) {
+    pdo = &PDO_rx[n];
+    if (pdo->cobId != msg->id || pdo->cobId == 0) {
+      continue;
+    }
+    if (msg->len < pdo->len) {
+      return;                               /* too short for the mapping    */
+    }
+    if (pdo->transType <= PDO_SYNC_MAX) {
+      memcpy (pdo->data, msg->data, 8);     /* actuate at next SYNC         */
+      pdo->rxNew = 1;
+    } else {
+      pdo_unpack (pdo, msg->data);
+    }
+    return;
+  }
+}
+
+/*----------------------------------------------------------------------------
+  retry transmission of TPDOs the mailbox could not take yet
+ *----------------------------------------------------------------------------*/
+void PDO_process (void)  {
+
+  if (PDO_txPending) {
+    pdo_flush ();
+  }
+}
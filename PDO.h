@@ -0,0 +1,44 @@
+/*----------------------------------------------------------------------------
+ * Name:    PDO.h
+ * Purpose: CANopen process data object definitions
+ * Note(s): PDO mappings are compiled into copy plans when configured, the
+ *          receive and SYNC paths only execute these plans
+ *----------------------------------------------------------------------------*/
+
+#ifndef __PDO_H
+#define __PDO_H
+
+#include <stdint.h>
+#include "CAN.h"
+
+/* PDO configuration */
+#define PDO_RX_NUM          4                /* number of RPDOs                */
+#define PDO_TX_NUM          4                /* number of TPDOs                */
+#define PDO_MAX_STEPS       8                /* copy steps per PDO             */
+#define PDO_SYNC_ID      0x80                /* COB-ID of the SYNC object      */
+
+/* transmission types */
+#define PDO_SYNC_ACYCLIC    0                /* on SYNC after an event         */
+#define PDO_SYNC_MAX      240                /* 1..240: every n-th SYNC        */
+#define PDO_EVENT         255                /* event driven, asynchronous     */
+
+/* PDO result codes */
+#define PDO_OK              0
+#define PDO_BUSY           -1                /* previous frame not yet sent    */
+#define PDO_ERR_PARAM      -2                /* invalid PDO number or type     */
+#define PDO_ERR_MAP        -3                /* object missing or not mappable */
+#define PDO_ERR_LEN        -4                /* mapping exceeds 64 bits        */
+
+/* mapping entry: index << 16 | sub-index << 8 | length in bits */
+#define PDO_MAP(index, sub, bits)  (((uint32_t)(index) << 16) | ((uint32_t)(sub) << 8) | (bits))
+
+/* Functions defined in module PDO.c */
+void     PDO_init     (CAN_dev *dev);
+int32_t  PDO_mapRx    (uint32_t n, uint32_t cobId, uint8_t transType, const uint32_t *map, uint32_t num);
+int32_t  PDO_mapTx    (uint32_t n, uint32_t cobId, uint8_t transType, const uint32_t *map, uint32_t num);
+int32_t  PDO_txEvent  (uint32_t n);
+void     PDO_sync     (void);
+void     PDO_rxMsg    (CAN_dev *dev, CAN_msg *msg);
+void     PDO_process  (void);
+
+#endif
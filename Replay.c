@@ -0,0 +1,305 @@
+#include <stm32f4xx.h>
+#include "CAN.h"
+#include "Clock.h"
+#include "Replay.h"
+
+#define RPL_MBX        0x06                     /* TX mailboxes 1 and 2        */
+#define RPL_LINE         96                     /* longest accepted log line   */
+#define RPL_XON        0x11
+#define RPL_XOFF       0x13
+
+typedef struct  {
+  uint32_t       due;                   /* TIM5 count of the transmission */
+  CAN_dev       *dev;                   /* controller parsed from canN */
+  CAN_msg        msg;
+} RPL_frame;
+
+static uint8_t            RPL_rx[RPL_RXBUF];      /* written by DMA, not in CCM */
+static uint32_t           RPL_rd;                 /* read index into RPL_rx    */
+static char               RPL_ln[RPL_LINE];
+static uint32_t           RPL_lnLen;
+static uint32_t           RPL_paused;             /* XOFF sent                 */
+
+static RPL_frame          RPL_q[RPL_QUEUE] CAN_CCM;
+static volatile uint32_t  RPL_head;               /* next frame to send (ISR)  */
+static volatile uint32_t  RPL_tail;               /* next free entry (thread)  */
+
+static uint32_t           RPL_sync;               /* log time base is set      */
+static uint32_t           RPL_logSec;             /* log time of the first     */
+static uint32_t           RPL_logUs;              /* frame ...                 */
+static uint32_t           RPL_t0;                 /* ... and its TIM5 count    */
+static volatile uint32_t  RPL_lateCnt;
+static uint32_t           RPL_underCnt;
+
+
+/*----------------------------------------------------------------------------
+  transmit all frames that are due, called from TIM5 and CAN TX interrupts
+  which share one priority; stops at the first frame that has to wait
+ *----------------------------------------------------------------------------*/
+static void rpl_send (void)  {
+  RPL_frame *f;
+  int32_t    dt;
+
+  while (RPL_head != RPL_tail) {
+    f  = &RPL_q[RPL_head];
+    dt = (int32_t)(f->due - TIM5->CNT);
+    if (dt > 0) {
+      TIM5->CCR1 = f->due;                  /* wake up at the due time      */
+      if ((int32_t)(f->due - TIM5->CNT) > 0) {
+        return;
+      }
+      continue;                             /* due time passed meanwhile    */
+    }
+    if (CAN_wrMbx (f->dev, RPL_MBX, &f->msg) < 0) {
+      CAN_txNotify (f->dev);
+      return;                               /* retried from the TX hook     */
+    }
+    if (-dt > RPL_LATE) {
+      RPL_lateCnt++;
+    }
+    RPL_head = (RPL_head + 1) & (RPL_QUEUE - 1);
+  }
+}
+
+/*----------------------------------------------------------------------------
+  TX interrupt hook: a mailbox became empty
+ *----------------------------------------------------------------------------*/
+static void rpl_txIRQ (CAN_dev *dev, uint32_t tsr)  {
+
+  rpl_send ();
+}
+
+/*----------------------------------------------------------------------------
+  value of a hex digit, -1 if c is none
+ *----------------------------------------------------------------------------*/
+static int32_t rpl_hex (char c)  {
+
+  if (c >= '0' && c <= '9') return (c - '0');
+  if (c >= 'A' && c <= 'F') return (c - 'A' + 10);
+  if (c >= 'a' && c <= 'f') return (c - 'a' + 10);
+  return (-1);
+}
+
+/*----------------------------------------------------------------------------
+  parse "(sec.usec) canN id#data" into a queue entry, 0 if malformed
+ *----------------------------------------------------------------------------*/
+static uint32_t rpl_parse (const char *s, RPL_frame *f, uint32_t *sec, uint32_t *us)  {
+  uint32_t n, id = 0, ctrl = 1;
+  int32_t  h, l;
+
+  if (*s++ != '(') return (0);
+  for (*sec = 0; *s >= '0' && *s <= '9'; s++) *sec = *sec * 10 + (*s - '0');
+  if (*s++ != '.') return (0);
+  for (*us = 0, n = 0; *s >= '0' && *s <= '9'; s++, n++) {
+    if (n < 6) *us = *us * 10 + (*s - '0');
+  }
+  for (; n < 6; n++) *us *= 10;
+  if (*s++ != ')') return (0);
+  while (*s == ' ') s++;
+  for (; *s && *s != ' '; s++) {            /* interface, last digit counts */
+    if (*s >= '0' && *s <= '9') ctrl = ((*s - '0') & 1) + 1;
+  }
+  while (*s == ' ') s++;
+  for (n = 0; (h = rpl_hex (*s)) >= 0; s++, n++) id = (id << 4) | h;
+  if (*s++ != '#' || n == 0 || n > 8) return (0);
+
+  f->dev        = CAN_DEV(ctrl);
+  f->msg.id     = id;
+  f->msg.format = (n > 3) ? EXTENDED_FORMAT : STANDARD_FORMAT;
+  f->msg.type   = DATA_FRAME;
+  f->msg.len    = 0;
+  if (*s == 'R' || *s == 'r') {
+    f->msg.type = REMOTE_FRAME;
+    if (rpl_hex (s[1]) >= 0 && rpl_hex (s[1]) <= 8) f->msg.len = (unsigned char)rpl_hex (s[1]);
+    return (1);
+  }
+  for (n = 0; n < 8 && (h = rpl_hex (s[0])) >= 0 && (l = rpl_hex (s[1])) >= 0; s += 2, n++) {
+    f->msg.data[n] = (unsigned char)((h << 4) | l);
+  }
+  f->msg.len = (unsigned char)n;
+  return (1);
+}
+
+/*----------------------------------------------------------------------------
+  queue a parsed frame at its original distance to the first frame
+  after an underrun the time base is moved, later frames keep their spacing;
+  a frame that is already behind its scheduled time is counted late, either
+  here when it moves the time base or by rpl_send against its due time
+ *----------------------------------------------------------------------------*/
+static void rpl_queue (RPL_frame *f, uint32_t sec, uint32_t us)  {
+  uint32_t now = TIM5->CNT;
+  uint32_t wasEmpty;
+
+  if (!RPL_sync) {
+    RPL_sync   = 1;
+    RPL_logSec = sec;
+    RPL_logUs  = us;
+    RPL_t0     = now + RPL_LEAD;
+  }
+  f->due = RPL_t0 + (sec - RPL_logSec) * 1000000UL + us - RPL_logUs;
+  if ((int32_t)(now - f->due) > RPL_LEAD) {
+    RPL_t0 += now + RPL_LEAD - f->due;      /* sender fell behind           */
+    f->due  = now + RPL_LEAD;
+    RPL_underCnt++;
+    RPL_lateCnt++;                          /* missed its scheduled time    */
+  }
+
+  RPL_q[RPL_tail] = *f;
+  wasEmpty = (RPL_head == RPL_tail);
+  RPL_tail = (RPL_tail + 1) & (RPL_QUEUE - 1);
+  if (wasEmpty) {
+    TIM5->EGR = TIM_EGR_CC1G;               /* let the ISR arm the compare  */
+  }
+}
+
+/*----------------------------------------------------------------------------
+  send a flow control character
+ *----------------------------------------------------------------------------*/
+static void rpl_flow (uint32_t c)  {
+
+  while (!(UART4->SR & USART_SR_TXE));
+  UART4->DR = c;
+}
+
+/*----------------------------------------------------------------------------
+  clock profile switch, refused while frames are queued or if the baud
+  rate cannot be reached; the time base restarts with the next frame
+ *----------------------------------------------------------------------------*/
+static uint32_t rpl_clock (uint32_t phase, const CLK_info *clk)  {
+
+  if (phase == CLK_CHECK) {
+    return (RPL_head == RPL_tail && clk->pclk1 / RPL_BAUD >= 16 && clk->tim1 % 1000000 == 0);
+  }
+  if (phase == CLK_POST) {
+    UART4->BRR = (clk->pclk1 + RPL_BAUD / 2) / RPL_BAUD;
+    TIM5->PSC  = (clk->tim1 / 1000000) - 1;
+    TIM5->EGR  = TIM_EGR_UG;                /* 32-bit counter, load PSC now  */
+    TIM5->SR   = 0;
+    RPL_sync   = 0;
+  }
+  return (1);
+}
+
+/*----------------------------------------------------------------------------
+  set up UART4 with receive DMA, TIM5 as microsecond time base and the
+  transmit order of both CAN controllers
+ *----------------------------------------------------------------------------*/
+int32_t RPL_init (void)  {
+  const CLK_info *clk = CLK_get ();
+
+  if ((CAN_Dev[0].txHook != 0 && CAN_Dev[0].txHook != rpl_txIRQ) ||
+      (CAN_Dev[1].txHook != 0 && CAN_Dev[1].txHook != rpl_txIRQ)) {
+    return (RPL_ERR_BUSY);
+  }
+  if ((UART4->CR1 & USART_CR1_UE) && !(UART4->CR3 & USART_CR3_DMAR)) {
+    return (RPL_ERR_BUSY);                  /* UART4 set up by Serial.c     */
+  }
+  if (clk->pclk1 / RPL_BAUD < 16 || clk->tim1 % 1000000 != 0) {
+    return (RPL_ERR_CLOCK);                 /* same limits as rpl_clock     */
+  }
+  RPL_rd = RPL_lnLen = RPL_paused = RPL_sync = 0;
+  RPL_head = RPL_tail = 0;
+  RPL_lateCnt = RPL_underCnt = 0;
+
+  RCC->APB1ENR  |= (1UL << 19) | (1UL << 3);  /* Enable UART4, TIM5 clock    */
+  RCC->AHB1ENR  |= (1UL << 21) | (1UL << 2);  /* Enable DMA1, GPIOC clock    */
+
+  GPIOC->MODER  &= 0xFF0FFFFF;
+  GPIOC->MODER  |= 0x00A00000;
+  GPIOC->AFR[1] &= 0xFFFF00FF;
+  GPIOC->AFR[1] |= 0x00008800;              /* PC10 UART4_Tx, PC11 UART4_Rx */
+
+  UART4->CR1 = 0;
+  UART4->BRR = (clk->pclk1 + RPL_BAUD / 2) / RPL_BAUD;
+  UART4->CR2 = 0;
+  UART4->CR3 = USART_CR3_DMAR;
+
+  DMA1_Stream2->CR   = 0;                   /* UART4_RX: stream 2, channel 4 */
+  while (DMA1_Stream2->CR & DMA_SxCR_EN);
+  DMA1_Stream2->PAR  = (uint32_t)&UART4->DR;
+  DMA1_Stream2->M0AR = (uint32_t)RPL_rx;
+  DMA1_Stream2->NDTR = RPL_RXBUF;
+  DMA1_Stream2->CR   = DMA_SxCR_CHSEL_2 | DMA_SxCR_MINC | DMA_SxCR_CIRC | DMA_SxCR_EN;
+  UART4->CR1 = USART_CR1_UE | USART_CR1_TE | USART_CR1_RE;
+
+  TIM5->CR1  = 0;
+  TIM5->PSC  = (clk->tim1 / 1000000) - 1;  /* 1 MHz, 32-bit free running */
+  TIM5->ARR  = 0xFFFFFFFF;
+  TIM5->CCMR1 = 0;                          /* CC1 compare, no output       */
+  TIM5->EGR  = TIM_EGR_UG;
+  TIM5->SR   = 0;
+  TIM5->DIER = TIM_DIER_CC1IE;
+  TIM5->CR1  = TIM_CR1_CEN;
+  NVIC_EnableIRQ (TIM5_IRQn);
+
+  CAN1->MCR |= CAN_MCR_TXFP;                /* mailboxes leave in load order */
+  CAN2->MCR |= CAN_MCR_TXFP;
+  CAN_Dev[0].txHook = rpl_txIRQ;
+  CAN_Dev[1].txHook = rpl_txIRQ;
+  CLK_notify (rpl_clock);
+  return (RPL_OK);
+}
+
+/*----------------------------------------------------------------------------
+  parse received log lines into the frame queue and pace the sender
+ *----------------------------------------------------------------------------*/
+void RPL_process (void)  {
+  uint32_t  wr = (RPL_RXBUF - DMA1_Stream2->NDTR) & (RPL_RXBUF - 1);
+  uint32_t  fill, sec, us;
+  RPL_frame f;
+  char      c;
+
+  while (RPL_rd != wr && ((RPL_tail + 1) & (RPL_QUEUE - 1)) != RPL_head) {
+    c = (char)RPL_rx[RPL_rd];
+    RPL_rd = (RPL_rd + 1) & (RPL_RXBUF - 1);
+    if (c == '\n' || c == '\r') {
+      if (RPL_lnLen > 0 && RPL_lnLen < RPL_LINE) {
+        RPL_ln[RPL_lnLen] = 0;
+        if (rpl_parse (RPL_ln, &f, &sec, &us)) {
+          rpl_queue (&f, sec, us);
+        }
+      }
+      RPL_lnLen = 0;
+    } else if (RPL_lnLen < RPL_LINE) {
+      RPL_ln[RPL_lnLen++] = c;              /* too long lines are dropped   */
+    }
+  }
+
+  fill = (wr - RPL_rd) & (RPL_RXBUF - 1);
+  if (!RPL_paused && fill > RPL_RXBUF / 2) {
+    rpl_flow (RPL_XOFF);
+    RPL_paused = 1;
+  } else if (RPL_paused && fill < RPL_RXBUF / 4) {
+    rpl_flow (RPL_XON);
+    RPL_paused = 0;
+  }
+}
+
+/*----------------------------------------------------------------------------
+  statistics: queued frames, frames sent late, time base corrections
+ *----------------------------------------------------------------------------*/
+uint32_t RPL_pending (void)  {
+
+  return ((RPL_tail - RPL_head) & (RPL_QUEUE - 1));
+}
+
+uint32_t RPL_late (void)  {
+
+  return (RPL_lateCnt);
+}
+
+uint32_t RPL_underruns (void)  {
+
+  return (RPL_underCnt);
+}
+
+/*----------------------------------------------------------------------------
+  TIM5 interrupt handler: next frame is due
+ *----------------------------------------------------------------------------*/
+void TIM5_IRQHandler (void) {
+
+  if (TIM5->SR & TIM_SR_CC1IF) {
+    TIM5->SR = ~TIM_SR_CC1IF;               /* clear compare flag           */
+    rpl_send ();
+  }
+}
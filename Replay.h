@@ -0,0 +1,46 @@
+/*----------------------------------------------------------------------------
+ * Name:    Replay.h
+ * Purpose: timed replay of candump logs streamed over the serial port
+ * Note(s): UART4 receives the log by DMA into a ring buffer, RPL_process
+ *          parses it into a frame queue that runs RPL_LEAD us ahead of
+ *          the bus. TIM5 counts microseconds and raises a compare
+ *          interrupt at the due time of the next frame, which is then
+ *          loaded into TX mailbox 1 or 2 with transmit FIFO priority.
+ *          Replay owns these mailboxes and the TX hooks, it cannot run
+ *          together with the cyclic scheduler or the stress generator:
+ *          RPL_init fails if another module holds a TX hook. UART4 is
+ *          also the retarget port of Serial.c, build with __DBG_ITM or
+ *          leave SER_Init out, RPL_init fails if Serial owns UART4.
+ *          The sender is paced with XON/XOFF, e.g.
+ *          stty -F /dev/ttyUSB0 2000000 raw ixon;
+ *          cat candump.log > /dev/ttyUSB0
+ *          Interfaces ending in an even digit (can0) map to CAN1, odd
+ *          ones (can1) to CAN2.
+ *----------------------------------------------------------------------------*/
+
+#ifndef __REPLAY_H
+#define __REPLAY_H
+
+#include <stdint.h>
+#include "CAN.h"
+
+/* Replay configuration */
+#define RPL_BAUD      2000000                /* UART4 baud rate                */
+#define RPL_RXBUF        4096                /* DMA receive ring, power of 2   */
+#define RPL_QUEUE         256                /* frames parsed ahead, power of 2 */
+#define RPL_LEAD       100000                /* us between parsing and sending */
+#define RPL_LATE           50                /* us after due time counted late */
+
+/* Replay result codes */
+#define RPL_OK              0
+#define RPL_ERR_BUSY       -1                /* TX hook or UART4 owned elsewhere */
+#define RPL_ERR_CLOCK      -2                /* PCLK1 too slow for RPL_BAUD    */
+
+/* Functions defined in module Replay.c */
+int32_t  RPL_init      (void);
+void     RPL_process   (void);
+uint32_t RPL_pending   (void);
+uint32_t RPL_late      (void);
+uint32_t RPL_underruns (void);
+
+#endif
@@ -0,0 +1,139 @@
+#include "RxDispatch.h"
+
+#define RXD_EXT_SLOTS  (1UL << RXD_EXT_BITS)
+#define RXD_KEY_USED   0x80000000UL             /* marks an occupied hash slot */
+
+typedef struct  {
+  uint32_t       key;                   /* RXD_KEY_USED | ctrl bit | 29 bit id */
+  uint8_t        func;                  /* index into RXD_funcTab */
+} RXD_slot;
+
+static RXD_func  RXD_funcTab[RXD_FUNCS + 1] CAN_CCM;  /* entry 0 is "no handler" */
+static uint8_t   RXD_std[2][2048] CAN_CCM;        /* standard id -> handler    */
+static RXD_slot  RXD_ext[RXD_EXT_SLOTS] CAN_CCM;  /* extended id hash table    */
+
+
+/*----------------------------------------------------------------------------
+  hash of an extended key, multiplicative (Fibonacci) hashing
+ *----------------------------------------------------------------------------*/
+static __inline uint32_t rxd_hash (uint32_t key)  {
+
+  return ((key * 2654435761UL) >> (32 - RXD_EXT_BITS));
+}
+
+/*----------------------------------------------------------------------------
+  index of a handler function, registers it on first use; 0 if table full
+ *----------------------------------------------------------------------------*/
+static uint32_t rxd_func (RXD_func func)  {
+  uint32_t i;
+
+  for (i = 1; i <= RXD_FUNCS; i++) {
+    if (RXD_funcTab[i] == func) {
+      return (i);
+    }
+    if (RXD_funcTab[i] == 0) {
+      RXD_funcTab[i] = func;
+      return (i);
+    }
+  }
+  return (0);
+}
+
+/*----------------------------------------------------------------------------
+  receive hook installed in CAN.c
+ *----------------------------------------------------------------------------*/
+static CAN_RAMFUNC uint32_t rxd_rxIRQ (CAN_dev *dev, CAN_msg *msg)  {
+
+  return (RXD_dispatch (dev, msg));
+}
+
+/*----------------------------------------------------------------------------
+  clear all tables and hook into the receive interrupt of both controllers
+  fails if another module holds an RX hook
+ *----------------------------------------------------------------------------*/
+int32_t RXD_init (void)  {
+  uint32_t i;
+
+  for (i = 0; i < 2; i++) {
+    if (CAN_Dev[i].rxHook != 0 && CAN_Dev[i].rxHook != rxd_rxIRQ) {
+      return (RXD_ERR_BUSY);
+    }
+  }
+  for (i = 0; i <= RXD_FUNCS; i++) RXD_funcTab[i] = 0;
+  for (i = 0; i < 2048; i++) RXD_std[0][i] = RXD_std[1][i] = 0;
+  for (i = 0; i < RXD_EXT_SLOTS; i++) RXD_ext[i].key = 0;
+
+  CAN_Dev[0].rxHook = rxd_rxIRQ;
+  CAN_Dev[1].rxHook = rxd_rxIRQ;
+  return (RXD_OK);
+}
+
+/*----------------------------------------------------------------------------
+  register the handler of an identifier, a second call replaces the handler
+  an extended id is rejected with RXD_ERR_FULL if it cannot be placed within
+  RXD_EXT_PROBE slots, which keeps the worst case lookup time fixed
+ *----------------------------------------------------------------------------*/
+int32_t RXD_add (CAN_dev *dev, uint32_t id, uint8_t format, RXD_func func)  {
+  uint32_t f, key, h, n, ctrl;
+
+  if (dev != &CAN_Dev[0] && dev != &CAN_Dev[1]) {
+    return (RXD_ERR_PARAM);
+  }
+  ctrl = dev->ctrl;
+  if (func == 0 ||
+      id > ((format == STANDARD_FORMAT) ? 0x7FFUL : 0x1FFFFFFFUL)) {
+    return (RXD_ERR_PARAM);
+  }
+  f = rxd_func (func);
+  if (f == 0) {
+    return (RXD_ERR_FULL);
+  }
+  if (format == STANDARD_FORMAT) {
+    RXD_std[ctrl-1][id] = (uint8_t)f;
+    return (RXD_OK);
+  }
+
+  key = RXD_KEY_USED | ((ctrl - 1) << 29) | id;
+  h   = rxd_hash (key);
+  for (n = 0; n < RXD_EXT_PROBE; n++) {
+    RXD_slot *s = &RXD_ext[(h + n) & (RXD_EXT_SLOTS - 1)];
+
+    if (s->key == key || s->key == 0) {
+      s->func = (uint8_t)f;                 /* handler before key, the ISR  */
+      s->key  = key;                        /* may look up concurrently     */
+      return (RXD_OK);
+    }
+  }
+  return (RXD_ERR_FULL);
+}
+
+/*----------------------------------------------------------------------------
+  call the handler of a received frame
+  returns 1 if a handler consumed the frame, 0 if no handler is registered
+ *----------------------------------------------------------------------------*/
+CAN_RAMFUNC uint32_t RXD_dispatch (CAN_dev *dev, CAN_msg *msg)  {
+  uint32_t f = 0, key, h, n, ctrl = dev->ctrl;
+
+  if (msg->format == STANDARD_FORMAT) {
+    f = RXD_std[ctrl-1][msg->id & 0x7FF];
+  } else {
+    key = RXD_KEY_USED | ((ctrl - 1) << 29) | msg->id;
+    h   = rxd_hash (key);
+    for (n = 0; n < RXD_EXT_PROBE; n++) {
+      RXD_slot *s = &RXD_ext[(h + n) & (RXD_EXT_SLOTS - 1)];
+
+      if (s->key == key) {
+        f = s->func;
+        break;
+      }
+      if (s->key == 0) {
+        break;
+      }
+    }
+  }
+  if (f == 0) {
+    return (0);
+  }
+  RXD_funcTab[f] (dev, msg);
+  return (1);
+}
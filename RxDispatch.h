@@ -0,0 +1,34 @@
+/*----------------------------------------------------------------------------
+ * Name:    RxDispatch.h
+ * Purpose: constant time dispatch of received CAN frames by identifier
+ * Note(s): standard identifiers index a 2048 entry table, extended
+ *          identifiers are looked up in an open addressed hash table whose
+ *          probe length is bounded when handlers are registered
+ *----------------------------------------------------------------------------*/
+
+#ifndef __RXDISPATCH_H
+#define __RXDISPATCH_H
+
+#include <stdint.h>
+#include "CAN.h"
+
+/* Dispatch configuration */
+#define RXD_FUNCS          31                /* distinct handler functions     */
+#define RXD_EXT_BITS        8                /* 2^n extended id slots          */
+#define RXD_EXT_PROBE       8                /* max. probes per lookup         */
+
+/* Dispatch result codes */
+#define RXD_OK              0
+#define RXD_ERR_FULL       -1                /* handler or hash table full     */
+#define RXD_ERR_PARAM      -2                /* invalid controller or id       */
+#define RXD_ERR_BUSY       -3                /* RX hook owned by another module */
+
+/* frame handler, same signature as the xxx_rxMsg functions of the modules */
+typedef void (*RXD_func) (CAN_dev *dev, CAN_msg *msg);
+
+/* Functions defined in module RxDispatch.c */
+int32_t  RXD_init      (void);
+int32_t  RXD_add       (CAN_dev *dev, uint32_t id, uint8_t format, RXD_func func);
+uint32_t RXD_dispatch  (CAN_dev *dev, CAN_msg *msg);
+
+#endif
@@ -0,0 +1,503 @@
+#include <stdint.h>
+#include <string.h>
+#include "CAN.h"
+#include "OD.h"
+#include "SDO.h"
+
+/* COB-ID base of the default SDO channel */
+#define SDO_RX_BASE       0x600                 /* client -> server            */
+#define SDO_TX_BASE       0x580                 /* server -> client            */
+
+/* client command specifiers (byte 0 bits 7..5) */
+#define SDO_CCS_DN_SEG        0                 /* download segment            */
+#define SDO_CCS_DN_INIT       1                 /* initiate download           */
+#define SDO_CCS_UP_INIT       2                 /* initiate upload             */
+#define SDO_CCS_UP_SEG        3                 /* upload segment              */
+#define SDO_CCS_ABORT         4
+#define SDO_CCS_BLK_UP        5                 /* block upload                */
+#define SDO_CCS_BLK_DN        6                 /* block download              */
+
+/* server states */
+#define SDO_IDLE              0
+#define SDO_DN_SEG            1                 /* segmented download          */
+#define SDO_UP_SEG            2                 /* segmented upload            */
+#define SDO_DN_BLK            3                 /* receiving download blocks   */
+#define SDO_DN_BLK_END        4                 /* waiting for download end    */
+#define SDO_UP_BLK_START      5                 /* waiting for upload start    */
+#define SDO_UP_BLK            6                 /* sending upload block        */
+#define SDO_UP_BLK_ACK        7                 /* waiting for block ack       */
+#define SDO_UP_BLK_END        8                 /* waiting for end response    */
+
+static CAN_dev        *SDO_dev;                   /* CAN controller            */
+static uint8_t         SDO_node;                  /* CANopen node id           */
+static uint32_t        SDO_now;
+
+static uint8_t         SDO_state;
+static const OD_entry *SDO_obj;                   /* object being transferred  */
+static uint16_t        SDO_index;
+static uint8_t         SDO_sub;
+static uint32_t        SDO_len;                   /* total transfer length     */
+static uint32_t        SDO_ofs;                   /* bytes transferred so far  */
+static uint32_t        SDO_blkOfs;                /* offset at start of block  */
+static uint8_t         SDO_toggle;
+static uint8_t         SDO_seq;                   /* last good / sent sequence */
+static uint8_t         SDO_blkSize;
+static uint8_t         SDO_crcEn;                 /* client supports CRC       */
+static uint32_t        SDO_time;                  /* last client activity      */
+
+static CAN_msg         SDO_txMsg;                 /* response to be sent       */
+static uint32_t        SDO_txPending;
+
+/* CRC-16-CCITT, polynomial 0x1021, processed one nibble at a time */
+static const uint16_t  SDO_crcTab[16] = {
+  0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+  0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+
+/*----------------------------------------------------------------------------
+  CRC over a block of data as used by SDO block transfer
+ *----------------------------------------------------------------------------*/
+static uint16_t sdo_crc (const uint8_t *data, uint32_t len)  {
+  uint16_t crc = 0;
+
+  while (len--) {
+    crc = (crc << 4) ^ SDO_crcTab[(crc >> 12) ^ (*data   >> 4)];
+    crc = (crc << 4) ^ SDO_crcTab[(crc >> 12) ^ (*data++ & 0x0F)];
+  }
+  return (crc);
+}
+
+/*----------------------------------------------------------------------------
+  transmit the pending response if the mailbox is free
+ *----------------------------------------------------------------------------*/
+static void sdo_flush (void)  {
+
+  if (SDO_txPending && CAN_tryWrMsg (SDO_dev, &SDO_txMsg)) {
+    SDO_txPending = 0;
+  }
+}
+
+/*----------------------------------------------------------------------------
+  prepare a response frame, bytes 1..3 carry the multiplexer
+ *----------------------------------------------------------------------------*/
+static uint8_t *sdo_resp (uint8_t cmd)  {
+
+  SDO_txMsg.id     = SDO_TX_BASE + SDO_node;
+  SDO_txMsg.format = STANDARD_FORMAT;
+  SDO_txMsg.type   = DATA_FRAME;
+  SDO_txMsg.len    = 8;
+  memset (SDO_txMsg.data, 0, 8);
+  SDO_txMsg.data[0] = cmd;
+  SDO_txMsg.data[1] = SDO_index & 0xFF;
+  SDO_txMsg.data[2] = SDO_index >> 8;
+  SDO_txMsg.data[3] = SDO_sub;
+  SDO_txPending     = 1;
+  return (SDO_txMsg.data);
+}
+
+/*----------------------------------------------------------------------------
+  abort the transfer and report the reason to the client
+ *----------------------------------------------------------------------------*/
+static void sdo_abort (uint32_t code)  {
+  uint8_t *d = sdo_resp (0x80);
+
+  d[4] = code & 0xFF;
+  d[5] = (code >>  8) & 0xFF;
+  d[6] = (code >> 16) & 0xFF;
+  d[7] = (code >> 24) & 0xFF;
+  SDO_state = SDO_IDLE;
+  sdo_flush ();
+}
+
+/*----------------------------------------------------------------------------
+  look up the multiplexed object and check access, 0 on abort
+ *----------------------------------------------------------------------------*/
+static const OD_entry *sdo_object (const uint8_t *d, uint8_t attr)  {
+  const OD_entry *e;
+
+  SDO_index = d[1] | ((uint16_t)d[2] << 8);
+  SDO_sub   = d[3];
+  if ((e = OD_find (SDO_index, SDO_sub)) == 0) {
+    sdo_abort (SDO_ABORT_NOOBJ);
+    return (0);
+  }
+  if ((e->attr & attr) == 0) {
+    sdo_abort ((attr == OD_READ) ? SDO_ABORT_WRITEONLY : SDO_ABORT_READONLY);
+    return (0);
+  }
+  return (e);
+}
+
+/*----------------------------------------------------------------------------
+  send the next segments of an upload block
+ *----------------------------------------------------------------------------*/
+static void sdo_upBlock (void)  {
+  CAN_msg  msg;
+  uint32_t n;
+
+  msg.id     = SDO_TX_BASE + SDO_node;
+  msg.format = STANDARD_FORMAT;
+  msg.type   = DATA_FRAME;
+  msg.len    = 8;
+  while (SDO_state == SDO_UP_BLK && !SDO_txPending) {
+    n = SDO_len - SDO_ofs;
+    if (n > 7) n = 7;
+    memset (msg.data, 0, 8);
+    msg.data[0] = SDO_seq + 1;
+    if (SDO_ofs + n >= SDO_len) {
+      msg.data[0] |= 0x80;                  /* last segment of the transfer */
+    }
+    memcpy (&msg.data[1], (uint8_t *)SDO_obj->data + SDO_ofs, n);
+    if (!CAN_tryWrMsg (SDO_dev, &msg)) {
+      return;                               /* retry from SDO_process       */
+    }
+    SDO_ofs += n;
+    SDO_seq++;
+    if (SDO_ofs >= SDO_len || SDO_seq >= SDO_blkSize) {
+      SDO_state = SDO_UP_BLK_ACK;
+    }
+  }
+}
+
+/*----------------------------------------------------------------------------
+  handle an initiate download request
+ *----------------------------------------------------------------------------*/
+static void sdo_dnInit (const uint8_t *d)  {
+  uint32_t len;
+
+  if ((SDO_obj = sdo_object (d, OD_WRITE)) == 0) {
+    return;
+  }
+  if (d[0] & 0x02) {                        /* expedited                    */
+    len = (d[0] & 0x01) ? 4 - ((d[0] >> 2) & 0x03) : SDO_obj->size;
+    if (len != SDO_obj->size || len > 4) {
+      sdo_abort (SDO_ABORT_LEN);
+      return;
+    }
+    memcpy (SDO_obj->data, &d[4], len);
+    SDO_state = SDO_IDLE;
+  } else {                                  /* segmented                    */
+    SDO_len = (d[0] & 0x01) ? d[4] | ((uint32_t)d[5] << 8) | ((uint32_t)d[6] << 16) | ((uint32_t)d[7] << 24)
+                            : SDO_obj->size;
+    if (SDO_len != SDO_obj->size) {
+      sdo_abort (SDO_ABORT_LEN);
+      return;
+    }
+    SDO_ofs    = 0;
+    SDO_toggle = 0;
+    SDO_state  = SDO_DN_SEG;
+  }
+  sdo_resp (0x60);
+}
+
+/*----------------------------------------------------------------------------
+  handle a download segment
+ *----------------------------------------------------------------------------*/
+static void sdo_dnSeg (const uint8_t *d)  {
+  uint32_t n;
+
+  if (((d[0] >> 4) & 0x01) != SDO_toggle) {
+    sdo_abort (SDO_ABORT_TOGGLE);
+    return;
+  }
+  n = 7 - ((d[0] >> 1) & 0x07);
+  if (SDO_ofs + n > SDO_len || ((d[0] & 0x01) && SDO_ofs + n != SDO_len)) {
+    sdo_abort (SDO_ABORT_LEN);              /* too long, or ends too early  */
+    return;
+  }
+  memcpy ((uint8_t *)SDO_obj->data + SDO_ofs, &d[1], n);
+  SDO_ofs += n;
+  sdo_resp (0x20 | (SDO_toggle << 4));
+  SDO_toggle ^= 1;
+  if (d[0] & 0x01) {                        /* no more segments             */
+    SDO_state = SDO_IDLE;
+  }
+}
+
+/*----------------------------------------------------------------------------
+  handle an initiate upload request
+ *----------------------------------------------------------------------------*/
+static void sdo_upInit (const uint8_t *d)  {
+  uint8_t *r;
+
+  if ((SDO_obj = sdo_object (d, OD_READ)) == 0) {
+    return;
+  }
+  SDO_len = SDO_obj->size;
+  if (SDO_len <= 4) {                       /* expedited                    */
+    r = sdo_resp (0x43 | ((4 - SDO_len) << 2));
+    memcpy (&r[4], SDO_obj->data, SDO_len);
+    SDO_state = SDO_IDLE;
+  } else {
+    r = sdo_resp (0x41);
+    r[4] = SDO_len & 0xFF;
+    r[5] = (SDO_len >>  8) & 0xFF;
+    r[6] = (SDO_len >> 16) & 0xFF;
+    r[7] = (SDO_len >> 24) & 0xFF;
+    SDO_ofs    = 0;
+    SDO_toggle = 0;
+    SDO_state  = SDO_UP_SEG;
+  }
+}
+
+/*----------------------------------------------------------------------------
+  handle an upload segment request
+ *----------------------------------------------------------------------------*/
+static void sdo_upSeg (const uint8_t *d)  {
+  uint8_t *r;
+  uint32_t n;
+
+  if (((d[0] >> 4) & 0x01) != SDO_toggle) {
+    sdo_abort (SDO_ABORT_TOGGLE);
+    return;
+  }
+  n = SDO_len - SDO_ofs;
+  if (n > 7) n = 7;
+  r = sdo_resp ((SDO_toggle << 4) | ((7 - n) << 1));
+  memset (&r[1], 0, 7);                     /* segment has no multiplexer   */
+  memcpy (&r[1], (uint8_t *)SDO_obj->data + SDO_ofs, n);
+  SDO_ofs    += n;
+  SDO_toggle ^= 1;
+  if (SDO_ofs >= SDO_len) {
+    r[0]     |= 0x01;
+    SDO_state = SDO_IDLE;
+  }
+}
+
+/*----------------------------------------------------------------------------
+  handle a block download sub-command or segment
+ *----------------------------------------------------------------------------*/
+static void sdo_blkDn (const uint8_t *d)  {
+  uint8_t *r;
+  uint32_t n, seq;
+
+  if (SDO_state == SDO_DN_BLK) {            /* every frame is a segment     */
+    seq = d[0] & 0x7F;
+    if (seq == 0) {                         /* no segment 0: client abort   */
+      SDO_state = SDO_IDLE;
+      return;
+    }
+    if (seq == (uint32_t)SDO_seq + 1) {
+      if (SDO_ofs >= SDO_obj->size) {
+        sdo_abort (SDO_ABORT_LEN);
+        return;
+      }
+      n = SDO_obj->size - SDO_ofs;
+      if (n > 7) n = 7;
+      memcpy ((uint8_t *)SDO_obj->data + SDO_ofs, &d[1], n);
+      SDO_ofs += 7;                         /* padding removed at the end   */
+      SDO_seq  = seq;
+    }
+    if ((d[0] & 0x80) || seq >= SDO_blkSize) {
+      r = sdo_resp (0xA2);                  /* acknowledge the block        */
+      r[1] = SDO_seq;
+      r[2] = SDO_blkSize;
+      r[3] = 0;
+      if ((d[0] & 0x80) && SDO_seq == seq) {
+        SDO_state = SDO_DN_BLK_END;
+      }
+      SDO_seq = 0;
+    }
+    return;
+  }
+
+  if (SDO_state == SDO_DN_BLK_END) {
+    if ((d[0] & 0xE3) != 0xC1) {
+      sdo_abort (SDO_ABORT_CMD);
+      return;
+    }
+    n = (d[0] >> 2) & 0x07;                 /* unused bytes of last segment */
+    if (SDO_ofs - n > SDO_obj->size || (SDO_len != 0 && SDO_ofs - n != SDO_len)) {
+      sdo_abort (SDO_ABORT_LEN);
+      return;
+    }
+    SDO_ofs -= n;
+    if (SDO_crcEn && sdo_crc (SDO_obj->data, SDO_ofs) != (d[1] | ((uint16_t)d[2] << 8))) {
+      sdo_abort (SDO_ABORT_CRC);
+      return;
+    }
+    r = sdo_resp (0xA1);
+    r[1] = r[2] = r[3] = 0;
+    SDO_state = SDO_IDLE;
+    return;
+  }
+
+  if ((d[0] & 0x01) != 0) {                 /* only initiate when idle      */
+    sdo_abort (SDO_ABORT_CMD);
+    return;
+  }
+  if ((SDO_obj = sdo_object (d, OD_WRITE)) == 0) {
+    return;
+  }
+  SDO_len = (d[0] & 0x02) ? d[4] | ((uint32_t)d[5] << 8) | ((uint32_t)d[6] << 16) | ((uint32_t)d[7] << 24) : 0;
+  if (SDO_len > SDO_obj->size) {
+    sdo_abort (SDO_ABORT_LEN);
+    return;
+  }
+  SDO_crcEn   = (d[0] >> 2) & 0x01;
+  SDO_ofs     = 0;
+  SDO_seq     = 0;
+  SDO_blkSize = SDO_BLKSIZE;
+  SDO_state   = SDO_DN_BLK;
+  r = sdo_resp (0xA4);                      /* server supports CRC          */
+  r[4] = SDO_blkSize;
+}
+
+/*----------------------------------------------------------------------------
+  handle a block upload sub-command
+ *----------------------------------------------------------------------------*/
+static void sdo_blkUp (const uint8_t *d)  {
+  uint8_t *r;
+  uint32_t n;
+
+  switch (d[0] & 0x03) {
+    case 0:                                 /* initiate                     */
+      if (SDO_state != SDO_IDLE) break;
+      if ((SDO_obj = sdo_object (d, OD_READ)) == 0) {
+        return;
+      }
+      if (d[4] == 0 || d[4] > 127) {
+        sdo_abort (SDO_ABORT_BLKSIZE);
+        return;
+      }
+      SDO_len     = SDO_obj->size;
+      SDO_crcEn   = (d[0] >> 2) & 0x01;
+      SDO_blkSize = d[4];
+      SDO_ofs     = 0;
+      SDO_state   = SDO_UP_BLK_START;
+      r = sdo_resp (0xC6);                  /* CRC supported, size given    */
+      r[4] = SDO_len & 0xFF;
+      r[5] = (SDO_len >>  8) & 0xFF;
+      r[6] = (SDO_len >> 16) & 0xFF;
+      r[7] = (SDO_len >> 24) & 0xFF;
+      return;
+
+    case 3:                                 /* start                        */
+      if (SDO_state != SDO_UP_BLK_START) break;
+      SDO_blkOfs = 0;
+      SDO_seq    = 0;
+      SDO_state  = SDO_UP_BLK;
+      sdo_upBlock ();
+      return;
+
+    case 2:                                 /* block acknowledge            */
+      if (SDO_state != SDO_UP_BLK_ACK) break;
+      if (d[2] == 0 || d[2] > 127 || d[1] > SDO_seq) {
+        sdo_abort (d[1] > SDO_seq ? SDO_ABORT_SEQ : SDO_ABORT_BLKSIZE);
+        return;
+      }
+      SDO_ofs     = SDO_blkOfs + (uint32_t)d[1] * 7;
+      if (SDO_ofs > SDO_len) SDO_ofs = SDO_len;
+      SDO_blkOfs  = SDO_ofs;
+      SDO_blkSize = d[2];
+      SDO_seq     = 0;
+      if (SDO_ofs >= SDO_len) {             /* all data acknowledged        */
+        n = (SDO_len % 7) ? 7 - (SDO_len % 7) : 0;
+        r = sdo_resp (0xC1 | (n << 2));
+        n = SDO_crcEn ? sdo_crc (SDO_obj->data, SDO_len) : 0;
+        r[1] = n & 0xFF;
+        r[2] = n >> 8;
+        r[3] = 0;
+        SDO_state = SDO_UP_BLK_END;
+      } else {
+        SDO_state = SDO_UP_BLK;             /* resend from first lost seg.  */
+        sdo_upBlock ();
+      }
+      return;
+
+    case 1:                                 /* end response                 */
+      if (SDO_state != SDO_UP_BLK_END) break;
+      SDO_state = SDO_IDLE;
+      return;
+  }
+  sdo_abort (SDO_ABORT_CMD);
+}
+
+/*----------------------------------------------------------------------------
+  initialise the SDO server of node nodeId
+ *----------------------------------------------------------------------------*/
+void SDO_init (CAN_dev *dev, uint8_t nodeId)  {
+
+  SDO_dev       = dev;
+  SDO_node      = nodeId;
+  SDO_state     = SDO_IDLE;
+  SDO_txPending = 0;
+}
+
+/*----------------------------------------------------------------------------
+  handle a request of the client, called with CAN_lock held
+ *----------------------------------------------------------------------------*/
+static void sdo_rx (const uint8_t *d)  {
+  uint32_t ccs;
+
+  SDO_time = SDO_now;
+
+  if (SDO_state == SDO_DN_BLK) {            /* segments carry no specifier  */
+    sdo_blkDn (d);
+    sdo_flush ();
+    return;
+  }
+
+  ccs = d[0] >> 5;
+  if (ccs == SDO_CCS_ABORT) {
+    SDO_state = SDO_IDLE;
+    return;
+  }
+  switch (SDO_state) {
+    case SDO_IDLE:
+      if      (ccs == SDO_CCS_DN_INIT) sdo_dnInit (d);
+      else if (ccs == SDO_CCS_UP_INIT) sdo_upInit (d);
+      else if (ccs == SDO_CCS_BLK_DN)  sdo_blkDn  (d);
+      else if (ccs == SDO_CCS_BLK_UP)  sdo_blkUp  (d);
+      else                             sdo_abort  (SDO_ABORT_CMD);
+      break;
+    case SDO_DN_SEG:
+      if (ccs == SDO_CCS_DN_SEG) sdo_dnSeg (d); else sdo_abort (SDO_ABORT_CMD);
+      break;
+    case SDO_UP_SEG:
+      if (ccs == SDO_CCS_UP_SEG) sdo_upSeg (d); else sdo_abort (SDO_ABORT_CMD);
+      break;
+    case SDO_DN_BLK_END:
+      if (ccs == SDO_CCS_BLK_DN) sdo_blkDn (d); else sdo_abort (SDO_ABORT_CMD);
+      break;
+    default:                                /* block upload states          */
+      if (ccs == SDO_CCS_BLK_UP) sdo_blkUp (d); else sdo_abort (SDO_ABORT_CMD);
+      break;
+  }
+  sdo_flush ();
+}
+
+/*----------------------------------------------------------------------------
+  process a received CAN frame
+  runs from the RX hook, the transfer state and SDO_txMsg are shared with
+  SDO_process and only changed under CAN_lock
+ *----------------------------------------------------------------------------*/
+void SDO_rxMsg (CAN_dev *dev, CAN_msg *msg)  {
+  uint32_t key;
+
+  if (dev != SDO_dev || msg->format != STANDARD_FORMAT || msg->id != SDO_RX_BASE + SDO_node ||
+      msg->type != DATA_FRAME || msg->len != 8) {
+    return;
+  }
+  key = CAN_lock ();
+  sdo_rx (msg->data);
+  CAN_unlock (key);
+}
+
+/*----------------------------------------------------------------------------
+  send pending frames and supervise the transfer, now is a free running ms tick
+ *----------------------------------------------------------------------------*/
+void SDO_process (uint32_t now)  {
+  uint32_t key = CAN_lock ();
+
+  SDO_now = now;
+  sdo_flush ();
+  if (SDO_state == SDO_UP_BLK) {
+    sdo_upBlock ();
+  }
+  if (SDO_state != SDO_IDLE && (now - SDO_time) > SDO_TIMEOUT) {
+    sdo_abort (SDO_ABORT_TIMEOUT);
+  }
+  CAN_unlock (key);
+}
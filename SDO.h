@@ -0,0 +1,36 @@
+/*----------------------------------------------------------------------------
+ * Name:    SDO.h
+ * Purpose: CANopen service data object server definitions
+ * Note(s): expedited, segmented and block transfer in both directions on
+ *          the default SDO channel of the node, objects come from OD.c
+ *----------------------------------------------------------------------------*/
+
+#ifndef __SDO_H
+#define __SDO_H
+
+#include <stdint.h>
+#include "CAN.h"
+
+/* SDO configuration */
+#define SDO_BLKSIZE       127                /* segments per block (1..127)    */
+#define SDO_TIMEOUT       500                /* ms without client activity     */
+
+/* SDO abort codes */
+#define SDO_ABORT_TOGGLE     0x05030000UL    /* toggle bit not alternated      */
+#define SDO_ABORT_TIMEOUT    0x05040000UL    /* SDO protocol timed out         */
+#define SDO_ABORT_CMD        0x05040001UL    /* command specifier not valid    */
+#define SDO_ABORT_BLKSIZE    0x05040002UL    /* invalid block size             */
+#define SDO_ABORT_SEQ        0x05040003UL    /* invalid sequence number        */
+#define SDO_ABORT_CRC        0x05040004UL    /* CRC error                      */
+#define SDO_ABORT_WRITEONLY  0x06010001UL    /* attempt to read a write only   */
+#define SDO_ABORT_READONLY   0x06010002UL    /* attempt to write a read only   */
+#define SDO_ABORT_NOOBJ      0x06020000UL    /* object does not exist          */
+#define SDO_ABORT_LEN        0x06070010UL    /* length does not match          */
+#define SDO_ABORT_GENERAL    0x08000000UL
+
+/* Functions defined in module SDO.c */
+void     SDO_init      (CAN_dev *dev, uint8_t nodeId);
+void     SDO_rxMsg     (CAN_dev *dev, CAN_msg *msg);
+void     SDO_process   (uint32_t now);
+
+#endif
@@ -1,10 +1,31 @@
 #include <stm32f4xx.h>                  /* STM32F4xx Definitions              */
 #include "Serial.h"
+#include "Clock.h"
+
+#define SER_BAUD  115200
 
 #ifdef __DBG_ITM
 volatile int32_t ITM_RxBuffer;
 #endif
 
+#ifndef __DBG_ITM
+/*-----------------------------------------------------------------------------
+ *       ser_clock:  Follow a clock profile switch
+ *----------------------------------------------------------------------------*/
+static uint32_t ser_clock (uint32_t phase, const CLK_info *clk) {
+
+  if (phase == CLK_CHECK) {
+    return (clk->pclk1 / SER_BAUD >= 16);
+  }
+  if (phase == CLK_PRE) {
+    while (!(UART4->SR & 0x0040));      /* wait for transmission complete     */
+  } else {
+    UART4->BRR = (clk->pclk1 + SER_BAUD / 2) / SER_BAUD;
+  }
+  return (1);
+}
+#endif
+
 /*-----------------------------------------------------------------------------
  *       SER_Init:  Initialize Serial Interface
  *----------------------------------------------------------------------------*/
@@ -21,11 +42,12 @@ void SER_Init (void) {
   GPIOC->MODER  |= 0x00A00000;
   GPIOC->AFR[1] |= 0x00008800;          /* PC10 UART4_Tx, PC11 UART4_Rx (AF8) */
 
-  /* Configure UART4: 115200 baud @ 42MHz, 8 bits, 1 stop bit, no parity      */
-  UART4->BRR = (22 << 4) | 12;
+  /* Configure UART4: 115200 baud @ APB1, 8 bits, 1 stop bit, no parity      */
+  UART4->BRR = (CLK_get ()->pclk1 + SER_BAUD / 2) / SER_BAUD;
   UART4->CR3 = 0x0000;
   UART4->CR2 = 0x0000;
   UART4->CR1 = 0x200C;
+  CLK_notify (ser_clock);
 #endif
 }
 
@@ -1,7 +1,7 @@
 /*----------------------------------------------------------------------------
  * Name:    Serial.h
  * Purpose: Low level serial definitions
- * Note(s):
+ * Note(s): without __DBG_ITM UART4 is used, which Replay.c also needs
  *----------------------------------------------------------------------------
  * This file is part of the uVision/ARM development tools.
  * This software may only be used under the terms of a valid, current,
@@ -0,0 +1,75 @@
+#include <string.h>
+#include <stm32f4xx.h>
+#include "SigDecode.h"
+
+#define SIG_F_SIGNED   0x01                     /* arithmetic shift right     */
+#define SIG_F_SPLIT    0x02                     /* signal spans both words    */
+
+
+/*----------------------------------------------------------------------------
+  compile signal definitions into decode steps
+  plan receives one step per signal; returns SIG_OK or the error of the
+  first bad signal, the plan is then incomplete
+ *----------------------------------------------------------------------------*/
+int32_t SIG_compile (SIG_step *plan, const SIG_def *def, uint32_t num)  {
+  uint32_t i, pos, msb;
+
+  for (i = 0; i < num; i++, def++, plan++) {
+    if (def->len == 0 || def->len > 32 || def->order > SIG_MOTOROLA) {
+      return (SIG_ERR_PARAM);
+    }
+    if (def->start > 63) {
+      return (SIG_ERR_LAYOUT);
+    }
+    if (def->order == SIG_INTEL) {
+      pos = def->start;                         /* lsb, little endian image   */
+      if (pos + def->len > 64) {
+        return (SIG_ERR_LAYOUT);
+      }
+      plan->src = (uint8_t)(pos / 32);
+    } else {
+      msb = (7 - def->start / 8) * 8 + def->start % 8;  /* big endian image */
+      if (msb + 1 < def->len) {
+        return (SIG_ERR_LAYOUT);
+      }
+      pos = msb + 1 - def->len;
+      plan->src = (uint8_t)(2 + pos / 32);
+    }
+    plan->shr   = (uint8_t)(32 - def->len);
+    plan->flags = def->sign ? SIG_F_SIGNED : 0;
+    if (pos / 32 != (pos + def->len - 1) / 32) {
+      plan->flags |= SIG_F_SPLIT;               /* lower part in word src     */
+      plan->lsb    = (uint8_t)pos;
+      plan->shl    = (uint8_t)(32 - def->len);
+    } else {
+      plan->lsb    = 0;
+      plan->shl    = (uint8_t)(32 - (pos % 32) - def->len);
+    }
+  }
+  return (SIG_OK);
+}
+
+/*----------------------------------------------------------------------------
+  decode 'num' signals from each of 'frames' messages
+  out receives frames * num raw values, frame by frame in plan order;
+  unsigned 32-bit signals are returned bit for bit
+ *----------------------------------------------------------------------------*/
+void SIG_decode (const SIG_step *plan, uint32_t num,
+                 const CAN_msg *msg, uint32_t frames, int32_t *out)  {
+  const SIG_step *s, *end = plan + num;
+  uint32_t        img[4], w;
+
+  for (; frames; frames--, msg++) {
+    memcpy (img, msg->data, 8);                 /* bits 0..63, no type pun    */
+    img[2] = __REV (img[1]);                    /* big endian bits  0..31     */
+    img[3] = __REV (img[0]);                    /* big endian bits 32..63     */
+    for (s = plan; s < end; s++) {
+      w = img[s->src];
+      if (s->flags & SIG_F_SPLIT) {
+        w = (w >> s->lsb) | (img[s->src + 1] << (32 - s->lsb));
+      }
+      w <<= s->shl;
+      *out++ = (s->flags & SIG_F_SIGNED) ? ((int32_t)w >> s->shr) : (int32_t)(w >> s->shr);
+    }
+  }
+}
@@ -0,0 +1,49 @@
+/*----------------------------------------------------------------------------
+ * Name:    SigDecode.h
+ * Purpose: bulk decoding of CAN signals from buffered frames
+ * Note(s): a signal set is compiled once into a plan of word level steps,
+ *          SIG_decode then runs the plan over any number of frames. Every
+ *          frame is loaded as two 32-bit words, byte reversed once with
+ *          REV for the Motorola signals, and each signal is cut out with a
+ *          shift pair, the run time form of UBFX / SBFX. Signals that span
+ *          the two words are joined with one more shift and or.
+ *          Start bits follow the DBC convention as in CanMsg.hpp: an Intel
+ *          signal starts at its lsb, a Motorola signal at its msb.
+ *----------------------------------------------------------------------------*/
+
+#ifndef __SIGDECODE_H
+#define __SIGDECODE_H
+
+#include <stdint.h>
+#include "CAN.h"
+
+/* byte order of a signal */
+#define SIG_INTEL           0                /* little endian, @1 in DBC       */
+#define SIG_MOTOROLA        1                /* big endian, @0 in DBC          */
+
+/* Signal result codes */
+#define SIG_OK              0
+#define SIG_ERR_PARAM      -1                /* length 0 or above 32, unknown order */
+#define SIG_ERR_LAYOUT     -2                /* signal leaves the frame        */
+
+typedef struct  {
+  uint8_t        start;                 /* DBC start bit 0..63 */
+  uint8_t        len;                   /* 1..32 bits */
+  uint8_t        order;                 /* SIG_INTEL, SIG_MOTOROLA */
+  uint8_t        sign;                  /* 1 - sign extend the raw value */
+} SIG_def;
+
+typedef struct  {
+  uint8_t        src;                   /* frame word: 0,1 little endian, 2,3 big endian */
+  uint8_t        lsb;                   /* split signal: lsb in word src, else 0 */
+  uint8_t        shl;                   /* puts the msb at bit 31 */
+  uint8_t        shr;                   /* 32 - len, shifts the lsb to bit 0 */
+  uint8_t        flags;
+} SIG_step;
+
+/* Functions defined in module SigDecode.c */
+int32_t  SIG_compile   (SIG_step *plan, const SIG_def *def, uint32_t num);
+void     SIG_decode    (const SIG_step *plan, uint32_t num,
+                        const CAN_msg *msg, uint32_t frames, int32_t *out);
+
+#endif
@@ -0,0 +1,294 @@
+#include <stm32f4xx.h>
+#include "CAN.h"
+#include "Clock.h"
+#include "Stress.h"
+
+#define STR_MBX        0x07                     /* all three TX mailboxes      */
+#define STR_BURST         3                     /* frames the budget may save  */
+#define STR_TICK_BITS  ((STR_BITRATE / 100) * STR_TICK_US / 10000)  /* 1% load per tick, x100 */
+
+typedef struct  {
+  STR_class      mix[STR_CLASSES];
+  uint32_t       num;                   /* classes in mix */
+  uint32_t       weights;               /* sum of all weights */
+  uint32_t       loadPct;
+  volatile uint32_t active;
+  uint32_t       rnd;                   /* xorshift state */
+  CAN_msg        next;                  /* frame waiting for a mailbox */
+  uint32_t       nextBits;              /* its nominal length in bits */
+  int32_t        budget;                /* bit times x100 still allowed */
+  uint32_t       mbxBits[3];            /* length of the frame in each mailbox */
+  volatile uint32_t sent, dropped, bits;
+  uint32_t       lastTime, lastSent, lastBits;
+  uint32_t       fps, load;
+} STR_ctrl;
+
+static STR_ctrl   STR_c[2];
+
+static void str_txIRQ (CAN_dev *dev, uint32_t tsr);
+
+
+/*----------------------------------------------------------------------------
+  32-bit xorshift pseudo random numbers
+ *----------------------------------------------------------------------------*/
+static __inline uint32_t str_rand (STR_ctrl *c)  {
+  uint32_t x = c->rnd;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x <<  5;
+  c->rnd = x;
+  return (x);
+}
+
+/*----------------------------------------------------------------------------
+  draw the next frame from the mix and compute its nominal length
+ *----------------------------------------------------------------------------*/
+static void str_next (STR_ctrl *c)  {
+  const STR_class *k = c->mix;
+  CAN_msg         *m = &c->next;
+  uint32_t         r, i;
+
+  r = str_rand (c) % c->weights;
+  for (i = 0; i < c->num - 1 && r >= k->weight; i++, k++) {
+    r -= k->weight;
+  }
+  m->id     = k->idMin + str_rand (c) % (k->idMax - k->idMin + 1);
+  m->format = k->format;
+  m->len    = (unsigned char)(k->dlcMin + str_rand (c) % (k->dlcMax - k->dlcMin + 1));
+  m->type   = (str_rand (c) % 100 < k->remote) ? REMOTE_FRAME : DATA_FRAME;
+  r = str_rand (c);
+  for (i = 0; i < 8; i++) {
+    m->data[i] = (unsigned char)(r >> (8 * (i & 3)));
+    if (i == 3) r = str_rand (c);
+  }
+
+  c->nextBits = ((m->format == STANDARD_FORMAT) ? 47 : 67) +
+                ((m->type == DATA_FRAME) ? 8 * m->len : 0);
+}
+
+/*----------------------------------------------------------------------------
+  fill free mailboxes as far as the budget allows
+  called from the TIM6 and CAN TX interrupts, which share one priority
+ *----------------------------------------------------------------------------*/
+static void str_fill (CAN_dev *dev)  {
+  STR_ctrl *c = &STR_c[dev->ctrl-1];
+  int32_t   mbx;
+
+  while (c->active && (c->loadPct >= 100 || c->budget >= (int32_t)(c->nextBits * 100))) {
+    mbx = CAN_wrMbx (dev, STR_MBX, &c->next);
+    if (mbx < 0) {
+      break;
+    }
+    c->mbxBits[mbx] = c->nextBits;
+    if (c->loadPct < 100) {
+      c->budget -= c->nextBits * 100;
+    }
+    str_next (c);
+  }
+  CAN_txNotify (dev);                                /* keep refill running */
+}
+
+/*----------------------------------------------------------------------------
+  give the TX hook back once a stopped generator's frames have left the
+  mailboxes, called from the TX interrupt or with it disabled
+ *----------------------------------------------------------------------------*/
+static void str_release (CAN_dev *dev)  {
+  CAN_TypeDef *pCAN = dev->reg;
+
+  if (!STR_c[dev->ctrl-1].active && dev->txHook == str_txIRQ &&
+      (pCAN->TSR & CAN_TSR_TME) == CAN_TSR_TME) {
+    dev->txHook = 0;
+  }
+}
+
+/*----------------------------------------------------------------------------
+  run the TIM6 pacing tick only while a generator below 100 % needs it
+ *----------------------------------------------------------------------------*/
+static void str_tick (void)  {
+  uint32_t i, need = 0;
+
+  for (i = 0; i < 2; i++) {
+    if (STR_c[i].active && STR_c[i].loadPct < 100) need = 1;
+  }
+  if (need) TIM6->CR1 |=  TIM_CR1_CEN;
+  else      TIM6->CR1 &= ~TIM_CR1_CEN;
+}
+
+/*----------------------------------------------------------------------------
+  TX interrupt hook: account completed mailboxes and refill them
+ *----------------------------------------------------------------------------*/
+static void str_txIRQ (CAN_dev *dev, uint32_t tsr)  {
+  static const uint32_t rqcp[3] = { CAN_TSR_RQCP0, CAN_TSR_RQCP1, CAN_TSR_RQCP2 };
+  static const uint32_t txok[3] = { CAN_TSR_TXOK0, CAN_TSR_TXOK1, CAN_TSR_TXOK2 };
+  STR_ctrl *c = &STR_c[dev->ctrl-1];
+  uint32_t  i;
+
+  for (i = 0; i < 3; i++) {
+    if (tsr & rqcp[i]) {
+      if (tsr & txok[i]) {
+        c->sent++;
+        c->bits += c->mbxBits[i];
+      } else {
+        c->dropped++;
+      }
+    }
+  }
+  if (c->active) {
+    str_fill (dev);
+  } else {
+    str_release (dev);
+  }
+}
+
+/*----------------------------------------------------------------------------
+  clock profile switch: keep the 1 MHz counter clock of the pacing tick
+ *----------------------------------------------------------------------------*/
+static uint32_t str_clock (uint32_t phase, const CLK_info *clk)  {
+
+  if (phase == CLK_CHECK) {
+    return (clk->tim1 % 1000000 == 0);
+  }
+  if (phase == CLK_POST) {
+    TIM6->PSC = (clk->tim1 / 1000000) - 1;
+  }
+  return (1);
+}
+
+/*----------------------------------------------------------------------------
+  set up the TIM6 pacing tick, both generators and the tick are stopped
+ *----------------------------------------------------------------------------*/
+void STR_init (void)  {
+
+  STR_c[0].active = STR_c[1].active = 0;
+
+  RCC->APB1ENR |= (1UL << 4);               /* Enable TIM6 clock            */
+  TIM6->CR1  = 0;
+  TIM6->PSC  = (CLK_get ()->tim1 / 1000000) - 1;  /* 1 MHz counter clock    */
+  TIM6->ARR  = STR_TICK_US - 1;
+  TIM6->EGR  = TIM_EGR_UG;
+  TIM6->SR   = 0;
+  TIM6->DIER = TIM_DIER_UIE;
+  NVIC_EnableIRQ (TIM6_DAC_IRQn);
+  CLK_notify (str_clock);
+}
+
+/*----------------------------------------------------------------------------
+  start generating traffic on a controller
+  mix lists the frame classes, loadPct is the target load in percent
+ *----------------------------------------------------------------------------*/
+int32_t STR_start (CAN_dev *dev, const STR_class *mix, uint32_t num, uint32_t loadPct)  {
+  STR_ctrl *c;
+  uint32_t  i, w = 0;
+
+  if ((dev != &CAN_Dev[0] && dev != &CAN_Dev[1]) || num == 0 || num > STR_CLASSES || loadPct == 0 || loadPct > 100) {
+    return (STR_ERR_PARAM);
+  }
+  for (i = 0; i < num; i++) {
+    if (mix[i].idMin > mix[i].idMax || mix[i].dlcMin > mix[i].dlcMax || mix[i].dlcMax > 8 ||
+        mix[i].idMax > ((mix[i].format == STANDARD_FORMAT) ? 0x7FFUL : 0x1FFFFFFFUL)) {
+      return (STR_ERR_PARAM);
+    }
+    w += mix[i].weight;
+  }
+  if (w == 0) {
+    return (STR_ERR_PARAM);
+  }
+  if (dev->txHook != 0 && dev->txHook != str_txIRQ) {
+    return (STR_ERR_BUSY);
+  }
+
+  c = &STR_c[dev->ctrl-1];
+  c->active = 0;
+  for (i = 0; i < num; i++) c->mix[i] = mix[i];
+  c->num      = num;
+  c->weights  = w;
+  c->loadPct  = loadPct;
+  c->rnd      = 0x2545F491UL * dev->ctrl;
+  c->budget   = 0;
+  c->sent     = c->dropped = c->bits = 0;
+  c->lastSent = c->lastBits = 0;
+  c->fps      = c->load = 0;
+  str_next (c);
+
+  dev->txHook = str_txIRQ;
+  NVIC_DisableIRQ ((dev->ctrl == 1) ? CAN1_TX_IRQn : CAN2_TX_IRQn);
+  c->active = 1;
+  str_fill (dev);
+  NVIC_EnableIRQ ((dev->ctrl == 1) ? CAN1_TX_IRQn : CAN2_TX_IRQn);
+  str_tick ();
+  return (STR_OK);
+}
+
+/*----------------------------------------------------------------------------
+  stop generating traffic, frames already in mailboxes are still sent and
+  counted, the TX hook is released when the last of them has left
+ *----------------------------------------------------------------------------*/
+void STR_stop (CAN_dev *dev)  {
+  IRQn_Type irq = (dev->ctrl == 1) ? CAN1_TX_IRQn : CAN2_TX_IRQn;
+
+  NVIC_DisableIRQ (irq);
+  STR_c[dev->ctrl-1].active = 0;
+  str_release (dev);
+  NVIC_EnableIRQ (irq);
+  str_tick ();
+}
+
+/*----------------------------------------------------------------------------
+  update frames/s and load once per second, now is a ms time stamp
+ *----------------------------------------------------------------------------*/
+void STR_process (uint32_t now)  {
+  STR_ctrl *c;
+  uint32_t  i, dt, sent, bits;
+
+  for (i = 0; i < 2; i++) {
+    c  = &STR_c[i];
+    dt = now - c->lastTime;
+    if (dt < 1000) {
+      continue;
+    }
+    sent = c->sent;
+    bits = c->bits;
+    c->fps  = (sent - c->lastSent) * 1000 / dt;
+    c->load = (uint32_t)((uint64_t)(bits - c->lastBits) * 100000 / ((uint64_t)STR_BITRATE * dt));
+    c->lastSent = sent;
+    c->lastBits = bits;
+    c->lastTime = now;
+  }
+}
+
+/*----------------------------------------------------------------------------
+  counters and rates of a controller
+ *----------------------------------------------------------------------------*/
+void STR_getStats (CAN_dev *dev, STR_stats *s)  {
+  STR_ctrl *c = &STR_c[dev->ctrl-1];
+
+  s->sent    = c->sent;
+  s->dropped = c->dropped;
+  s->fps     = c->fps;
+  s->load    = c->load;
+}
+
+/*----------------------------------------------------------------------------
+  TIM6 interrupt handler: release the budget of one tick
+ *----------------------------------------------------------------------------*/
+void TIM6_DAC_IRQHandler (void) {
+  STR_ctrl *c;
+  uint32_t  i;
+
+  if (TIM6->SR & TIM_SR_UIF) {
+    TIM6->SR = ~TIM_SR_UIF;                 /* clear update flag            */
+
+    for (i = 0; i < 2; i++) {
+      c = &STR_c[i];
+      if (!c->active || c->loadPct >= 100) {
+        continue;
+      }
+      c->budget += STR_TICK_BITS * c->loadPct;
+      if (c->budget > STR_BURST * 131 * 100) {
+        c->budget = STR_BURST * 131 * 100;  /* 131: longest nominal frame   */
+      }
+      str_fill (&CAN_Dev[i]);
+    }
+  }
+}
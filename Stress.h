@@ -0,0 +1,57 @@
+/*----------------------------------------------------------------------------
+ * Name:    Stress.h
+ * Purpose: bus load generator for testing other nodes under heavy traffic
+ * Note(s): frames are drawn at random from a mix of frame classes and
+ *          loaded into all three TX mailboxes from the TX interrupt. Below
+ *          100 % the TIM6 tick releases a budget of bit times that paces
+ *          the refills. Loads are computed from nominal frame lengths
+ *          without stuff bits. Without automatic retransmission (NART) a
+ *          frame that loses arbitration or sees an error is counted as
+ *          dropped. The generator owns the TX mailboxes and the TX hooks
+ *          of the controllers it runs on, STR_start fails if another
+ *          module (cyclic scheduler, replay) holds the TX hook. STR_stop
+ *          hands the hook back once the mailboxes have drained, TIM6 only
+ *          runs while a generator below 100 % is active.
+ *----------------------------------------------------------------------------*/
+
+#ifndef __STRESS_H
+#define __STRESS_H
+
+#include <stdint.h>
+#include "CAN.h"
+
+/* Stress configuration */
+#define STR_BITRATE  CAN_BITRATE            /* CAN bit rate set by CAN_setup  */
+#define STR_TICK_US       100                /* pacing tick                    */
+#define STR_CLASSES         8                /* frame classes per controller   */
+
+/* Stress result codes */
+#define STR_OK              0
+#define STR_ERR_PARAM      -1                /* invalid controller or mix      */
+#define STR_ERR_BUSY       -2                /* TX hook owned by another module */
+
+typedef struct  {
+  uint32_t       idMin;                 /* identifiers drawn uniformly */
+  uint32_t       idMax;                 /* from idMin..idMax */
+  uint8_t        format;                /* STANDARD_FORMAT, EXTENDED_FORMAT */
+  uint8_t        dlcMin;                /* data length drawn uniformly */
+  uint8_t        dlcMax;                /* from dlcMin..dlcMax */
+  uint8_t        remote;                /* percentage of remote frames */
+  uint8_t        weight;                /* share of this class in the mix */
+} STR_class;
+
+typedef struct  {
+  uint32_t       sent;                  /* frames transmitted */
+  uint32_t       dropped;               /* arbitration lost or error */
+  uint32_t       fps;                   /* frames per second, last interval */
+  uint32_t       load;                  /* achieved load in %, last interval */
+} STR_stats;
+
+/* Functions defined in module Stress.c */
+void     STR_init      (void);
+int32_t  STR_start     (CAN_dev *dev, const STR_class *mix, uint32_t num, uint32_t loadPct);
+void     STR_stop      (CAN_dev *dev);
+void     STR_process   (uint32_t now);
+void     STR_getStats  (CAN_dev *dev, STR_stats *s);
+
+#endif
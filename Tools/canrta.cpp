@@ -0,0 +1,255 @@
+/*----------------------------------------------------------------------------
+ * Name:    canrta.cpp
+ * Purpose: worst case response times of a CAN message set
+ * Note(s): host tool, build with  g++ -std=c++11 -O2 -o canrta canrta.cpp
+ *          usage: canrta [-r btr] [-p pclk] [-b bitrate] [-m mailboxes] msgs.txt
+ *
+ *          msgs.txt has one message per line
+ *            ctrl  id  dlc  period_ms  [jitter_ms [deadline_ms]]  [x]
+ *          where ctrl names the transmitting controller (can1, can2 or any
+ *          other node on the bus), x marks an extended id and '#' starts a
+ *          comment. The deadline defaults to the period.
+ *
+ *          The bit rate is taken from a BTR value as written by CAN_setup
+ *          (-r, default the 500 kbit/s timing at -p 42 MHz) or given
+ *          directly with -b. Frame times assume the worst case number of
+ *          stuff bits. Response times follow the revised schedulability
+ *          analysis of Davis, Burns, Bril and Lukkien (2007), with busy
+ *          periods over several instances and release jitter.
+ *
+ *          Each message is analysed for a controller with one TX mailbox,
+ *          as CAN_wrMsg uses it, and with three, as CAN_wrMbx can. Frames
+ *          already loaded cannot be aborted: if a controller has at least
+ *          as many lower priority messages as mailboxes, all mailboxes can
+ *          hold them when a message is released. It then waits until the
+ *          highest of those frames is sent, which is delayed by all other
+ *          controllers' frames above that frame. This bound is sufficient,
+ *          not exact, and assumes the controller queues its frames in
+ *          priority order. -m 1 or -m 3 judges only that configuration,
+ *          the exit status is 1 if a deadline can be missed.
+ *----------------------------------------------------------------------------*/
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+struct Message {
+  std::string ctrl;
+  uint32_t    id;
+  bool        ext;
+  unsigned    dlc;
+  double      T, J, D;                  /* period, jitter, deadline in us */
+  double      C;                        /* longest frame time in us */
+  uint64_t    prio;                     /* arbitration order, lower wins */
+};
+
+/*----------------------------------------------------------------------------
+  bit rate of a bxCAN BTR value at APB1 clock pclk
+ *----------------------------------------------------------------------------*/
+static double btrBitrate (uint32_t btr, double pclk)  {
+  unsigned brp = (btr & 0x3FF) + 1;
+  unsigned ts1 = ((btr >> 16) & 0x0F) + 1;
+  unsigned ts2 = ((btr >> 20) & 0x07) + 1;
+
+  return pclk / (brp * (1 + ts1 + ts2));
+}
+
+/*----------------------------------------------------------------------------
+  longest frame including stuff bits, EOF and inter frame space, in bits
+ *----------------------------------------------------------------------------*/
+static unsigned frameBits (const Message &m)  {
+  unsigned g = m.ext ? 54 : 34;         /* bits exposed to stuffing, without data */
+
+  return g + 8 * m.dlc + 13 + (g + 8 * m.dlc - 1) / 4;
+}
+
+class Analysis {
+public:
+  Analysis (const std::vector<Message> &msgs, double tbit) : msgs_ (msgs), tbit_ (tbit) {}
+
+  /* worst case response time of message i with 'mbx' TX mailboxes per
+     controller, infinity if the busy period does not end */
+  double response (unsigned i, unsigned mbx) const  {
+    const Message &m   = msgs_[i];
+    double         inv = 0;
+    double         B   = 0;
+    double         t, w, R = 0, next;
+    unsigned       k, q, Q;
+    int            p   = inversion (i, mbx);
+    std::vector<unsigned> I;            /* messages that can be sent ahead of m */
+
+    for (k = 0; k < msgs_.size (); k++) {
+      if (k == i) continue;
+      if (msgs_[k].prio < m.prio) {
+        I.push_back (k);
+      } else {
+        B = std::max (B, msgs_[k].C);   /* a lower frame already on the bus */
+        if (p >= 0 && msgs_[k].ctrl != m.ctrl && msgs_[k].prio < msgs_[p].prio) {
+          I.push_back (k);              /* ahead of the frame in our mailbox */
+        }
+      }
+    }
+    if (p >= 0) inv = msgs_[p].C;
+
+    /* length of the busy period at the priority of m */
+    for (t = m.C; ; t = next) {
+      next = B + inv + std::ceil ((t + m.J) / m.T) * m.C;
+      for (k = 0; k < I.size (); k++) next += std::ceil ((t + msgs_[I[k]].J) / msgs_[I[k]].T) * msgs_[I[k]].C;
+      if (next == t) break;
+      if (next > LIMIT) return INFINITY;
+    }
+    Q = (unsigned)std::ceil ((t + m.J) / m.T);
+
+    for (q = 0; q < Q; q++) {
+      for (w = B + inv + q * m.C; ; w = next) {
+        next = B + inv + q * m.C;
+        for (k = 0; k < I.size (); k++) {
+          next += std::ceil ((w + msgs_[I[k]].J + tbit_) / msgs_[I[k]].T) * msgs_[I[k]].C;
+        }
+        if (next == w) break;
+        if (next > LIMIT) return INFINITY;
+      }
+      R = std::max (R, m.J + w - q * m.T + m.C);
+    }
+    return R;
+  }
+
+private:
+  static constexpr double LIMIT = 60e6; /* 60 s, the message set is overloaded */
+
+  /* frame of the own controller that can sit in the mailboxes when message i
+     is released: the highest of the 'mbx' lowest priority messages, -1 if a
+     mailbox is always free for i */
+  int inversion (unsigned i, unsigned mbx) const  {
+    std::vector<unsigned> low;
+    unsigned k;
+
+    for (k = 0; k < msgs_.size (); k++) {
+      if (msgs_[k].ctrl == msgs_[i].ctrl && msgs_[k].prio > msgs_[i].prio) low.push_back (k);
+    }
+    if (low.size () < mbx) return -1;
+    std::sort (low.begin (), low.end (), [this] (unsigned a, unsigned b) {
+      return msgs_[a].prio > msgs_[b].prio;
+    });
+    return (int)low[mbx - 1];
+  }
+
+  const std::vector<Message> &msgs_;
+  double                      tbit_;
+};
+
+static bool load (std::vector<Message> &msgs, const char *file)  {
+  std::ifstream in (file);
+  std::string   line;
+  unsigned      no = 0, k;
+
+  if (!in) {
+    fprintf (stderr, "canrta: cannot open %s\n", file);
+    return false;
+  }
+  while (std::getline (in, line)) {
+    std::vector<std::string> f;
+    std::string tok;
+    Message     m;
+
+    no++;
+    line = line.substr (0, line.find ('#'));
+    std::istringstream s (line);
+    while (s >> tok) f.push_back (tok);
+    if (f.empty ()) continue;
+    m.ext = (f.back () == "x");
+    if (m.ext) f.pop_back ();
+    if (f.size () < 4 || f.size () > 6) {
+      fprintf (stderr, "canrta: %s:%u: ctrl id dlc period_ms [jitter_ms [deadline_ms]] [x]\n", file, no);
+      return false;
+    }
+    m.ctrl = f[0];
+    m.id   = (uint32_t)strtoul (f[1].c_str (), 0, 0);
+    m.dlc  = (unsigned)atoi (f[2].c_str ());
+    m.T    = atof (f[3].c_str ()) * 1000.0;
+    m.J    = (f.size () > 4) ? atof (f[4].c_str ()) * 1000.0 : 0.0;
+    m.D    = (f.size () > 5) ? atof (f[5].c_str ()) * 1000.0 : m.T;
+    m.prio = m.ext ? (((uint64_t)(m.id >> 18) << 20) | (1UL << 19) | ((m.id & 0x3FFFF) << 1))
+                   : ((uint64_t)m.id << 20);
+    if (m.dlc > 8 || m.T <= 0 || m.J < 0 || m.D <= 0 || m.id > (m.ext ? 0x1FFFFFFFUL : 0x7FFUL)) {
+      fprintf (stderr, "canrta: %s:%u: invalid message\n", file, no);
+      return false;
+    }
+    for (k = 0; k < msgs.size (); k++) {
+      if (msgs[k].prio == m.prio) {
+        fprintf (stderr, "canrta: %s:%u: id used twice\n", file, no);
+        return false;
+      }
+    }
+    msgs.push_back (m);
+  }
+  return true;
+}
+
+int main (int argc, char **argv)  {
+  uint32_t    btr  = 0x0213000B;        /* CAN_setup at 42 MHz: 12 * 7 tq */
+  double      pclk = 42e6, bitrate = 0, U = 0;
+  unsigned    mbx  = 0, i, miss = 0;
+  const char *file = 0;
+  int         a;
+  std::vector<Message> msgs;
+
+  for (a = 1; a < argc; a++) {
+    if      (!strcmp (argv[a], "-r") && a + 1 < argc) btr     = (uint32_t)strtoul (argv[++a], 0, 16);
+    else if (!strcmp (argv[a], "-p") && a + 1 < argc) pclk    = atof (argv[++a]);
+    else if (!strcmp (argv[a], "-b") && a + 1 < argc) bitrate = atof (argv[++a]);
+    else if (!strcmp (argv[a], "-m") && a + 1 < argc) mbx     = (unsigned)atoi (argv[++a]);
+    else if (argv[a][0] != '-' && file == 0)          file    = argv[a];
+    else {
+      fprintf (stderr, "usage: canrta [-r btr] [-p pclk] [-b bitrate] [-m mailboxes] msgs.txt\n");
+      return 2;
+    }
+  }
+  if (bitrate == 0) bitrate = btrBitrate (btr, pclk);
+  if (!file || bitrate <= 0 || (mbx != 0 && mbx != 1 && mbx != 3)) {
+    fprintf (stderr, "canrta: need a message file, a bit rate and 1 or 3 mailboxes\n");
+    return 2;
+  }
+  if (!load (msgs, file)) return 1;
+
+  double tbit = 1e6 / bitrate;
+  for (i = 0; i < msgs.size (); i++) {
+    msgs[i].C = frameBits (msgs[i]) * tbit;
+    U += msgs[i].C / msgs[i].T;
+  }
+  std::sort (msgs.begin (), msgs.end (), [] (const Message &x, const Message &y) {
+    return x.prio < y.prio;
+  });
+
+  Analysis rta (msgs, tbit);
+  printf ("bit rate %.0f bit/s, bus utilisation %.1f %% (worst case stuffing)\n\n", bitrate, 100.0 * U);
+  printf ("%-8s %9s %3s %8s %7s %8s %7s %10s %10s\n", "ctrl", "id", "dlc", "period", "jitter",
+          "deadline", "C_us", "R1_us", "R3_us");
+  for (i = 0; i < msgs.size (); i++) {
+    const Message &m  = msgs[i];
+    double         r1 = rta.response (i, 1);
+    double         r3 = rta.response (i, 3);
+    double         r  = (mbx == 3) ? r3 : r1;
+    char           id[16];
+
+    snprintf (id, sizeof (id), m.ext ? "%08X" : "%03X", (unsigned)m.id);
+    printf ("%-8s %9s %3u %8.3f %7.3f %8.3f %7.1f %10.1f %10.1f", m.ctrl.c_str (), id, m.dlc,
+            m.T / 1000.0, m.J / 1000.0, m.D / 1000.0, m.C, r1, r3);
+    if (mbx == 0) {
+      printf ("%s%s\n", (r1 > m.D) ? "  miss(1)" : "", (r3 > m.D) ? "  miss(3)" : "");
+      if (r1 > m.D || r3 > m.D) miss++;
+    } else {
+      printf ("%s\n", (r > m.D) ? "  miss" : "");
+      if (r > m.D) miss++;
+    }
+  }
+  printf ("\n%u of %u messages can miss their deadline\n", miss, (unsigned)msgs.size ());
+  return miss ? 1 : 0;
+}
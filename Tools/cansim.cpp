@@ -0,0 +1,414 @@
+/*----------------------------------------------------------------------------
+ * Name:    cansim.cpp
+ * Purpose: simulate a CAN network of many nodes and report latency per id
+ * Note(s): host tool, build with  g++ -std=c++11 -O2 -o cansim cansim.cpp
+ *          usage: cansim [-b bitrate] [-t seconds] [-m mailboxes] [-a]
+ *                        [-g nodes] [-s seed] [-z] [network.txt]
+ *
+ *          Every node transmits the way CAN.c does: frames released by the
+ *          application wait in a software queue and are loaded into the
+ *          first empty of 'mailboxes' TX mailboxes (CAN_wrMbx). Pending
+ *          mailboxes are offered to the bus in identifier order (TXFP = 0).
+ *          As CAN_setup sets NART, a mailbox that loses arbitration
+ *          completes with ALST and the frame goes back to the head of the
+ *          queue; -a simulates automatic retransmission instead.
+ *
+ *          Frames are built bit by bit including CRC and stuff bits, the
+ *          contenders are compared bit by bit on the wired-AND bus until
+ *          one is left, and every frame is followed by the 3 bit inter
+ *          frame space. Time advances from frame to frame, so an hour of
+ *          bus traffic takes seconds. Payloads are random (-s seed) or all
+ *          zero with -z, which gives the most stuff bits.
+ *
+ *          network.txt has one periodic message per line
+ *            node  id  dlc  period_ms  [offset_ms]  [x]
+ *          where x marks an extended id; '#' starts a comment. -g N
+ *          generates N nodes with four messages each instead.
+ *----------------------------------------------------------------------------*/
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+struct Message {
+  unsigned    node;
+  uint32_t    id;
+  bool        ext;
+  unsigned    dlc;
+  double      period;                   /* us */
+  double      offset;                   /* us, release of the next instance */
+  uint64_t    next;                     /* the same in bit times */
+  /* statistics */
+  unsigned long sent, lost, miss;
+  uint64_t    latSum, latMin, latMax;   /* release to end of EOF, bit times */
+  unsigned    bitsMax;
+  unsigned    queued;                   /* instances not yet sent */
+};
+
+struct Frame {
+  unsigned    msg;                      /* index into the message table */
+  uint64_t    release;
+};
+
+struct Node {
+  std::string        name;
+  std::deque<Frame>  queue;             /* software queue in front of the mailboxes */
+  std::vector<Frame> mbx;               /* loaded mailboxes */
+};
+
+/*----------------------------------------------------------------------------
+  bit stream of a frame: SOF up to the end of the CRC field with stuff
+  bits, the fixed form fields follow and are only counted
+ *----------------------------------------------------------------------------*/
+static void put (std::vector<uint8_t> &v, uint32_t val, unsigned bits)  {
+
+  while (bits--) v.push_back ((uint8_t)((val >> bits) & 1));
+}
+
+static std::vector<uint8_t> frameBits (const Message &m, const uint8_t *data)  {
+  std::vector<uint8_t> raw, out;
+  unsigned             i, crc = 0, run = 0;
+  uint8_t              last = 2;
+
+  put (raw, 0, 1);                      /* SOF */
+  if (m.ext) {
+    put (raw, m.id >> 18, 11);
+    put (raw, 1, 1);                    /* SRR */
+    put (raw, 1, 1);                    /* IDE */
+    put (raw, m.id & 0x3FFFF, 18);
+    put (raw, 0, 1);                    /* RTR, data frame */
+    put (raw, 0, 2);                    /* r1, r0 */
+  } else {
+    put (raw, m.id, 11);
+    put (raw, 0, 1);                    /* RTR */
+    put (raw, 0, 1);                    /* IDE */
+    put (raw, 0, 1);                    /* r0 */
+  }
+  put (raw, m.dlc, 4);
+  for (i = 0; i < m.dlc; i++) put (raw, data[i], 8);
+
+  for (i = 0; i < raw.size (); i++) {   /* CRC-15, x^15+x^14+x^10+x^8+x^7+x^4+x^3+1 */
+    unsigned nxt = raw[i] ^ ((crc >> 14) & 1);
+    crc = (crc << 1) & 0x7FFF;
+    if (nxt) crc ^= 0x4599;
+  }
+  put (raw, crc, 15);
+
+  for (i = 0; i < raw.size (); i++) {   /* a sixth equal bit is preceded by a stuff bit */
+    out.push_back (raw[i]);
+    run  = (raw[i] == last) ? run + 1 : 1;
+    last = raw[i];
+    if (run == 5) {
+      last = (uint8_t)!last;
+      out.push_back (last);
+      run  = 1;
+    }
+  }
+  return out;
+}
+
+#define FIXED_BITS   (1 + 2 + 7)        /* CRC delimiter, ACK slot + delimiter, EOF */
+#define IFS_BITS     3
+
+class Simulator {
+public:
+  Simulator (double bitrate, unsigned mailboxes, bool retx, bool zero, unsigned seed)
+    : bitrate_ (bitrate), mailboxes_ (mailboxes), retx_ (retx), zero_ (zero),
+      rnd_ (seed ? seed : 1), now_ (0), busy_ (0), frames_ (0), collisions_ (0) {}
+
+  bool add (const std::string &node, uint32_t id, bool ext, unsigned dlc,
+            double periodMs, double offsetMs)  {
+    Message m;
+    unsigned n;
+
+    if (dlc > 8 || periodMs <= 0 || id > (ext ? 0x1FFFFFFFUL : 0x7FFUL)) return false;
+    for (n = 0; n < msgs_.size (); n++) {
+      if (msgs_[n].id == id && msgs_[n].ext == ext) return false;   /* ids must be unique */
+    }
+    for (n = 0; n < nodes_.size () && nodes_[n].name != node; n++);
+    if (n == nodes_.size ()) {
+      nodes_.push_back (Node ());
+      nodes_.back ().name = node;
+    }
+    memset (&m, 0, sizeof (m));
+    m.node   = n;
+    m.id     = id;
+    m.ext    = ext;
+    m.dlc    = dlc;
+    m.period = periodMs * 1000.0;
+    m.offset = offsetMs * 1000.0;
+    m.next   = bits (m.offset);
+    m.latMin = ~(uint64_t)0;
+    msgs_.push_back (m);
+    return true;
+  }
+
+  /* N nodes with four messages each, periods from a typical body / powertrain mix */
+  void generate (unsigned nodes)  {
+    static const double per[] = { 10, 20, 50, 100, 100, 200, 500, 1000 };
+    char     name[16];
+    unsigned n, k;
+    uint32_t id;
+
+    for (n = 0; n < nodes; n++) {
+      snprintf (name, sizeof (name), "node%u", n + 1);
+      for (k = 0; k < 4; k++) {
+        do {
+          id = rand32 () % 0x7FF;
+        } while (!add (name, id, false, 1 + rand32 () % 8, per[rand32 () % 8], rand32 () % 10));
+      }
+    }
+  }
+
+  void run (double seconds)  {
+    uint64_t end = bits (seconds * 1e6);
+
+    while (now_ < end) {
+      release ();
+      std::vector<unsigned> cand = contenders ();
+      if (cand.empty ()) {
+        now_ = std::max (now_ + 1, nextRelease ());
+        continue;
+      }
+      arbitrate (cand);
+    }
+  }
+
+  void report () const  {
+    std::vector<unsigned> idx (msgs_.size ());
+    unsigned i;
+    double   us = 1e6 / bitrate_;
+
+    for (i = 0; i < idx.size (); i++) idx[i] = i;
+    std::sort (idx.begin (), idx.end (), [this] (unsigned a, unsigned b) {
+      return prio (msgs_[a]) < prio (msgs_[b]);
+    });
+    printf ("%-10s %9s %4s %8s %8s %10s %10s %10s %5s %7s %6s\n", "node", "id", "dlc",
+            "period", "sent", "min_us", "avg_us", "max_us", "bits", "arblost", "missed");
+    for (i = 0; i < idx.size (); i++) {
+      const Message &m = msgs_[idx[i]];
+      printf ("%-10s %9s %4u %8.1f %8lu %10.1f %10.1f %10.1f %5u %7lu %6lu\n",
+              nodes_[m.node].name.c_str (), idText (m).c_str (), m.dlc, m.period / 1000.0, m.sent,
+              m.sent ? m.latMin * us : 0.0, m.sent ? (double)m.latSum / m.sent * us : 0.0,
+              m.latMax * us, m.bitsMax, m.lost, m.miss);
+    }
+    printf ("\n%lu frames in %.3f s, bus load %.1f %%, %lu arbitration losses\n",
+            frames_, now_ / bitrate_, now_ ? 100.0 * busy_ / now_ : 0.0, collisions_);
+  }
+
+private:
+  uint64_t bits (double us) const { return (uint64_t)(us * bitrate_ / 1e6 + 0.5); }
+
+  uint32_t rand32 ()  {                 /* xorshift32 */
+    rnd_ ^= rnd_ << 13;
+    rnd_ ^= rnd_ >> 17;
+    rnd_ ^= rnd_ << 5;
+    return rnd_;
+  }
+
+  /* arbitration order: lower value wins, a standard id beats an extended one
+     with the same base id */
+  static uint64_t prio (const Message &m)  {
+    return m.ext ? (((uint64_t)(m.id >> 18) << 20) | (1UL << 19) | ((m.id & 0x3FFFF) << 1))
+                 : ((uint64_t)m.id << 20);
+  }
+
+  static std::string idText (const Message &m)  {
+    char t[16];
+    snprintf (t, sizeof (t), m.ext ? "%08X" : "%03X", (unsigned)m.id);
+    return t;
+  }
+
+  uint64_t nextRelease () const  {
+    uint64_t t = ~(uint64_t)0;
+    for (unsigned i = 0; i < msgs_.size (); i++) t = std::min (t, msgs_[i].next);
+    return t;
+  }
+
+  /* application releases and CAN_wrMbx refills of the first empty mailboxes */
+  void release ()  {
+    unsigned i;
+
+    for (i = 0; i < msgs_.size (); i++) {
+      Message &m = msgs_[i];
+      while (m.next <= now_) {
+        Frame f = { i, m.next };
+        if (m.queued) m.miss++;         /* previous instance still waiting */
+        m.queued++;
+        nodes_[m.node].queue.push_back (f);
+        m.offset += m.period;
+        m.next    = bits (m.offset);
+      }
+    }
+    for (i = 0; i < nodes_.size (); i++) {
+      Node &n = nodes_[i];
+      while (n.mbx.size () < mailboxes_ && !n.queue.empty ()) {
+        n.mbx.push_back (n.queue.front ());
+        n.queue.pop_front ();
+      }
+    }
+  }
+
+  /* per node the pending mailbox with the highest priority, as mailbox slot */
+  std::vector<unsigned> contenders ()  {
+    std::vector<unsigned> cand;
+    unsigned i, k, best;
+
+    for (i = 0; i < nodes_.size (); i++) {
+      Node &n = nodes_[i];
+      if (n.mbx.empty ()) continue;
+      for (best = 0, k = 1; k < n.mbx.size (); k++) {
+        if (prio (msgs_[n.mbx[k].msg]) < prio (msgs_[n.mbx[best].msg])) best = k;
+      }
+      std::swap (n.mbx[0], n.mbx[best]);
+      cand.push_back (i);
+    }
+    return cand;
+  }
+
+  /* bit by bit on the wired-AND bus, recessive senders seeing dominant back off */
+  void arbitrate (const std::vector<unsigned> &cand)  {
+    std::vector<std::vector<uint8_t> > stream (cand.size ());
+    std::vector<bool> active (cand.size (), true);
+    uint8_t  data[8];
+    unsigned i, k, left = (unsigned)cand.size (), win = 0;
+
+    for (i = 0; i < cand.size (); i++) {
+      const Message &m = msgs_[nodes_[cand[i]].mbx[0].msg];
+      for (k = 0; k < 8; k++) data[k] = zero_ ? 0 : (uint8_t)rand32 ();
+      stream[i] = frameBits (m, data);
+    }
+    for (k = 0; left > 1; k++) {
+      uint8_t bus = 1;
+      for (i = 0; i < cand.size (); i++) {
+        if (active[i]) bus &= stream[i][k];
+      }
+      for (i = 0; i < cand.size (); i++) {
+        if (active[i] && stream[i][k] != bus) {
+          active[i] = false;
+          left--;
+        }
+      }
+    }
+    for (i = 0; i < cand.size (); i++) {
+      Node &n = nodes_[cand[i]];
+      if (active[i]) {
+        win = i;
+        continue;
+      }
+      collisions_++;
+      msgs_[n.mbx[0].msg].lost++;
+      if (!retx_) {                     /* ALST, the TX hook requeues the frame */
+        n.queue.push_front (n.mbx[0]);
+        n.mbx.erase (n.mbx.begin ());
+      }
+    }
+
+    Node     &n   = nodes_[cand[win]];
+    Message  &m   = msgs_[n.mbx[0].msg];
+    unsigned  len = (unsigned)stream[win].size () + FIXED_BITS;
+    uint64_t  lat = now_ + len - n.mbx[0].release;
+
+    m.sent++;
+    m.queued--;
+    m.latSum += lat;
+    m.latMin  = std::min (m.latMin, lat);
+    m.latMax  = std::max (m.latMax, lat);
+    m.bitsMax = std::max (m.bitsMax, len);
+    n.mbx.erase (n.mbx.begin ());
+    busy_    += len + IFS_BITS;
+    now_     += len + IFS_BITS;
+    frames_++;
+  }
+
+  double               bitrate_;
+  unsigned             mailboxes_;
+  bool                 retx_;
+  bool                 zero_;
+  uint32_t             rnd_;
+  std::vector<Message> msgs_;
+  std::vector<Node>    nodes_;
+  uint64_t             now_;            /* bit times since start */
+  uint64_t             busy_;
+  unsigned long        frames_;
+  unsigned long        collisions_;
+};
+
+static bool load (Simulator &sim, const char *file)  {
+  std::ifstream in (file);
+  std::string   line;
+  unsigned      no = 0;
+
+  if (!in) {
+    fprintf (stderr, "cansim: cannot open %s\n", file);
+    return false;
+  }
+  while (std::getline (in, line)) {
+    std::string node, id, x;
+    unsigned    dlc;
+    double      period, offset = 0;
+
+    no++;
+    line = line.substr (0, line.find ('#'));
+    std::istringstream s (line);
+    if (!(s >> node)) continue;
+    if (!(s >> id >> dlc >> period)) {
+      fprintf (stderr, "cansim: %s:%u: node id dlc period_ms [offset_ms] [x]\n", file, no);
+      return false;
+    }
+    if (s >> x) {
+      if (x != "x") {
+        offset = atof (x.c_str ());
+        x.clear ();
+        s >> x;
+      }
+    }
+    if (!sim.add (node, (uint32_t)strtoul (id.c_str (), 0, 0), x == "x", dlc, period, offset)) {
+      fprintf (stderr, "cansim: %s:%u: invalid or duplicate message\n", file, no);
+      return false;
+    }
+  }
+  return true;
+}
+
+int main (int argc, char **argv)  {
+  double      bitrate = 500000, seconds = 10;
+  unsigned    mailboxes = 3, nodes = 0, seed = 1;
+  bool        retx = false, zero = false;
+  const char *file = 0;
+  int         i;
+
+  for (i = 1; i < argc; i++) {
+    if      (!strcmp (argv[i], "-b") && i + 1 < argc) bitrate   = atof (argv[++i]);
+    else if (!strcmp (argv[i], "-t") && i + 1 < argc) seconds   = atof (argv[++i]);
+    else if (!strcmp (argv[i], "-m") && i + 1 < argc) mailboxes = (unsigned)atoi (argv[++i]);
+    else if (!strcmp (argv[i], "-g") && i + 1 < argc) nodes     = (unsigned)atoi (argv[++i]);
+    else if (!strcmp (argv[i], "-s") && i + 1 < argc) seed      = (unsigned)atoi (argv[++i]);
+    else if (!strcmp (argv[i], "-a"))                 retx      = true;
+    else if (!strcmp (argv[i], "-z"))                 zero      = true;
+    else if (argv[i][0] != '-' && file == 0)          file      = argv[i];
+    else {
+      fprintf (stderr, "usage: cansim [-b bitrate] [-t seconds] [-m mailboxes] [-a]\n"
+                       "              [-g nodes] [-s seed] [-z] [network.txt]\n");
+      return 2;
+    }
+  }
+  if (mailboxes < 1 || mailboxes > 3 || bitrate <= 0 || seconds <= 0 || (!file && !nodes)) {
+    fprintf (stderr, "cansim: need a network file or -g, 1..3 mailboxes\n");
+    return 2;
+  }
+
+  Simulator sim (bitrate, mailboxes, retx, zero, seed);
+  if (file && !load (sim, file)) return 1;
+  if (nodes) sim.generate (nodes);
+  sim.run (seconds);
+  sim.report ();
+  return 0;
+}
@@ -0,0 +1,376 @@
+/*----------------------------------------------------------------------------
+ * Name:    dbcgen.cpp
+ * Purpose: generate C pack / unpack functions from a DBC file
+ * Note(s): host tool, build with  g++ -std=c++11 -O2 -o dbcgen dbcgen.cpp
+ *          usage: dbcgen [-p PREFIX] input.dbc output.h
+ *
+ *          Every message becomes a struct of raw signal values together
+ *          with inline pack and unpack functions. Bit positions, shifts and
+ *          masks are resolved here, so the generated code is a fixed
+ *          sequence of byte loads, shifts and masks per signal. A dispatch
+ *          function switches on the identifier and calls the handler the
+ *          application registered for that message.
+ *----------------------------------------------------------------------------*/
+
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+struct Signal {
+  std::string name;
+  unsigned    start;                    /* DBC start bit */
+  unsigned    len;                      /* length in bits */
+  bool        intel;                    /* @1 little endian, @0 big endian */
+  bool        sign;                     /* '-' signed, '+' unsigned */
+  double      factor;
+  double      offset;
+  std::string unit;
+  int         mux;                      /* -1 plain, -2 multiplexor, n muxed */
+};
+
+struct Message {
+  uint32_t            id;               /* identifier without extended flag */
+  bool                ext;
+  std::string         name;
+  unsigned            dlc;
+  std::vector<Signal> sigs;
+};
+
+/* a run of signal bits that sits contiguously in one frame byte */
+struct Segment {
+  unsigned byte;                        /* frame byte */
+  unsigned byteShift;                   /* lowest bit in that byte */
+  unsigned sigShift;                    /* signal bit stored there */
+  unsigned width;
+};
+
+
+/*----------------------------------------------------------------------------
+  split a signal into byte segments
+ *----------------------------------------------------------------------------*/
+static bool segments (const Signal &s, unsigned dlc, std::vector<Segment> &out)  {
+  std::vector<unsigned> pos (s.len);    /* frame bit of every signal bit */
+  unsigned              p = s.start;
+  unsigned              i;
+
+  if (s.intel) {
+    for (i = 0; i < s.len; i++) pos[i] = s.start + i;
+  } else {                              /* start bit is the MSB          */
+    for (i = s.len; i-- > 0; ) {
+      pos[i] = p;
+      p = (p % 8 == 0) ? p + 15 : p - 1;
+    }
+  }
+  out.clear ();
+  for (i = 0; i < s.len; i++) {
+    if (pos[i] / 8 >= dlc) return false;
+    if (!out.empty ()) {
+      Segment &g = out.back ();
+      if (g.byte == pos[i] / 8 && g.byteShift + g.width == pos[i] % 8) {
+        g.width++;
+        continue;
+      }
+    }
+    Segment g = { pos[i] / 8, pos[i] % 8, i, 1 };
+    out.push_back (g);
+  }
+  return true;
+}
+
+/*----------------------------------------------------------------------------
+  minimal tokenizer helpers for DBC lines
+ *----------------------------------------------------------------------------*/
+static std::string trim (const std::string &s)  {
+  size_t a = s.find_first_not_of (" \t\r\n");
+  size_t b = s.find_last_not_of (" \t\r\n");
+
+  return (a == std::string::npos) ? std::string () : s.substr (a, b - a + 1);
+}
+
+static bool parseMessage (const std::string &line, Message &m)  {
+  char     name[256];
+  unsigned long id;
+  unsigned dlc;
+
+  if (sscanf (line.c_str (), "BO_ %lu %255[^: ] : %u", &id, name, &dlc) != 3) {
+    return false;
+  }
+  m.ext  = (id & 0x80000000UL) != 0;
+  m.id   = (uint32_t)(id & 0x1FFFFFFFUL);
+  m.name = name;
+  m.dlc  = dlc > 8 ? 8 : dlc;
+  return true;
+}
+
+static bool parseSignal (const std::string &line, Signal &s)  {
+  std::string rest = trim (line.substr (3));
+  size_t      colon = rest.find (':');
+  char        order, sign, unit[128] = "";
+  double      mn, mx;
+
+  if (colon == std::string::npos) return false;
+  std::istringstream head (rest.substr (0, colon));
+  std::string        muxTok;
+  head >> s.name >> muxTok;
+  s.mux = -1;
+  if (muxTok == "M")                              s.mux = -2;
+  else if (muxTok.size () > 1 && muxTok[0] == 'm') s.mux = atoi (muxTok.c_str () + 1);
+
+  if (sscanf (rest.c_str () + colon + 1, " %u|%u@%c%c (%lf,%lf) [%lf|%lf] \"%127[^\"]\"",
+              &s.start, &s.len, &order, &sign, &s.factor, &s.offset, &mn, &mx, unit) < 8) {
+    return false;
+  }
+  s.intel = (order == '1');
+  s.sign  = (sign == '-');
+  s.unit  = unit;
+  return s.len > 0 && s.len <= 64;
+}
+
+/*----------------------------------------------------------------------------
+  C type used for a raw signal value
+ *----------------------------------------------------------------------------*/
+static const char *rawType (const Signal &s)  {
+
+  if (s.len > 32) return s.sign ? "int64_t"  : "uint64_t";
+  if (s.len > 16) return s.sign ? "int32_t"  : "uint32_t";
+  if (s.len >  8) return s.sign ? "int16_t"  : "uint16_t";
+  return                 s.sign ? "int8_t"   : "uint8_t";
+}
+
+static std::string upper (std::string s)  {
+
+  std::transform (s.begin (), s.end (), s.begin (), ::toupper);
+  return s;
+}
+
+static std::string hexMask (unsigned width)  {
+  char buf[32];
+
+  snprintf (buf, sizeof (buf), "0x%02XU", (1U << width) - 1);
+  return buf;
+}
+
+/*----------------------------------------------------------------------------
+  accumulator of a signal: v for up to 32 bits, w for wider signals
+ *----------------------------------------------------------------------------*/
+static const char *accName (const Signal &s)  {
+
+  return (s.len > 32) ? "w" : "v";
+}
+
+static const char *accType (const Signal &s)  {
+
+  return (s.len > 32) ? "uint64_t" : "uint32_t";
+}
+
+/*----------------------------------------------------------------------------
+  write the unpack statement of one signal
+ *----------------------------------------------------------------------------*/
+static void emitUnpack (FILE *f, const Signal &s, const std::vector<Segment> &seg)  {
+  const char *acc = accName (s);
+  size_t      i;
+
+  fprintf (f, "  %s = ", acc);
+  for (i = 0; i < seg.size (); i++) {
+    const Segment &g = seg[i];
+    std::string    term = "d[" + std::to_string (g.byte) + "]";
+
+    if (g.byteShift) term = "(" + term + " >> " + std::to_string (g.byteShift) + ")";
+    if (g.byteShift + g.width < 8) term = "(" + term + " & " + hexMask (g.width) + ")";
+    term = std::string ("(") + accType (s) + ")" + term;
+    if (g.sigShift) term = "(" + term + " << " + std::to_string (g.sigShift) + ")";
+    fprintf (f, "%s%s", i ? "\n     | " : "", term.c_str ());
+  }
+  fprintf (f, ";\n");
+  if (s.sign && s.len < 64 && s.len != 8 && s.len != 16 && s.len != 32) {
+    fprintf (f, "  %s = (%s ^ 0x%llXU) - 0x%llXU;\n", acc, acc,
+             1ULL << (s.len - 1), 1ULL << (s.len - 1));
+  }
+  fprintf (f, "  m->%s = (%s)%s;\n", s.name.c_str (), rawType (s), acc);
+}
+
+/*----------------------------------------------------------------------------
+  write the pack statements of one signal
+ *----------------------------------------------------------------------------*/
+static void emitPack (FILE *f, const Signal &s, const std::vector<Segment> &seg, const std::string &muxName)  {
+  const char *acc    = accName (s);
+  const char *indent = (s.mux >= 0) ? "    " : "  ";
+  size_t      i;
+
+  if (s.mux >= 0) {
+    fprintf (f, "  if (m->%s == %d) {\n", muxName.c_str (), s.mux);
+  }
+  fprintf (f, "%s%s = (%s)m->%s;\n", indent, acc, accType (s), s.name.c_str ());
+  for (i = 0; i < seg.size (); i++) {
+    const Segment &g = seg[i];
+    std::string    term = acc;
+
+    if (g.sigShift) term = "(" + term + " >> " + std::to_string (g.sigShift) + ")";
+    if (g.width < 8) term = "(" + term + " & " + hexMask (g.width) + ")";
+    if (g.byteShift) term = "(" + term + " << " + std::to_string (g.byteShift) + ")";
+    fprintf (f, "%sd[%u] |= (uint8_t)%s;\n", indent, g.byte, term.c_str ());
+  }
+  if (s.mux >= 0) {
+    fprintf (f, "  }\n");
+  }
+}
+
+/*----------------------------------------------------------------------------
+  write the accumulator declarations a message needs
+ *----------------------------------------------------------------------------*/
+static void emitLocals (FILE *f, const Message &m)  {
+  bool   narrow = false, wide = false;
+  size_t j;
+
+  for (j = 0; j < m.sigs.size (); j++) {
+    if (m.sigs[j].len > 32) wide   = true;
+    else                    narrow = true;
+  }
+  if (narrow) fprintf (f, "  uint32_t v;\n");
+  if (wide)   fprintf (f, "  uint64_t w;\n");
+  if (narrow || wide) fprintf (f, "\n");
+}
+
+/*----------------------------------------------------------------------------
+  write the generated header
+ *----------------------------------------------------------------------------*/
+static void emit (FILE *f, const std::vector<Message> &msgs, const std::string &pfx, const char *src)  {
+  std::string guard = "__" + upper (pfx) + "_DBC_H";
+  std::vector<Segment> seg;
+
+  fprintf (f, "/*----------------------------------------------------------------------------\n");
+  fprintf (f, " * Name:    %s generated signal access\n", pfx.c_str ());
+  fprintf (f, " * Purpose: pack / unpack functions generated from %s\n", src);
+  fprintf (f, " * Note(s): generated by dbcgen, do not edit\n");
+  fprintf (f, " *----------------------------------------------------------------------------*/\n\n");
+  fprintf (f, "#ifndef %s\n#define %s\n\n", guard.c_str (), guard.c_str ());
+  fprintf (f, "#include <stdint.h>\n#include \"CAN.h\"\n\n");
+  fprintf (f, "#ifndef DBC_INLINE\n#define DBC_INLINE static __inline\n#endif\n\n");
+
+  for (size_t k = 0; k < msgs.size (); k++) {
+    const Message &m  = msgs[k];
+    std::string    M  = upper (pfx + "_" + m.name);
+    std::string    T  = pfx + "_" + m.name;
+    std::string    muxName;
+
+    fprintf (f, "/* %s */\n", m.name.c_str ());
+    fprintf (f, "#define %s_ID      0x%08XU\n", M.c_str (), m.id);
+    fprintf (f, "#define %s_FORMAT  %s\n", M.c_str (), m.ext ? "EXTENDED_FORMAT" : "STANDARD_FORMAT");
+    fprintf (f, "#define %s_DLC     %u\n", M.c_str (), m.dlc);
+    for (size_t j = 0; j < m.sigs.size (); j++) {
+      const Signal &s = m.sigs[j];
+      if (s.mux == -2) muxName = s.name;
+      fprintf (f, "#define %s_%s_FACTOR  %.10g\n", M.c_str (), upper (s.name).c_str (), s.factor);
+      fprintf (f, "#define %s_%s_OFFSET  %.10g\n", M.c_str (), upper (s.name).c_str (), s.offset);
+    }
+    fprintf (f, "\ntypedef struct  {\n");
+    for (size_t j = 0; j < m.sigs.size (); j++) {
+      const Signal &s = m.sigs[j];
+      fprintf (f, "  %-9s %s;%s%s\n", rawType (s), s.name.c_str (),
+               s.unit.empty () ? "" : "  /* ", s.unit.empty () ? "" : (s.unit + " */").c_str ());
+    }
+    if (m.sigs.empty ()) fprintf (f, "  uint8_t   unused;\n");
+    fprintf (f, "} %s;\n\n", T.c_str ());
+
+    fprintf (f, "DBC_INLINE void %s_unpack (%s *m, const uint8_t *d)  {\n", T.c_str (), T.c_str ());
+    emitLocals (f, m);
+    for (size_t j = 0; j < m.sigs.size (); j++) {
+      segments (m.sigs[j], m.dlc, seg);
+      emitUnpack (f, m.sigs[j], seg);
+    }
+    if (m.sigs.empty ()) fprintf (f, "  (void)m; (void)d;\n");
+    fprintf (f, "}\n\n");
+
+    fprintf (f, "DBC_INLINE void %s_pack (const %s *m, uint8_t *d)  {\n", T.c_str (), T.c_str ());
+    emitLocals (f, m);
+    for (unsigned b = 0; b < m.dlc; b++) fprintf (f, "  d[%u] = 0;\n", b);
+    for (size_t j = 0; j < m.sigs.size (); j++) {
+      segments (m.sigs[j], m.dlc, seg);
+      emitPack (f, m.sigs[j], seg, muxName);
+    }
+    if (m.sigs.empty ()) fprintf (f, "  (void)m; (void)d;\n");
+    fprintf (f, "}\n\n");
+  }
+
+  /* handler table and dispatch */
+  fprintf (f, "typedef struct  {\n");
+  for (size_t k = 0; k < msgs.size (); k++) {
+    fprintf (f, "  void (*%s) (const %s_%s *m);\n", msgs[k].name.c_str (), pfx.c_str (), msgs[k].name.c_str ());
+  }
+  if (msgs.empty ()) fprintf (f, "  void (*unused) (void);\n");
+  fprintf (f, "} %s_handlers;\n\n", pfx.c_str ());
+
+  fprintf (f, "/* unpack a received frame and call its handler, returns 0 for unknown ids */\n");
+  fprintf (f, "DBC_INLINE int %s_dispatch (const %s_handlers *h, const CAN_msg *msg)  {\n", pfx.c_str (), pfx.c_str ());
+  fprintf (f, "  uint32_t key = msg->id | ((msg->format == EXTENDED_FORMAT) ? 0x80000000U : 0);\n\n");
+  fprintf (f, "  switch (key) {\n");
+  for (size_t k = 0; k < msgs.size (); k++) {
+    const Message &m = msgs[k];
+    std::string    T = pfx + "_" + m.name;
+    fprintf (f, "    case 0x%08XU: {\n", m.id | (m.ext ? 0x80000000U : 0));
+    fprintf (f, "      %s v;\n", T.c_str ());
+    fprintf (f, "      if (msg->len < %u || h->%s == 0) return 1;\n", m.dlc, m.name.c_str ());
+    fprintf (f, "      %s_unpack (&v, msg->data);\n", T.c_str ());
+    fprintf (f, "      h->%s (&v);\n", m.name.c_str ());
+    fprintf (f, "      return 1;\n    }\n");
+  }
+  fprintf (f, "    default:\n      return 0;\n  }\n}\n\n");
+  fprintf (f, "#endif\n");
+}
+
+int main (int argc, char **argv)  {
+  std::string          pfx = "DBC";
+  std::vector<Message> msgs;
+  std::string          line;
+  int                  a = 1;
+
+  if (argc > 2 && std::string (argv[1]) == "-p") {
+    pfx = argv[2];
+    a   = 3;
+  }
+  if (argc - a != 2) {
+    fprintf (stderr, "usage: dbcgen [-p PREFIX] input.dbc output.h\n");
+    return 2;
+  }
+  std::ifstream in (argv[a]);
+  if (!in) {
+    fprintf (stderr, "dbcgen: cannot open %s\n", argv[a]);
+    return 1;
+  }
+  while (std::getline (in, line)) {
+    std::string t = trim (line);
+    Message     m;
+    Signal      s;
+
+    if (t.compare (0, 4, "BO_ ") == 0 && parseMessage (t, m)) {
+      msgs.push_back (m);
+    } else if (t.compare (0, 4, "SG_ ") == 0 && !msgs.empty ()) {
+      if (parseSignal (t, s)) {
+        std::vector<Segment> seg;
+        if (!segments (s, msgs.back ().dlc, seg)) {
+          fprintf (stderr, "dbcgen: %s.%s does not fit in %u bytes, skipped\n",
+                   msgs.back ().name.c_str (), s.name.c_str (), msgs.back ().dlc);
+          continue;
+        }
+        msgs.back ().sigs.push_back (s);
+      } else {
+        fprintf (stderr, "dbcgen: cannot parse: %s\n", t.c_str ());
+      }
+    }
+  }
+
+  FILE *f = fopen (argv[a + 1], "w");
+  if (!f) {
+    fprintf (stderr, "dbcgen: cannot create %s\n", argv[a + 1]);
+    return 1;
+  }
+  emit (f, msgs, pfx, argv[a]);
+  fclose (f);
+  return 0;
+}
@@ -0,0 +1,214 @@
+/*----------------------------------------------------------------------------
+ * Name:    swodec.cpp
+ * Purpose: decode CAN frame records from a raw SWO capture
+ * Note(s): host tool, build with  g++ -std=c++11 -O2 -o swodec swodec.cpp
+ *          usage: swodec [-c core_hz] [-p port] [-x] capture.bin > frames.log
+ *
+ *          Reads the ITM packet stream as written by the SWO pin (e.g. the
+ *          trace file of the debugger or a UART capture in NRZ mode) and
+ *          prints the records of Trace.c in candump log format. With -x
+ *          the direction is appended to every line. Characters sent on
+ *          stimulus port 0 (printf over __DBG_ITM) are copied to stderr.
+ *          Time stamps are built from DWT cycle counter deltas, so the bus
+ *          must not be silent for longer than one counter wrap (25 s at
+ *          168 MHz). The core clock given with -c applies until the first
+ *          clock record of Trace.c, which TRC_init and every clock profile
+ *          switch write; from then on the recorded clock is used.
+ *----------------------------------------------------------------------------*/
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+class FrameDecoder {
+public:
+  FrameDecoder (unsigned port, double coreHz, bool dir)
+    : port_ (port), coreHz_ (coreHz), dir_ (dir), need_ (0), lastCyc_ (0),
+      time_ (0), started_ (false), lost_ (0) {}
+
+  /* one 32-bit word written to stimulus port 'port' */
+  void word (unsigned port, uint32_t w)  {
+    if (port == port_) {
+      if (need_ != 0) lost_++;          /* previous record incomplete    */
+      rec_.assign (1, w);
+      need_ = (w == CLOCK) ? 3 : 2;     /* clock: hclk, pre, post        */
+    } else if (port == port_ + 1 && need_ != 0) {
+      rec_.push_back (w);
+      if (rec_.size () == 2 && rec_[0] != CLOCK) {
+        unsigned len = rec_[1] & 0x0F;
+        bool     rtr = (rec_[0] >> 30) & 1;
+        if (len > 8) len = 8;
+        need_ += (rtr || len == 0) ? 0 : (len > 4 ? 2 : 1);
+      }
+      if (--need_ == 0) emit ();
+    }
+  }
+
+  unsigned long lost () const { return lost_; }
+
+private:
+  static const uint32_t CLOCK = 0x1FFFFFFF;  /* TRC_CLOCK */
+
+  /* the clock in rec_[1] counts from cycle rec_[3] on, the old one up to rec_[2] */
+  void clock ()  {
+    if (started_) time_ += (double)(uint32_t)(rec_[2] - lastCyc_) / coreHz_;
+    started_ = true;
+    lastCyc_ = rec_[3];
+    if (rec_[1] != 0) coreHz_ = rec_[1];
+  }
+
+  void emit ()  {
+    uint32_t hdr = rec_[0];
+    unsigned len = rec_[1] & 0x0F;
+    unsigned ctrl = (rec_[1] >> 4) & 1;
+    uint32_t cyc = rec_[2];
+    bool     ext = (hdr >> 29) & 1;
+    bool     rtr = (hdr >> 30) & 1;
+    bool     tx  = (hdr >> 31) & 1;
+    uint8_t  data[8];
+    unsigned i;
+
+    if (hdr == CLOCK) {
+      clock ();
+      return;
+    }
+    if (started_) time_ += (double)(uint32_t)(cyc - lastCyc_) / coreHz_;
+    started_ = true;
+    lastCyc_ = cyc;
+
+    for (i = 0; i < 8; i++) {
+      size_t k = 3 + i / 4;
+      data[i] = (k < rec_.size ()) ? (uint8_t)(rec_[k] >> (8 * (i % 4))) : 0;
+    }
+    printf ("(%.6f) can%u ", time_, ctrl);
+    if (ext) printf ("%08X#", hdr & 0x1FFFFFFF);
+    else     printf ("%03X#",  hdr & 0x7FF);
+    if (rtr) {
+      printf ("R");
+    } else {
+      for (i = 0; i < len && i < 8; i++) printf ("%02X", data[i]);
+    }
+    if (dir_) printf (" %s", tx ? "tx" : "rx");
+    printf ("\n");
+  }
+
+  unsigned              port_;
+  double                coreHz_;
+  bool                  dir_;
+  unsigned              need_;          /* words missing in the record   */
+  std::vector<uint32_t> rec_;
+  uint32_t              lastCyc_;
+  double                time_;          /* s up to lastCyc_              */
+  bool                  started_;
+  unsigned long         lost_;
+};
+
+/*----------------------------------------------------------------------------
+  ITM packet parser (ARMv7-M debug architecture, appendix D4)
+ *----------------------------------------------------------------------------*/
+class ItmParser {
+public:
+  explicit ItmParser (FrameDecoder &dec) : dec_ (dec), state_ (HEADER), zeros_ (0) {}
+
+  void byte (uint8_t b)  {
+    switch (state_) {
+      case HEADER:
+        header (b);
+        break;
+      case PAYLOAD:
+        payload_ |= (uint32_t)b << (8 * got_);
+        if (++got_ == size_) {
+          if (!hw_) deliver ();
+          state_ = HEADER;
+        }
+        break;
+      case CONTINUATION:                  /* time stamp / extension bytes  */
+        if ((b & 0x80) == 0) state_ = HEADER;
+        break;
+    }
+  }
+
+private:
+  enum State { HEADER, PAYLOAD, CONTINUATION };
+
+  void header (uint8_t b)  {
+    if (b == 0x00) {                      /* part of a synchronisation     */
+      zeros_++;
+      return;
+    }
+    if (zeros_ >= 5 && b == 0x80) {       /* end of synchronisation packet */
+      zeros_ = 0;
+      return;
+    }
+    zeros_ = 0;
+    if (b == 0x70) return;                /* overflow                      */
+    if ((b & 0x03) != 0) {                /* source packet                 */
+      static const unsigned sz[4] = { 0, 1, 2, 4 };
+      size_   = sz[b & 0x03];
+      hw_     = (b & 0x04) != 0;
+      port_   = b >> 3;
+      payload_ = 0;
+      got_    = 0;
+      state_  = PAYLOAD;
+      return;
+    }
+    if (b & 0x80) state_ = CONTINUATION;  /* time stamp or extension       */
+  }
+
+  void deliver ()  {
+    if (port_ == 0) {
+      for (unsigned i = 0; i < size_; i++) fputc ((int)((payload_ >> (8 * i)) & 0xFF), stderr);
+    } else if (size_ == 4) {
+      dec_.word (port_, payload_);
+    }
+  }
+
+  FrameDecoder &dec_;
+  State         state_;
+  unsigned      zeros_;
+  unsigned      size_, got_, port_;
+  bool          hw_;
+  uint32_t      payload_;
+};
+
+int main (int argc, char **argv)  {
+  double      coreHz = 168e6;
+  unsigned    port   = 8;
+  bool        dir    = false;
+  const char *file   = 0;
+  int         i;
+
+  for (i = 1; i < argc; i++) {
+    if      (!strcmp (argv[i], "-c") && i + 1 < argc) coreHz = atof (argv[++i]);
+    else if (!strcmp (argv[i], "-p") && i + 1 < argc) port   = (unsigned)atoi (argv[++i]);
+    else if (!strcmp (argv[i], "-x"))                 dir    = true;
+    else if (argv[i][0] != '-' && file == 0)          file   = argv[i];
+    else {
+      fprintf (stderr, "usage: swodec [-c core_hz] [-p port] [-x] capture.bin\n");
+      return 2;
+    }
+  }
+  if (port > 30 || coreHz <= 0) {
+    fprintf (stderr, "swodec: invalid port or clock\n");
+    return 2;
+  }
+
+  FILE *f = file ? fopen (file, "rb") : stdin;
+  if (!f) {
+    fprintf (stderr, "swodec: cannot open %s\n", file);
+    return 1;
+  }
+  FrameDecoder dec (port, coreHz, dir);
+  ItmParser    itm (dec);
+  uint8_t      buf[4096];
+  size_t       n;
+
+  while ((n = fread (buf, 1, sizeof (buf), f)) > 0) {
+    for (size_t k = 0; k < n; k++) itm.byte (buf[k]);
+  }
+  if (file) fclose (f);
+  if (dec.lost ()) fprintf (stderr, "swodec: %lu incomplete records\n", dec.lost ());
+  return 0;
+}
@@ -0,0 +1,118 @@
+#include <stm32f4xx.h>
+#include "Clock.h"
+#include "Trace.h"
+
+#define TRC_PORTS     (3UL << TRC_PORT)
+
+static uint32_t  TRC_t0;                          /* cycle count at TRC_init   */
+static uint32_t  TRC_swo;                         /* SWO bit rate, 0 = unknown */
+static uint32_t  TRC_pre;                         /* cycles at CLK_PRE         */
+
+/*----------------------------------------------------------------------------
+  write one word to a stimulus port, waits while the port FIFO is full
+ *----------------------------------------------------------------------------*/
+static __inline void trc_put (uint32_t port, uint32_t word)  {
+
+  while (ITM->PORT[port].u32 == 0);
+  ITM->PORT[port].u32 = word;
+}
+
+/*----------------------------------------------------------------------------
+  ITM and both trace ports are enabled
+ *----------------------------------------------------------------------------*/
+static __inline uint32_t trc_on (void)  {
+
+  return ((ITM->TCR & ITM_TCR_ITMENA_Msk) && (ITM->TER & TRC_PORTS) == TRC_PORTS);
+}
+
+/*----------------------------------------------------------------------------
+  write a clock record: the core clock that counts from cycle 'post' on,
+  the previous one counted up to cycle 'pre'
+ *----------------------------------------------------------------------------*/
+static void trc_clkRec (uint32_t hclk, uint32_t pre, uint32_t post)  {
+  uint32_t primask;
+
+  if (!trc_on ()) {
+    return;
+  }
+  primask = __get_PRIMASK();
+  __disable_irq();
+  trc_put (TRC_PORT,     TRC_CLOCK);
+  trc_put (TRC_PORT + 1, hclk);
+  trc_put (TRC_PORT + 1, pre);
+  trc_put (TRC_PORT + 1, post);
+  __set_PRIMASK(primask);
+}
+
+/*----------------------------------------------------------------------------
+  clock profile switch: SWO is clocked from HCLK, keep its bit rate and
+  tell the decoder the new cycle counter rate
+ *----------------------------------------------------------------------------*/
+static uint32_t trc_clock (uint32_t phase, const CLK_info *clk)  {
+
+  if (phase == CLK_PRE) {
+    if (ITM->TCR & ITM_TCR_ITMENA_Msk) {
+      while (ITM->TCR & ITM_TCR_BUSY_Msk);  /* drain at the old bit rate    */
+    }
+    TRC_pre = DWT->CYCCNT - TRC_t0;
+  } else if (phase == CLK_POST) {
+    if (TRC_swo) {
+      TPI->ACPR = (clk->hclk + TRC_swo / 2) / TRC_swo - 1;
+    }
+    trc_clkRec (clk->hclk, TRC_pre, DWT->CYCCNT - TRC_t0);
+  }
+  return (1);
+}
+
+/*----------------------------------------------------------------------------
+  start the cycle counter used for time stamps and request the trace ports
+  ITM itself and the SWO pin are set up by the debugger, the SWO bit rate
+  it chose is kept across clock profile switches. The counter is shared
+  with CAN.c and CanLog.c and never reset, time stamps count from here
+ *----------------------------------------------------------------------------*/
+void TRC_init (void)  {
+
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL        |= DWT_CTRL_CYCCNTENA_Msk;
+  TRC_t0            = DWT->CYCCNT;
+  ITM->TER         |= TRC_PORTS;
+  TRC_swo           = CLK_get ()->hclk / (TPI->ACPR + 1);
+  CLK_notify (trc_clock);
+  trc_clkRec (CLK_get ()->hclk, 0, 0);      /* rate of the first stamps     */
+}
+
+/*----------------------------------------------------------------------------
+  write a frame record, nothing is written while ITM or a port is disabled
+  called from thread and interrupt level, so a record is written with
+  interrupts disabled to keep it contiguous
+ *----------------------------------------------------------------------------*/
+void TRC_frame (uint32_t ctrl, CAN_msg *msg, uint32_t dir)  {
+  uint32_t hdr, len, primask;
+  uint8_t *d = msg->data;
+
+  if (!trc_on ()) {
+    return;
+  }
+  hdr = msg->id & 0x1FFFFFFF;
+  if (msg->format == EXTENDED_FORMAT) hdr |= 1UL << 29;
+  if (msg->type   == REMOTE_FRAME)    hdr |= 1UL << 30;
+  if (dir         == TRC_TX)          hdr |= 1UL << 31;
+  len = msg->len & 0x0F;
+
+  primask = __get_PRIMASK();
+  __disable_irq();
+  trc_put (TRC_PORT,     hdr);
+  trc_put (TRC_PORT + 1, len | ((ctrl - 1) << 4));
+  trc_put (TRC_PORT + 1, DWT->CYCCNT - TRC_t0);
+  if (msg->type == DATA_FRAME) {
+    if (len > 0) {
+      trc_put (TRC_PORT + 1, ((uint32_t)d[3] << 24) | ((uint32_t)d[2] << 16) |
+                             ((uint32_t)d[1] <<  8) |  (uint32_t)d[0]);
+    }
+    if (len > 4) {
+      trc_put (TRC_PORT + 1, ((uint32_t)d[7] << 24) | ((uint32_t)d[6] << 16) |
+                             ((uint32_t)d[5] <<  8) |  (uint32_t)d[4]);
+    }
+  }
+  __set_PRIMASK(primask);
+}
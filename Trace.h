@@ -0,0 +1,46 @@
+/*----------------------------------------------------------------------------
+ * Name:    Trace.h
+ * Purpose: binary trace of CAN frames over ITM / SWO
+ * Note(s): every frame is written as 32-bit words to two ITM stimulus ports,
+ *          the header word goes to TRC_PORT, the rest of the record to
+ *          TRC_PORT+1. Port 0 stays free for printf over __DBG_ITM.
+ *          CAN.c traces its frames when compiled with __CAN_TRACE, the
+ *          debugger has to enable ITM, the two ports and SWO output.
+ *          Tools/swodec.cpp turns a SWO capture back into a frame log.
+ *
+ *          record:  TRC_PORT    id | EXT << 29 | RTR << 30 | TX << 31
+ *                   TRC_PORT+1  dlc | (ctrl-1) << 4
+ *                   TRC_PORT+1  DWT cycles since TRC_init
+ *                   TRC_PORT+1  data[0..3]   if dlc > 0 and not RTR
+ *                   TRC_PORT+1  data[4..7]   if dlc > 4 and not RTR
+ *
+ *          TRC_init and every clock profile switch write a clock record,
+ *          its header is TRC_CLOCK, which no frame can have (standard id
+ *          above 0x7FF). The previous core clock counted up to cycle
+ *          'pre', the new one counts from cycle 'post' on:
+ *
+ *          clock:   TRC_PORT    TRC_CLOCK
+ *                   TRC_PORT+1  HCLK in Hz
+ *                   TRC_PORT+1  pre
+ *                   TRC_PORT+1  post
+ *----------------------------------------------------------------------------*/
+
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <stdint.h>
+#include "CAN.h"
+
+/* Trace configuration */
+#define TRC_PORT            8                /* header port, payload on +1     */
+#define TRC_CLOCK  0x1FFFFFFFUL              /* header of a clock record       */
+
+/* frame direction */
+#define TRC_RX              0
+#define TRC_TX              1                /* loaded into a TX mailbox       */
+
+/* Functions defined in module Trace.c */
+void     TRC_init      (void);
+void     TRC_frame     (uint32_t ctrl, CAN_msg *msg, uint32_t dir);
+
+#endif